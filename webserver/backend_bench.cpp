@@ -0,0 +1,239 @@
+#include "asio.hpp"
+#include "beast.hpp"
+
+#include <boost/beast/http.hpp>
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <sys/resource.h>
+
+// Compare asio's reactor backends on this host.
+// The same source is built as backend_bench_epoll and, with WEBSERVER_IO_URING, as
+// backend_bench_uring. Each measures, over loopback with the server on one thread and the
+// client on another:
+//   accept rate    - connections accepted and closed per second
+//   http           - small keep-alive GETs per second
+//   websocket echo - 64 byte messages echoed per second
+// Run both binaries on the host in question and keep the faster backend for its build.
+
+using namespace std::literals;
+using clock_type = std::chrono::steady_clock;
+
+enum class bench_mode
+{
+    accept,
+    http,
+    websocket
+};
+
+struct bench_options
+{
+    std::size_t connections = 50;
+    std::chrono::seconds duration { 5 };
+};
+
+/// Serve one connection until the client closes it.
+asio::awaitable< void >
+serve(asio::ip::tcp::socket sock, bench_mode mode)
+{
+    namespace http = beast::http;
+
+    sock.set_option(asio::ip::tcp::no_delay(true));
+    auto buffer = beast::flat_buffer();
+    try
+    {
+        if (mode == bench_mode::http)
+        {
+            auto res = http::response< http::string_body >(http::status::ok, 11);
+            res.set(http::field::content_type, "text/plain");
+            res.body() = "Hello, World!";
+            res.prepare_payload();
+            for (;;)
+            {
+                auto req = http::request< http::empty_body >();
+                co_await http::async_read(sock, buffer, req, asio::use_awaitable);
+                co_await http::async_write(sock, res, asio::use_awaitable);
+            }
+        }
+        else if (mode == bench_mode::websocket)
+        {
+            auto ws = beast::websocket::stream< asio::ip::tcp::socket& >(sock);
+            co_await ws.async_accept(asio::use_awaitable);
+            for (;;)
+            {
+                co_await ws.async_read(buffer, asio::use_awaitable);
+                ws.text(ws.got_text());
+                co_await ws.async_write(buffer.data(), asio::use_awaitable);
+                buffer.consume(buffer.size());
+            }
+        }
+    }
+    catch (std::exception&)
+    {
+        // the client closed the connection
+    }
+}
+
+asio::awaitable< void >
+accept_loop(asio::ip::tcp::acceptor& acceptor, bench_mode mode)
+{
+    for (;;)
+    {
+        auto sock = co_await acceptor.async_accept(asio::use_awaitable);
+        if (mode == bench_mode::accept)
+            continue;
+        asio::co_spawn(acceptor.get_executor(), serve(std::move(sock), mode), asio::detached);
+    }
+}
+
+/// One client connection. Counts completed operations until the deadline.
+asio::awaitable< void >
+client(asio::ip::tcp::endpoint ep, bench_mode mode, clock_type::time_point deadline, std::uint64_t& count)
+{
+    namespace http = beast::http;
+
+    auto exec = co_await asio::this_coro::executor;
+    if (mode == bench_mode::accept)
+    {
+        while (clock_type::now() < deadline)
+        {
+            auto sock = asio::ip::tcp::socket(exec);
+            co_await sock.async_connect(ep, asio::use_awaitable);
+
+            // wait for the server's close, so that connections are counted once accepted
+            char c;
+            auto ec = error_code();
+            co_await sock.async_read_some(asio::buffer(&c, 1), asio::redirect_error(asio::use_awaitable, ec));
+            ++count;
+        }
+        co_return;
+    }
+
+    auto sock = asio::ip::tcp::socket(exec);
+    co_await sock.async_connect(ep, asio::use_awaitable);
+    sock.set_option(asio::ip::tcp::no_delay(true));
+    auto buffer = beast::flat_buffer();
+
+    if (mode == bench_mode::http)
+    {
+        auto req = http::request< http::empty_body >(http::verb::get, "/", 11);
+        req.set(http::field::host, "localhost");
+        while (clock_type::now() < deadline)
+        {
+            co_await http::async_write(sock, req, asio::use_awaitable);
+            auto res = http::response< http::string_body >();
+            co_await http::async_read(sock, buffer, res, asio::use_awaitable);
+            ++count;
+        }
+    }
+    else
+    {
+        auto ws = beast::websocket::stream< asio::ip::tcp::socket& >(sock);
+        co_await ws.async_handshake("localhost", "/", asio::use_awaitable);
+        auto const message = std::string(64, 'x');
+        while (clock_type::now() < deadline)
+        {
+            co_await ws.async_write(asio::buffer(message), asio::use_awaitable);
+            co_await ws.async_read(buffer, asio::use_awaitable);
+            buffer.consume(buffer.size());
+            ++count;
+        }
+        co_await ws.async_close(beast::websocket::close_code::normal, asio::use_awaitable);
+    }
+}
+
+/// @return operations per second
+double
+measure(bench_mode mode, bench_options const& opts)
+{
+    auto server_ioc = asio::io_context(1);
+    auto acceptor   = asio::ip::tcp::acceptor(server_ioc, { asio::ip::make_address("127.0.0.1"), 0 });
+    acceptor.listen(asio::socket_base::max_listen_connections);
+    auto const ep = acceptor.local_endpoint();
+    asio::co_spawn(server_ioc, accept_loop(acceptor, mode), asio::detached);
+    auto server = std::thread([&] { server_ioc.run(); });
+
+    auto client_ioc = asio::io_context(1);
+    auto count      = std::uint64_t(0);
+    auto const start    = clock_type::now();
+    auto const deadline = start + opts.duration;
+    for (std::size_t i = 0; i < opts.connections; ++i)
+        asio::co_spawn(client_ioc, client(ep, mode, deadline, count), [](std::exception_ptr ep)
+        {
+            if (ep)
+                std::rethrow_exception(ep);
+        });
+    client_ioc.run();
+    auto const elapsed = std::chrono::duration< double >(clock_type::now() - start).count();
+
+    asio::post(server_ioc, [&] { server_ioc.stop(); });
+    server.join();
+    return double(count) / elapsed;
+}
+
+/// Allow as many file descriptors as the hard limit permits, since the accept test churns them.
+void
+raise_fd_limit()
+{
+    auto lim = rlimit();
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+}
+
+const char* const usage = "usage: backend_bench [-c connections] [-d seconds]";
+
+bench_options
+parse_options(int argc, char** argv)
+{
+    auto opts = bench_options();
+    auto number = [](std::string_view s)
+    {
+        auto value = std::size_t(0);
+        auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+        if (ec != std::errc() || ptr != s.data() + s.size() || value == 0)
+            throw std::invalid_argument(usage);
+        return value;
+    };
+
+    for (int i = 1; i < argc; ++i)
+    {
+        auto const arg = std::string_view(argv[i]);
+        if (i + 1 == argc)
+            throw std::invalid_argument(usage);
+        if (arg == "-c")
+            opts.connections = number(argv[++i]);
+        else if (arg == "-d")
+            opts.duration = std::chrono::seconds(number(argv[++i]));
+        else
+            throw std::invalid_argument(usage);
+    }
+    return opts;
+}
+
+int
+main(int argc, char** argv)
+try
+{
+    auto const opts = parse_options(argc, argv);
+    raise_fd_limit();
+
+    std::cout << "backend        : " << asio_backend << '\n'
+              << "accept rate    : " << measure(bench_mode::accept, opts) << " conn/s\n"
+              << "http           : " << measure(bench_mode::http, opts) << " req/s\n"
+              << "websocket echo : " << measure(bench_mode::websocket, opts) << " msg/s\n";
+}
+catch (std::exception& e)
+{
+    std::cerr << "backend_bench: " << e.what() << '\n';
+    return 1;
+}
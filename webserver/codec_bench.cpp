@@ -0,0 +1,179 @@
+#include "asio.hpp"
+#include "beast.hpp"
+#include "any_websocket.hpp"
+
+#include <boost/beast/http.hpp>
+
+#include <charconv>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+
+// Compare any_websocket's codecs on wsecho's traffic: each message is read and written straight
+// back from the receive buffer. The server runs on one thread and beast websocket clients on
+// another, over loopback. Text messages of several sizes are echoed in turn on every connection,
+// first with beast::websocket::stream behind any_websocket and then with native_websock.
+
+using namespace std::literals;
+using clock_type = std::chrono::steady_clock;
+
+struct bench_options
+{
+    std::size_t connections = 50;
+    std::chrono::seconds duration { 3 };
+};
+
+asio::awaitable< void >
+serve(asio::ip::tcp::socket sock, websocket_codec codec)
+{
+    sock.set_option(asio::ip::tcp::no_delay(true));
+    try
+    {
+        auto rxbuf   = beast::flat_buffer();
+        auto request = any_websocket::request_type();
+        co_await beast::http::async_read(sock, rxbuf, request, asio::use_awaitable);
+
+        auto ws = std::make_shared< any_websocket >(std::move(sock), std::move(rxbuf), codec);
+        co_await ws->accept(request);
+        for (;;)
+        {
+            auto frame = co_await ws->read();
+            co_await ws->write(frame);
+        }
+    }
+    catch (std::exception&)
+    {
+        // the client closed the connection
+    }
+}
+
+asio::awaitable< void >
+accept_loop(asio::ip::tcp::acceptor& acceptor, websocket_codec codec)
+{
+    for (;;)
+    {
+        auto sock = co_await acceptor.async_accept(asio::use_awaitable);
+        asio::co_spawn(acceptor.get_executor(), serve(std::move(sock), codec), asio::detached);
+    }
+}
+
+/// One client connection. Counts messages echoed until the deadline.
+asio::awaitable< void >
+client(asio::ip::tcp::endpoint ep, std::string const& message, clock_type::time_point deadline, std::uint64_t& count)
+{
+    auto ws = beast::websocket::stream< asio::ip::tcp::socket >(co_await asio::this_coro::executor);
+    co_await ws.next_layer().async_connect(ep, asio::use_awaitable);
+    ws.next_layer().set_option(asio::ip::tcp::no_delay(true));
+    co_await ws.async_handshake("localhost", "/", asio::use_awaitable);
+
+    auto buffer = beast::flat_buffer();
+    while (clock_type::now() < deadline)
+    {
+        co_await ws.async_write(asio::buffer(message), asio::use_awaitable);
+        co_await ws.async_read(buffer, asio::use_awaitable);
+        if (buffer.size() != message.size())
+            throw std::logic_error("echo does not match");
+        buffer.consume(buffer.size());
+        ++count;
+    }
+    co_await ws.async_close(beast::websocket::close_code::normal, asio::use_awaitable);
+}
+
+/// @return messages echoed per second
+double
+measure(websocket_codec codec, std::string const& message, bench_options const& opts)
+{
+    auto server_ioc = asio::io_context(1);
+    auto acceptor   = asio::ip::tcp::acceptor(server_ioc, { asio::ip::make_address("127.0.0.1"), 0 });
+    acceptor.listen(asio::socket_base::max_listen_connections);
+    auto const ep = acceptor.local_endpoint();
+    asio::co_spawn(server_ioc, accept_loop(acceptor, codec), asio::detached);
+    auto server = std::thread([&] { server_ioc.run(); });
+
+    auto client_ioc = asio::io_context(1);
+    auto count      = std::uint64_t(0);
+    auto const start    = clock_type::now();
+    auto const deadline = start + opts.duration;
+    for (std::size_t i = 0; i < opts.connections; ++i)
+        asio::co_spawn(client_ioc, client(ep, message, deadline, count), [](std::exception_ptr ep)
+        {
+            if (ep)
+                std::rethrow_exception(ep);
+        });
+    client_ioc.run();
+    auto const elapsed = std::chrono::duration< double >(clock_type::now() - start).count();
+
+    asio::post(server_ioc, [&] { server_ioc.stop(); });
+    server.join();
+    return double(count) / elapsed;
+}
+
+/// Text of the given size, mostly ascii with some multibyte characters, as chat traffic is.
+std::string
+make_message(std::size_t size)
+{
+    auto const pattern = "websocket message caf\xC3\xA9 \xE6\x97\xA5\xE6\x9C\xAC "sv;
+    auto s = std::string();
+    while (s.size() + pattern.size() <= size)
+        s += pattern;
+    s.append(size - s.size(), 'x');
+    return s;
+}
+
+const char* const usage = "usage: codec_bench [-c connections] [-d seconds]";
+
+bench_options
+parse_options(int argc, char** argv)
+{
+    auto opts = bench_options();
+    auto number = [](std::string_view s)
+    {
+        auto value = std::size_t(0);
+        auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+        if (ec != std::errc() || ptr != s.data() + s.size() || value == 0)
+            throw std::invalid_argument(usage);
+        return value;
+    };
+
+    for (int i = 1; i < argc; ++i)
+    {
+        auto const arg = std::string_view(argv[i]);
+        if (i + 1 == argc)
+            throw std::invalid_argument(usage);
+        if (arg == "-c")
+            opts.connections = number(argv[++i]);
+        else if (arg == "-d")
+            opts.duration = std::chrono::seconds(number(argv[++i]));
+        else
+            throw std::invalid_argument(usage);
+    }
+    return opts;
+}
+
+int
+main(int argc, char** argv)
+try
+{
+    auto const opts = parse_options(argc, argv);
+
+    std::cout << std::setw(8) << "size" << std::setw(14) << "beast msg/s" << std::setw(14) << "native msg/s"
+              << std::setw(10) << "ratio" << '\n';
+    for (auto size : { 64, 1024, 16 * 1024, 256 * 1024 })
+    {
+        auto const message = make_message(size);
+        auto const beast_rate  = measure(websocket_codec::beast, message, opts);
+        auto const native_rate = measure(websocket_codec::native, message, opts);
+        std::cout << std::setw(8) << size << std::fixed << std::setprecision(0) << std::setw(14) << beast_rate
+                  << std::setw(14) << native_rate << std::setprecision(2) << std::setw(10)
+                  << native_rate / beast_rate << '\n';
+    }
+}
+catch (std::exception& e)
+{
+    std::cerr << "codec_bench: " << e.what() << '\n';
+    return 1;
+}
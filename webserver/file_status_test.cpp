@@ -0,0 +1,122 @@
+#include "asio.hpp"
+#include "beast.hpp"
+
+#include <boost/beast/http.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Start the webserver given on the command line over a document root holding a file, a
+// directory and a fifo, and check the status of the response to a request for each of them.
+// Each is requested over HTTP/1.0, which always takes the uncached path, and over a persistent
+// HTTP/1.1 connection, which tries the file cache first.
+
+using namespace std::literals;
+namespace fs = std::filesystem;
+using tcp = asio::ip::tcp;
+
+/// Connect to the server, retrying while it starts.
+tcp::socket
+connect(asio::io_context& ioc)
+{
+    auto const ep = tcp::endpoint(asio::ip::make_address("127.0.0.1"), 8080);
+    for (int attempt = 0;; ++attempt)
+    {
+        auto sock = tcp::socket(ioc);
+        auto ec = error_code();
+        sock.connect(ep, ec);
+        if (!ec)
+            return sock;
+        if (attempt == 50)
+            throw system_error(ec, "connect");
+        std::this_thread::sleep_for(100ms);
+    }
+}
+
+/// @return the status of the response to a GET of target
+unsigned
+status_of(asio::io_context& ioc, std::string const& target, unsigned version)
+{
+    auto sock = connect(ioc);
+    auto request = beast::http::request< beast::http::empty_body >(beast::http::verb::get, target, version);
+    request.set(beast::http::field::host, "localhost");
+    request.keep_alive(version == 11);
+    beast::http::write(sock, request);
+
+    auto rxbuf = beast::flat_buffer();
+    auto response = beast::http::response< beast::http::string_body >();
+    beast::http::read(sock, rxbuf, response);
+    return response.result_int();
+}
+
+int
+main(int argc, char** argv)
+try
+{
+    if (argc != 2)
+        throw std::invalid_argument("usage: file_status_test <webserver>");
+
+    auto const root = fs::temp_directory_path() / ("webserver-docroot-" + std::to_string(::getpid()));
+    fs::create_directories(root / "dir");
+    std::ofstream(root / "file.txt") << "hello\n";
+    if (::mkfifo((root / "fifo").c_str(), 0600) < 0)
+        throw system_error(error_code(errno, asio::error::get_system_category()), "mkfifo");
+
+    auto const server = ::fork();
+    if (server == 0)
+    {
+        ::setenv("WEBSERVER_DOCROOT", root.c_str(), 1);
+        ::setenv("WEBSERVER_LOG_LEVEL", "warn", 1);
+        ::execl(argv[1], argv[1], static_cast< char* >(nullptr));
+        std::_Exit(127);
+    }
+
+    auto failures = 0;
+    try
+    {
+        auto ioc = asio::io_context();
+        struct expectation
+        {
+            const char* target;
+            unsigned status;
+        };
+        for (auto [target, status] : { expectation { "/file/file.txt", 200 },
+                                       expectation { "/file/dir", 404 },
+                                       expectation { "/file/fifo", 403 } })
+            for (auto version : { 10u, 11u })
+            {
+                auto const got = status_of(ioc, target, version);
+                std::cout << target << " HTTP/" << version / 10 << '.' << version % 10 << ": " << got << '\n';
+                if (got != status)
+                {
+                    std::cout << "  expected " << status << '\n';
+                    ++failures;
+                }
+            }
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "file_status_test: " << e.what() << '\n';
+        ++failures;
+    }
+
+    ::kill(server, SIGINT);
+    ::waitpid(server, nullptr, 0);
+    fs::remove_all(root);
+    return failures ? 1 : 0;
+}
+catch (std::exception& e)
+{
+    std::cerr << "file_status_test: " << e.what() << '\n';
+    return 1;
+}
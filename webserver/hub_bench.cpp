@@ -0,0 +1,147 @@
+#include "broadcast_hub.hpp"
+
+#include <boost/beast/http.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+// Measure the cost of broadcast_hub operations, first independently of any socket I/O, with
+// subscribers which count the payloads queued to them instead of writing to a websocket.
+// Then publish to real any_websockets over loopback, so that every delivery goes through
+// queue_write() and the websocket's write queue, drained by a run_writer() coroutine.
+
+struct counting_subscriber
+{
+    std::uint64_t* count;
+};
+
+void
+queue_write(counting_subscriber const& s, shared_payload const&, frame_type)
+{
+    ++*s.count;
+}
+
+using namespace std::literals;
+
+constexpr std::size_t subscriber_count = 100'000;
+constexpr std::size_t publish_count    = 200;
+
+// two descriptors each, so within the usual limit of 1024
+constexpr std::size_t websocket_count         = 256;
+constexpr std::size_t websocket_publish_count = 1'000;
+
+template < class F >
+double
+seconds(F&& f)
+{
+    auto const start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration< double >(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Accept one websocket, start its writer and subscribe it to the topic.
+asio::awaitable< void >
+accept_subscriber(asio::ip::tcp::acceptor& acceptor,
+                  websocket_codec codec,
+                  broadcast_hub& hub,
+                  std::vector< broadcast_hub::subscription >& subs)
+{
+    auto sock    = co_await acceptor.async_accept(asio::use_awaitable);
+    auto rxbuf   = beast::flat_buffer();
+    auto request = any_websocket::request_type();
+    co_await beast::http::async_read(sock, rxbuf, request, asio::use_awaitable);
+
+    auto ws = std::make_shared< any_websocket >(std::move(sock), std::move(rxbuf), codec);
+    co_await ws->accept(request);
+    asio::co_spawn(acceptor.get_executor(), run_writer(ws), asio::detached);
+    subs.push_back(hub.subscribe("news", ws));
+}
+
+/// One client, which counts the messages it receives.
+asio::awaitable< void >
+receive(asio::ip::tcp::endpoint ep, std::uint64_t& received)
+{
+    auto ws = beast::websocket::stream< asio::ip::tcp::socket >(co_await asio::this_coro::executor);
+    co_await ws.next_layer().async_connect(ep, asio::use_awaitable);
+    co_await ws.async_handshake("localhost", "/", asio::use_awaitable);
+
+    auto buffer = beast::flat_buffer();
+    for (;;)
+    {
+        co_await ws.async_read(buffer, asio::use_awaitable);
+        buffer.consume(buffer.size());
+        ++received;
+    }
+}
+
+/// Publish to websockets on one thread, waiting for each message to reach every client before
+/// publishing the next, so that each publish finds the writers idle.
+void
+publish_to_websockets(websocket_codec codec, char const* name)
+{
+    auto hub  = broadcast_hub();
+    auto ioc  = asio::io_context(1);
+    auto subs = std::vector< broadcast_hub::subscription >();
+
+    auto acceptor = asio::ip::tcp::acceptor(ioc, { asio::ip::make_address("127.0.0.1"), 0 });
+    acceptor.listen(asio::socket_base::max_listen_connections);
+    std::uint64_t received = 0;
+    for (std::size_t i = 0; i < websocket_count; ++i)
+    {
+        asio::co_spawn(ioc, accept_subscriber(acceptor, codec, hub, subs), asio::detached);
+        asio::co_spawn(ioc, receive(acceptor.local_endpoint(), received), asio::detached);
+    }
+    while (subs.size() < websocket_count)
+        ioc.run_one();
+    ioc.poll();
+
+    auto payload = shared_payload(std::string(128, 'x'));
+    auto queueing = 0.0;
+    auto t = seconds([&] {
+        for (std::size_t i = 0; i < websocket_publish_count; ++i)
+        {
+            queueing += seconds([&] { hub.publish("news", payload); });
+            while (received < (i + 1) * websocket_count)
+                ioc.run_one();
+        }
+    });
+    std::cout << "publish " << name << ": " << received / queueing / 1e6 << " M queued/s, "
+              << received / t / 1e6 << " M delivered/s (" << received << " in " << t << "s)\n";
+
+    // unsubscribe before the websockets are destroyed with the io_context
+    subs.clear();
+}
+
+int
+main()
+{
+    auto hub       = basic_broadcast_hub< counting_subscriber >();
+    std::uint64_t delivered = 0;
+    auto subs      = std::vector< basic_broadcast_hub< counting_subscriber >::subscription >();
+    subs.reserve(subscriber_count);
+
+    auto t = seconds([&] {
+        for (std::size_t i = 0; i < subscriber_count; ++i)
+            subs.push_back(hub.subscribe("news", counting_subscriber { &delivered }));
+    });
+    std::cout << "subscribe   : " << t * 1e9 / subscriber_count << " ns/op\n";
+
+    auto payload = shared_payload(std::string(128, 'x'));
+    t = seconds([&] {
+        for (std::size_t i = 0; i < publish_count; ++i)
+            hub.publish("news", payload);
+    });
+    std::cout << "publish     : " << delivered / t / 1e6 << " M deliveries/s (" << delivered << " in " << t << "s)\n";
+
+    // unsubscribe from the middle, so that every removal swaps
+    t = seconds([&] {
+        for (std::size_t i = 0; i < subscriber_count; ++i)
+            subs[(i * 7919) % subscriber_count].reset();
+    });
+    std::cout << "unsubscribe : " << t * 1e9 / subscriber_count << " ns/op\n";
+    std::cout << "topics left : " << hub.topic_count() << '\n';
+
+    publish_to_websockets(websocket_codec::beast, "beast ");
+    publish_to_websockets(websocket_codec::native, "native");
+}
@@ -0,0 +1,180 @@
+#include "asio.hpp"
+#include "beast.hpp"
+#include "ktls_stream.hpp"
+#include "send_file.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <sys/resource.h>
+
+// Compare the cost of sending bulk data over tls through asio::ssl::stream, which encrypts in
+// user space, and through ktls_stream, which hands encryption to the kernel when it can.
+// The server sends over loopback to a client on another thread. Reported CPU time is the
+// server thread's, per GiB sent.
+// If the kernel has no tls module loaded (modprobe tls), ktls_stream falls back to user space
+// and the figures show only the cost of its socket BIO.
+
+using namespace std::literals;
+
+constexpr std::size_t total_bytes = std::size_t(1) << 30;
+constexpr std::size_t chunk_size  = 64 * 1024;
+
+/// A throwaway self-signed certificate, so that the benchmark needs no files.
+void
+use_test_certificate(asio::ssl::context& ctx)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    auto key  = EVP_EC_gen("P-256");
+    auto cert = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+    X509_set_pubkey(cert, key);
+    X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC,
+        reinterpret_cast< const unsigned char* >("localhost"), -1, -1, 0);
+    X509_set_issuer_name(cert, X509_get_subject_name(cert));
+    X509_sign(cert, key, EVP_sha256());
+
+    SSL_CTX_use_certificate(ctx.native_handle(), cert);
+    SSL_CTX_use_PrivateKey(ctx.native_handle(), key);
+    X509_free(cert);
+    EVP_PKEY_free(key);
+#else
+    (void)ctx;
+    throw std::runtime_error("ktls_bench needs OpenSSL 3");
+#endif
+}
+
+/// Read and discard everything the server sends.
+void
+drain(asio::ip::tcp::endpoint ep)
+{
+    auto ioc    = asio::io_context();
+    auto ctx    = asio::ssl::context(asio::ssl::context::tls_client);
+    auto stream = asio::ssl::stream< asio::ip::tcp::socket >(ioc, ctx);
+    stream.next_layer().connect(ep);
+    stream.handshake(asio::ssl::stream_base::client);
+
+    auto buf = std::make_unique< char[] >(chunk_size);
+    auto ec  = error_code();
+    while (!ec)
+        stream.read_some(asio::buffer(buf.get(), chunk_size), ec);
+
+    // answer the server's close_notify
+    if (ec == asio::error::eof)
+        stream.shutdown(ec);
+}
+
+double
+thread_cpu_seconds()
+{
+    auto usage = rusage();
+    getrusage(RUSAGE_THREAD, &usage);
+    auto tv = [](timeval t) { return double(t.tv_sec) + double(t.tv_usec) / 1e6; };
+    return tv(usage.ru_utime) + tv(usage.ru_stime);
+}
+
+template < class Send >
+void
+measure(std::string_view name, asio::ssl::context& ctx, Send send)
+{
+    auto ioc      = asio::io_context();
+    auto acceptor = asio::ip::tcp::acceptor(ioc, { asio::ip::make_address("127.0.0.1"), 0 });
+    auto client   = std::thread(drain, acceptor.local_endpoint());
+
+    auto cpu     = thread_cpu_seconds();
+    auto start   = std::chrono::steady_clock::now();
+    auto kernel  = false;
+    auto failure = std::exception_ptr();
+    asio::co_spawn(ioc,
+        [&]() -> asio::awaitable< void >
+        {
+            auto sock = co_await acceptor.async_accept(asio::use_awaitable);
+            co_await send(std::move(sock), kernel);
+        },
+        [&failure](std::exception_ptr ep) { failure = ep; });
+    ioc.run();
+    client.join();
+    if (failure)
+        std::rethrow_exception(failure);
+
+    auto const elapsed = std::chrono::duration< double >(std::chrono::steady_clock::now() - start).count();
+    cpu = thread_cpu_seconds() - cpu;
+    auto const gib = double(total_bytes) / double(1 << 30);
+    std::cout << name << (kernel ? " (kernel)" : " (user space)") << " : " << gib / elapsed << " GiB/s, "
+              << cpu / gib << " cpu s/GiB\n";
+}
+
+int
+main()
+try
+{
+    auto ctx = asio::ssl::context(asio::ssl::context::tls_server);
+    use_test_certificate(ctx);
+    enable_ktls(ctx);
+
+    auto payload = std::string(chunk_size, 'x');
+
+    measure("asio::ssl::stream write ", ctx,
+        [&](asio::ip::tcp::socket sock, bool&) -> asio::awaitable< void >
+        {
+            auto stream = asio::ssl::stream< asio::ip::tcp::socket >(std::move(sock), ctx);
+            co_await stream.async_handshake(asio::ssl::stream_base::server, asio::use_awaitable);
+            for (std::size_t sent = 0; sent < total_bytes; sent += payload.size())
+                co_await asio::async_write(stream, asio::buffer(payload), asio::use_awaitable);
+            co_await stream.async_shutdown(asio::use_awaitable);
+        });
+
+    measure("ktls_stream write       ", ctx,
+        [&](asio::ip::tcp::socket sock, bool& kernel) -> asio::awaitable< void >
+        {
+            auto stream = ktls_stream(std::move(sock), ctx);
+            co_await stream.async_handshake(asio::const_buffer(), asio::use_awaitable);
+            kernel = stream.kernel_send();
+            for (std::size_t sent = 0; sent < total_bytes; sent += payload.size())
+                co_await asio::async_write(stream, asio::buffer(payload), asio::use_awaitable);
+            co_await stream.async_shutdown(asio::use_awaitable);
+        });
+
+    // a file of the same size, in the page cache
+    auto path = std::string("ktls_bench.tmp");
+    {
+        auto ec   = error_code();
+        auto file = beast::file();
+        file.open(path.c_str(), beast::file_mode::write, ec);
+        for (std::size_t n = 0; !ec && n < total_bytes; n += payload.size())
+            file.write(payload.data(), payload.size(), ec);
+        if (ec)
+            throw system_error(ec);
+    }
+
+    measure("ktls_stream send_file   ", ctx,
+        [&](asio::ip::tcp::socket sock, bool& kernel) -> asio::awaitable< void >
+        {
+            auto stream = ktls_stream(std::move(sock), ctx);
+            co_await stream.async_handshake(asio::const_buffer(), asio::use_awaitable);
+            kernel = stream.kernel_send();
+
+            auto ec   = error_code();
+            auto file = beast::file();
+            file.open(path.c_str(), beast::file_mode::scan, ec);
+            if (ec)
+                throw system_error(ec);
+            co_await send_file(stream, file, 0, total_bytes);
+            co_await stream.async_shutdown(asio::use_awaitable);
+        });
+
+    std::remove(path.c_str());
+}
+catch (std::exception& e)
+{
+    std::cerr << "ktls_bench: " << e.what() << '\n';
+    return 1;
+}
@@ -0,0 +1,74 @@
+#include "router.hpp"
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <regex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// Compare the cost of finding a route in a table of a few hundred routes, using
+// the compiled radix tree router and a table of std::regex as chat_http used to.
+
+using namespace std::literals;
+
+constexpr std::size_t route_count = 300;
+constexpr std::size_t iterations  = 200'000;
+
+std::vector< std::string >
+make_targets()
+{
+    auto targets = std::vector< std::string >();
+    for (std::size_t i = 0; i < route_count; i += 7)
+    {
+        targets.push_back("/api/v1/resource" + std::to_string(i) + "/" + std::to_string(i * 31));
+        targets.push_back("/static/bundle" + std::to_string(i) + "/js/app.js");
+        targets.push_back("/nowhere/" + std::to_string(i));
+    }
+    return targets;
+}
+
+template < class F >
+void
+measure(std::string_view name, std::vector< std::string > const& targets, F&& f)
+{
+    std::size_t found = 0;
+    auto const start  = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i)
+        found += f(targets[i % targets.size()]);
+    auto const elapsed = std::chrono::steady_clock::now() - start;
+
+    auto ns = std::chrono::duration_cast< std::chrono::nanoseconds >(elapsed).count();
+    std::cout << name << " : " << double(ns) / iterations << " ns/lookup, " << found << " matches\n";
+}
+
+int
+main()
+{
+    auto radix   = router< std::size_t >();
+    auto regexes = std::vector< std::tuple< std::regex, std::size_t > >();
+
+    for (std::size_t i = 0; i < route_count / 2; ++i)
+    {
+        auto n = std::to_string(i);
+        radix.add("/api/v1/resource" + n + "/{id:int}", 2 * i);
+        regexes.emplace_back(std::regex("/api/v1/resource" + n + "/([-0-9]+)"), 2 * i);
+        radix.add("/static/bundle" + n + "/{path:path}", 2 * i + 1);
+        regexes.emplace_back(std::regex("/static/bundle" + n + "/(.+)"), 2 * i + 1);
+    }
+
+    auto const targets = make_targets();
+
+    measure("radix", targets, [&](std::string const& t) {
+        auto params = route_params();
+        return radix.match(t, params) != nullptr;
+    });
+
+    measure("regex", targets, [&](std::string const& t) {
+        for (auto&& [re, index] : regexes)
+            if (std::regex_match(t, re))
+                return true;
+        return false;
+    });
+}
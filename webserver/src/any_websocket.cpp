@@ -1,35 +1,128 @@
 #include "any_websocket.hpp"
-#include <iostream>
+#include "logger.hpp"
+#include "object_id.hpp"
+#include <algorithm>
+#include <tuple>
 
-any_websocket::any_websocket(tcp_transport&& t, boost::beast::flat_buffer&& rxbuf)
-: ws_(tcp_websock(std::move(t)))
+namespace
+{
+    /// Await an operation of native_websock, which throws, and return its error and result
+    /// as asioex::as_tuple would for beast.
+    template<class T>
+    asio::awaitable<std::tuple<error_code, T>>
+    capture_error(asio::awaitable<T> op)
+    {
+        auto ec = error_code();
+        try
+        {
+            co_return std::make_tuple(ec, co_await std::move(op));
+        }
+        catch(system_error& e)
+        {
+            ec = e.code();
+        }
+        co_return std::make_tuple(ec, T());
+    }
+}
+
+template<class Beast, class Native, class Transport>
+any_websocket::var_type
+any_websocket::make_websock(Transport&& t, beast::flat_buffer& rxbuf, websocket_codec codec)
+{
+    if (codec == websocket_codec::native)
+        return var_type(boost::variant2::in_place_type<Native>, std::move(t), std::move(rxbuf));
+    return var_type(boost::variant2::in_place_type<Beast>, std::move(t));
+}
+
+any_websocket::any_websocket(tcp_transport&& t, boost::beast::flat_buffer&& rxbuf, websocket_codec codec)
+: ws_(make_websock<tcp_websock, native_tcp_websock>(std::move(t), rxbuf, codec))
 , rxbuf_(std::move(rxbuf))
 , write_condition_(get_executor())
 , join_condition_(get_executor())
+, tx_ready_(get_executor())
 {
     
 }
 
-any_websocket::any_websocket(tls_transport&& t, boost::beast::flat_buffer&& rxbuf)
-: ws_(tls_websock(std::move(t)))
+any_websocket::any_websocket(tls_transport&& t, boost::beast::flat_buffer&& rxbuf, websocket_codec codec)
+: ws_(make_websock<tls_websock, native_tls_websock>(std::move(t), rxbuf, codec))
+, rxbuf_(std::move(rxbuf))
+, write_condition_(get_executor())
+, join_condition_(get_executor())
+, tx_ready_(get_executor())
+{
+
+}
+
+any_websocket::any_websocket(ktls_stream&& t, boost::beast::flat_buffer&& rxbuf, websocket_codec codec)
+: ws_(make_websock<ktls_websock, native_ktls_websock>(std::move(t), rxbuf, codec))
 , rxbuf_(std::move(rxbuf))
 , write_condition_(get_executor())
 , join_condition_(get_executor())
+, tx_ready_(get_executor())
 {
 
 }
 
+any_websocket::~any_websocket()
+{
+    // frames still queued when the websocket dies are never sent, so stop counting them
+    if (!txqueue_.empty())
+        metrics_.websocket_queued_frames.add(-static_cast<std::int64_t>(txqueue_.size()));
+
+    if (compression_reserved_)
+        compression_memory::release(compression_reserved_);
+}
+
 asio::awaitable<void>
-any_websocket::accept(request_type& request)
+any_websocket::accept(request_type& request, compression_options const& options)
 {
-    auto op = [&](auto& ws)
+    if (is_native())
     {
-        return ws.async_accept(request, asio::use_awaitable);
+        co_await visit([&](auto& ws) -> asio::awaitable<void>
+        {
+            if constexpr (is_native_websock_v<std::decay_t<decltype(ws)>>)
+                co_await ws.accept(request);
+        }, ws_);
+        co_return;
+    }
+
+    auto pmd = make_permessage_deflate(options);
+    if (pmd.server_enable && offers_permessage_deflate(request))
+    {
+        auto const bytes = compression_memory_estimate(options);
+        if (compression_memory::reserve(bytes, options.global_memory_limit))
+            compression_reserved_ = bytes;
+        else
+            pmd.server_enable = false;
+    }
+    else
+    {
+        pmd.server_enable = false;
+    }
+
+    auto op = [&](auto& ws) -> asio::awaitable<void>
+    {
+        if constexpr (!is_native_websock_v<std::decay_t<decltype(ws)>>)
+        {
+            ws.set_option(pmd);
+            co_await ws.async_accept(request, asio::use_awaitable);
+        }
     };
 
     co_await visit(op, ws_);
 }
 
+bool
+any_websocket::is_native() const
+{
+    auto op = [](auto const& ws)
+    {
+        return is_native_websock_v<std::decay_t<decltype(ws)>>;
+    };
+    return visit(op, ws_);
+}
+
 
 tcp_transport const& 
 any_websocket::socket() const
@@ -43,59 +136,211 @@ any_websocket::socket() const
 }
 
 void 
-queue_write(std::shared_ptr<any_websocket> pws, std::string s, frame_type type)
+queue_write(std::shared_ptr<any_websocket> pws, shared_payload s, frame_type type)
 {
-    asio::co_spawn(pws->get_executor(), 
-        write(pws, std::move(s), type), 
-        asio::detached);
+    pws->enqueue(std::move(s), type);
+    if (pws->flushing_)
+        return;
+
+    if (pws->writer_idle_)
+        pws->tx_ready_.notify_one();
+    else
+    {
+        // The coroutine does not start until later. Claim the flush for it now, so that
+        // frames queued meanwhile join its batch rather than start another flush.
+        pws->flushing_ = true;
+        asio::co_spawn(pws->get_executor(), 
+            [pws]() -> asio::awaitable<void> { co_await pws->send_queue(); }, 
+            asio::detached);
+    }
+}
+
+std::uint64_t
+any_websocket::enqueue(shared_payload s, frame_type type)
+{
+    txqueue_.push(queued_frame { std::move(s), type });
+    metrics_.websocket_queued_frames.add(1);
+    ++outstanding_writes_;
+    return ++enqueued_seq_;
 }
 
 asio::awaitable<void>
-any_websocket::write(std::string s, frame_type type)
+any_websocket::write(shared_payload s, frame_type type)
 {
-    // If we are not the first writer, wait on the write
-    // condition variable. We are guaranteed to be woken up 
-    // in order.
-    if(outstanding_writes_++ != 0)
-        co_await write_condition_.wait();
+    auto const seq = enqueue(std::move(s), type);
 
-    // ensure that the condition is correctly notified whether
-    // the write fails with an exception or completes correctly
-    auto bump = [&]
+    // If another coroutine is flushing, it will pick up our frame in its next batch. 
+    // Wait on the write condition variable until our frame has been sent.
+    if (flushing_)
     {
-        --outstanding_writes_;
-        write_condition_.notify_one();
-        if (outstanding_writes_ == 0 && !closing_)
-            join_condition_.notify_all();
-    };
+        while (flushed_seq_ < seq)
+            co_await write_condition_.wait();
+    }
+    else
+    {
+        co_await flush();
+    }
+}
 
-    auto write_op = [&s, type](auto& ws)
+asio::awaitable<void>
+any_websocket::write(frame const& f)
+{
+    auto const type = f.is_binary() ? frame_type::binary : frame_type::text;
+    if (flushing_ || !txqueue_.empty())
     {
-        switch (type)
+        co_await write(shared_payload(f.as_string()), type);
+        co_return;
+    }
+
+    // Nothing else to send: write directly from the receive buffer. Holding the flushing_
+    // flag makes writes started meanwhile queue up behind this one.
+    flushing_ = true;
+    ++outstanding_writes_;
+
+    auto op = [&](auto& ws)
+    {
+        if constexpr (is_native_websock_v<std::decay_t<decltype(ws)>>)
+            return capture_error(ws.write(asio::buffer(f.as_string()), f.is_binary()));
+        else
         {
-        case frame_type::text:
-            ws.text();
-            break;
-            
-        case frame_type::binary:
-            ws.binary();
-            break;
+            ws.text(type == frame_type::text);
+            return ws.async_write(asio::buffer(f.as_string()), asioex::as_tuple(asio::use_awaitable));
         }
-        return ws.async_write(asio::buffer(s), asio::use_awaitable);
     };
+    auto [ec, n] = co_await visit(op, ws_);
 
-    // Wait for the write to complete before dropping out of scope
-    // and updating the condition variable
-    try
+    ++stats_.flushes;
+    ++stats_.frames;
+    stats_.max_frames_per_flush = std::max<std::uint64_t>(stats_.max_frames_per_flush, 1);
+    metrics_.websocket_write_batch.record(1);
+    if (!ec)
     {
-        co_await visit(write_op, ws_);
-        bump();
+        metrics_.websocket_frames_out.add();
+        metrics_.websocket_bytes_out.add(n);
     }
-    catch(const std::exception& e)
+    --outstanding_writes_;
+    flushing_ = false;
+
+    if (!txqueue_.empty())
+        co_await flush();
+    else if (outstanding_writes_ == 0 && !closing_)
+        join_condition_.notify_all();
+
+    if (ec)
+        throw system_error(ec);
+}
+
+template<class WebSocket>
+asio::awaitable<std::size_t>
+any_websocket::flush_batch(WebSocket& ws)
+{
+    // Hold back every frame but the last in the corked layer, then send the lot with 
+    // the write of the last frame. Beast still frames each message individually, so 
+    // message boundaries and order are preserved. The corked layer refers to each payload,
+    // which it keeps alive, and copies only the frame headers.
+    std::size_t count = 0;
+    auto batch = txqueue_.size();
+    while (batch--)
     {
-        std::cerr << "websocket write failed: " << e.what() << '\n';
-        bump();
+        auto& f = txqueue_.front();
+        if (batch == 0)
+            ws.next_layer().uncork();
+        else
+        {
+            ws.next_layer().cork();
+            ws.next_layer().hold(f.payload.buffer(), f.payload.owner());
+        }
+
+        ws.text(f.type == frame_type::text);
+        auto const n = co_await ws.async_write(f.payload.buffer(), asio::use_awaitable);
+        txqueue_.pop();
+        metrics_.websocket_queued_frames.add(-1);
+        metrics_.websocket_frames_out.add();
+        metrics_.websocket_bytes_out.add(n);
+        ++count;
+    }
+    co_return count;
+}
+
+template<class NextLayer>
+asio::awaitable<std::size_t>
+any_websocket::flush_batch(native_websock<NextLayer>& ws)
+{
+    // Every queued frame goes out in one gather write, with its header built alongside it.
+    // The frames stay in the queue until the write completes, so that flush() can drop them
+    // if it fails. std::queue cannot be iterated, so the batch is rotated through it once.
+    auto const batch = txqueue_.size();
+    native_batch_.clear();
+    for (std::size_t i = 0; i < batch; ++i)
+    {
+        auto& f = txqueue_.front();
+        native_batch_.push_back(native_outbound { f.payload.buffer(), f.type == frame_type::binary });
+        txqueue_.push(std::move(f));
+        txqueue_.pop();
     }
+
+    auto const n = co_await ws.write_batch(native_batch_);
+    for (std::size_t i = 0; i < batch; ++i)
+        txqueue_.pop();
+    metrics_.websocket_queued_frames.add(-static_cast<std::int64_t>(batch));
+    metrics_.websocket_frames_out.add(batch);
+    metrics_.websocket_bytes_out.add(n);
+    co_return batch;
+}
+
+asio::awaitable<void>
+any_websocket::flush()
+{
+    assert(!flushing_);
+    flushing_ = true;
+    co_await send_queue();
+}
+
+asio::awaitable<void>
+any_websocket::send_queue()
+{
+    assert(flushing_);
+
+    while (!txqueue_.empty())
+    {
+        auto const seq = enqueued_seq_;
+        auto const batch = txqueue_.size();
+
+        try
+        {
+            co_await visit([this](auto& ws) { return flush_batch(ws); }, ws_);
+        }
+        catch(const std::exception& e)
+        {
+            log_info(object_id(__func__, socket()), "websocket write failed: ", e.what());
+
+            // Frames in a failed batch are dropped, including any the corked layer holds back.
+            // Otherwise the next write, such as a close, would send them ahead of itself.
+            visit([](auto& ws) 
+            { 
+                ws.next_layer().uncork(); 
+                ws.next_layer().discard();
+            }, ws_);
+            for (auto n = txqueue_.size() - (enqueued_seq_ - seq); n--; )
+            {
+                txqueue_.pop();
+                metrics_.websocket_queued_frames.add(-1);
+            }
+        }
+
+        ++stats_.flushes;
+        stats_.frames += batch;
+        stats_.max_frames_per_flush = std::max<std::uint64_t>(stats_.max_frames_per_flush, batch);
+        metrics_.websocket_write_batch.record(batch);
+
+        flushed_seq_ = seq;
+        outstanding_writes_ -= batch;
+        write_condition_.notify_all();
+    }
+
+    flushing_ = false;
+    if (outstanding_writes_ == 0 && !closing_)
+        join_condition_.notify_all();
 }
 
 asio::awaitable< frame >
@@ -104,32 +349,99 @@ any_websocket::read()
     rxbuf_.consume(last_read_size_);
     last_read_size_ = 0;
 
-    auto read_op = [this](auto& ws)
+    // the native codec returns a view of the message in its own buffer
+    auto read_op = [this](auto& ws) -> asio::awaitable<std::tuple<error_code, native_message>>
     {
-        return ws.async_read(rxbuf_, asioex::as_tuple(asio::use_awaitable));
+        if constexpr (is_native_websock_v<std::decay_t<decltype(ws)>>)
+            co_return co_await capture_error(ws.read());
+        else
+        {
+            auto [ec, n] = co_await ws.async_read(rxbuf_, asioex::as_tuple(asio::use_awaitable));
+            last_read_size_ = n;
+            co_return std::make_tuple(ec, native_message { rxbuf_.cdata(), ws.got_binary() });
+        }
     };
 
-    auto got_binary = [](auto& ws)
+    auto [ec, message] = 
+        co_await 
+            visit(read_op, ws_);
+
+    co_return co_await complete_read(ec, message);
+}
+
+asio::awaitable< frame >
+any_websocket::read_some()
+{
+    rxbuf_.consume(last_read_size_);
+    last_read_size_ = 0;
+
+    auto read_op = [this](auto& ws) -> asio::awaitable<std::tuple<error_code, native_message>>
     {
-        return ws.got_binary();
+        if constexpr (is_native_websock_v<std::decay_t<decltype(ws)>>)
+            co_return co_await capture_error(ws.read_some(read_limits_.max_chunk_size));
+        else
+        {
+            auto [ec, n] = co_await ws.async_read_some(rxbuf_, read_limits_.max_chunk_size, 
+                asioex::as_tuple(asio::use_awaitable));
+            last_read_size_ = n;
+            co_return std::make_tuple(ec, 
+                native_message { rxbuf_.cdata(), ws.got_binary(), ws.is_message_done() });
+        }
     };
 
-    auto ec = error_code();
-
-    std::tie(ec, last_read_size_) = 
+    auto [ec, message] = 
         co_await 
             visit(read_op, ws_);
 
+    co_return co_await complete_read(ec, message);
+}
+
+asio::awaitable< frame >
+any_websocket::complete_read(error_code ec, native_message message)
+{
     if (ec)
     {
+        read_failed_ = true;
+        tx_ready_.notify_all();
         co_await join();
         throw system_error(ec);
     }
-    else
+
+    // a message is counted once, when its last part arrives
+    if (message.fin)
+        metrics_.websocket_frames_in.add();
+    metrics_.websocket_bytes_in.add(message.data.size());
+    co_return frame(message.data, message.binary, message.fin);
+}
+
+void
+any_websocket::set_read_limits(websocket_read_limits const& limits)
+{
+    read_limits_ = limits;
+    visit([&](auto& ws) { ws.read_message_max(limits.max_message_size); }, ws_);
+}
+
+websocket_read_limits const&
+any_websocket::read_limits() const
+{
+    return read_limits_;
+}
+
+asio::awaitable<void>
+any_websocket::writer_loop()
+{
+    while (!read_failed_)
     {
-        co_return 
-            frame(rxbuf_, 
-                visit(got_binary, ws_));
+        if (txqueue_.empty() || flushing_)
+        {
+            writer_idle_ = true;
+            co_await tx_ready_.wait();
+            writer_idle_ = false;
+        }
+        else
+        {
+            co_await flush();
+        }
     }
 }
 
@@ -153,13 +465,16 @@ any_websocket::close(beast::websocket::close_reason reason)
         co_await
             visit([&](auto& ws)
             {
-                return ws.async_close(reason, asio::use_awaitable);
+                if constexpr (is_native_websock_v<std::decay_t<decltype(ws)>>)
+                    return ws.close(reason);
+                else
+                    return ws.async_close(reason, asio::use_awaitable);
             }, ws_);
             bump();
     }
     catch(std::exception& e)
     {
-        std::cerr << "websocket close failed: " << e.what() << '\n';
+        log_info(object_id(__func__, socket()), "websocket close failed: ", e.what());
         bump();
     }
 }
@@ -177,6 +492,18 @@ any_websocket::join()
 }
 
 
+std::size_t
+any_websocket::compression_memory_reserved() const
+{
+    return compression_reserved_;
+}
+
+write_stats const&
+any_websocket::stats() const
+{
+    return stats_;
+}
+
 asio::any_io_executor
 any_websocket::get_executor()
 {
@@ -190,10 +517,17 @@ any_websocket::get_executor()
 // free functions
 
 asio::awaitable<void>
-write(std::shared_ptr<any_websocket> impl, std::string s, frame_type)
+write(std::shared_ptr<any_websocket> impl, shared_payload s, frame_type type)
 {
     // note - impl has been passed by value, causing a copy. Thereby guaranteeing 
     // that the lifetime of the websocket is preserved during the execution of the
     // inner coroutine
-    co_await impl->write(std::move(s));
+    co_await impl->write(std::move(s), type);
+}
+
+asio::awaitable<void>
+run_writer(std::shared_ptr<any_websocket> impl)
+{
+    // as with write(), impl is held by value for the lifetime of the coroutine
+    co_await impl->writer_loop();
 }
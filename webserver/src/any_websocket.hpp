@@ -3,74 +3,67 @@
 
 #include "asio.hpp"
 #include "beast.hpp"
+#include "condvar.hpp"
+#include "corked_stream.hpp"
+#include "ktls_stream.hpp"
+#include "metrics.hpp"
+#include "native_websock.hpp"
+#include "shared_payload.hpp"
+#include "websocket_compression.hpp"
 
 #include <boost/variant2/variant.hpp>
 #include <string>
 #include <queue>
 #include <deque>
 #include <span>
+#include <vector>
 
 using tcp_transport = asio::ip::tcp::socket;
 using tls_transport = asio::ssl::stream<tcp_transport>;
 
-using tcp_websock = beast::websocket::stream<tcp_transport>;
-using tls_websock = beast::websocket::stream<tls_transport>;
+using tcp_websock = beast::websocket::stream<corked_stream<tcp_transport>>;
+using tls_websock = beast::websocket::stream<corked_stream<tls_transport>>;
+using ktls_websock = beast::websocket::stream<corked_stream<ktls_stream>>;
 
-struct condvar
-{
-    using timer_type = asio::steady_timer;
-    using time_point = timer_type::time_point;
-
-    condvar(asio::any_io_executor exec)
-    : timer_(std::move(exec))
-    {
-        timer_.expires_at(time_point::max());
-    }
-
-    void
-    notify_all()
-    {
-        timer_.cancel();
-    }
+using native_tcp_websock = native_websock<corked_stream<tcp_transport>>;
+using native_tls_websock = native_websock<corked_stream<tls_transport>>;
+using native_ktls_websock = native_websock<corked_stream<ktls_stream>>;
 
-    void
-    notify_one()
-    {
-        timer_.cancel_one();
-    }
-
-    asio::awaitable<void>
-    wait()
-    {
-        auto [ec] = co_await timer_.async_wait(asioex::as_tuple(asio::use_awaitable));
-        if (ec && ec != asio::error::operation_aborted)
-            throw system_error(ec);
-        co_return;
-    }
+/// Selects the implementation of the websocket protocol behind an any_websocket
+enum class websocket_codec
+{
+    /// beast::websocket::stream, which supports permessage-deflate
+    beast,
 
-    asio::steady_timer timer_;
+    /// native_websock, which reads and writes frames without copying their payloads
+    native
 };
 
 struct frame
 {
     frame(beast::flat_buffer const& buf, bool binary)
-    : buffer_(&buf)
+    : frame(buf.data(), binary)
+    {
+
+    }
+
+    frame(asio::const_buffer data, bool binary, bool final = true)
+    : data_(data)
     , binary_(binary)
+    , final_(final)
     {
 
     }
 
     std::string_view as_string() const
     {
-        auto d = buffer_->data();
-        return { reinterpret_cast<const char*>(d.data()), d.size() };
+        return { reinterpret_cast<const char*>(data_.data()), data_.size() };
     }
 
     std::span<const char> 
     as_span() const
     {
-        auto d = buffer_->data();
-        return { reinterpret_cast<const char*>(d.data()), d.size() };
+        return { reinterpret_cast<const char*>(data_.data()), data_.size() };
     }
 
     bool 
@@ -79,9 +72,14 @@ struct frame
     bool 
     is_text() const { return !binary_; }
 
+    /// Return true if the frame ends its message. Always true of frames returned by read().
+    bool
+    is_final() const { return final_; }
+
 private:
-    beast::flat_buffer const* buffer_;
+    asio::const_buffer data_;
     bool binary_;
+    bool final_;
 };
 
 enum class frame_type : std::uint8_t
@@ -90,28 +88,94 @@ enum class frame_type : std::uint8_t
     binary = 1
 };
 
+/// Limits on the messages read from an any_websocket
+struct websocket_read_limits
+{
+    /// largest message accepted. The websocket is closed with code 1009 on a larger one.
+    std::uint64_t max_message_size = 16 * 1024 * 1024;
+
+    /// most bytes returned by one any_websocket::read_some()
+    std::size_t max_chunk_size = 64 * 1024;
+};
+
+/// Counters describing how outbound frames were coalesced into writes.
+struct write_stats
+{
+    /// number of gather writes issued
+    std::uint64_t flushes = 0;
+
+    /// number of frames sent by those writes
+    std::uint64_t frames = 0;
+
+    /// largest number of frames sent by a single write
+    std::uint64_t max_frames_per_flush = 0;
+};
+
 struct any_websocket
 {
     using request_type = beast::http::request<beast::http::string_body>;
 
-    any_websocket(tcp_transport&& t, beast::flat_buffer&& rxbuf);
-    any_websocket(tls_transport&& t, beast::flat_buffer&& rxbuf);
+    /// Construct the websocket over a transport.
+    /// @param rxbuf holds any bytes read from the transport after the upgrade request.
+    /// @param codec selects the implementation of the protocol.
+    any_websocket(tcp_transport&& t, beast::flat_buffer&& rxbuf, websocket_codec codec = websocket_codec::beast);
+    any_websocket(tls_transport&& t, beast::flat_buffer&& rxbuf, websocket_codec codec = websocket_codec::beast);
+    any_websocket(ktls_stream&& t, beast::flat_buffer&& rxbuf, websocket_codec codec = websocket_codec::beast);
+
+    any_websocket(any_websocket const&) = delete;
+    any_websocket& operator=(any_websocket const&) = delete;
+
+    ~any_websocket();
 
     tcp_transport const& 
     socket() const;
 
+    /// Accept the websocket upgrade.
+    /// permessage-deflate is negotiated if the client offers it, the options enable it and the
+    /// estimated zlib memory fits within the global limit. Otherwise the websocket is uncompressed.
+    /// The native codec never negotiates compression.
+    /// @param request is the upgrade request
+    /// @param options are the compression settings
     asio::awaitable<void>
-    accept(request_type& request);
+    accept(request_type& request, compression_options const& options = {});
 
     /// Coroutine to write in order.
-    /// Each subsequent invocation of this coroutine maintains order
-    /// @param s is a reference to the text frame to write
+    /// Each subsequent invocation of this coroutine maintains order.
+    /// Frames queued while another write is in progress are sent together with a single
+    /// gather write once that write completes.
+    /// @param s is the payload of the frame to write. It is shared, not copied.
+    asio::awaitable<void>
+    write(shared_payload s, frame_type type = frame_type::text);
+
+    /// Write a received frame back out with the same type, e.g. to echo it.
+    /// If no other write is queued or in progress, the frame's bytes are written straight
+    /// from the receive buffer. Otherwise they are copied into a shared_payload and queued.
+    /// @pre f is the frame most recently returned by read(), and read() is not called again
+    /// until this coroutine completes.
     asio::awaitable<void>
-    write(std::string s, frame_type type = frame_type::text);
+    write(frame const& f);
 
+    /// Read the next whole message. It is held in memory in full, up to the largest message
+    /// allowed by the read limits.
+    /// @pre no message is part read by read_some()
     asio::awaitable< frame > 
     read();
 
+    /// Read the next part of a message, as soon as any of it has arrived.
+    /// Parts are at most max_chunk_size bytes, and only the latest is held in memory, so that
+    /// large messages can be processed as they arrive. frame::is_final() is true of the last
+    /// part of each message, which may be empty.
+    /// @return a view of the part, which is valid until the next read.
+    asio::awaitable< frame >
+    read_some();
+
+    /// Set the limits on messages read from now on
+    void
+    set_read_limits(websocket_read_limits const& limits);
+
+    websocket_read_limits const&
+    read_limits() const;
+
     /// Initiate a close on the websocket. May be invoked while a read is in progress.
     /// @pre must not be invoked while there is an outstanding close in progress
     asio::awaitable<void>
@@ -126,27 +190,111 @@ struct any_websocket
     asio::any_io_executor
     get_executor();
 
+    /// Return the estimated memory held by this websocket's compression contexts, or zero
+    /// if the websocket is not compressed.
+    std::size_t
+    compression_memory_reserved() const;
+
+    /// Return the write coalescing counters for this websocket
+    write_stats const&
+    stats() const;
+
 private:
+    friend void 
+    queue_write(std::shared_ptr<any_websocket> pws, shared_payload s, frame_type type);
+
+    friend asio::awaitable<void>
+    run_writer(std::shared_ptr<any_websocket> impl);
+
+    /// Account for a completed read, or end the websocket's writes if it failed.
+    /// @return message as a frame
+    /// @throw system_error if ec is set
+    asio::awaitable< frame >
+    complete_read(error_code ec, native_message message);
+
+    /// Send queued frames whenever there are any, until a read fails.
+    asio::awaitable<void>
+    writer_loop();
+
+    struct queued_frame
+    {
+        shared_payload payload;
+        frame_type type;
+    };
+
+    /// Add a frame to the write queue.
+    /// @return the sequence number of the frame.
+    std::uint64_t
+    enqueue(shared_payload s, frame_type type);
+
+    /// Send queued frames until the queue is empty.
+    /// @pre no other flush is in progress
+    asio::awaitable<void>
+    flush();
+
+    /// Send queued frames until the queue is empty, then clear flushing_.
+    /// @pre flushing_ has been set by the caller, which hands the flush to this coroutine
+    asio::awaitable<void>
+    send_queue();
+
+    template<class WebSocket>
+    asio::awaitable<std::size_t>
+    flush_batch(WebSocket& ws);
+
+    /// Send the whole queue in one gather write, framed by native_websock.
+    template<class NextLayer>
+    asio::awaitable<std::size_t>
+    flush_batch(native_websock<NextLayer>& ws);
+
+    /// Return true if the native codec is in use
+    bool
+    is_native() const;
+
     using var_type = boost::variant2::variant<
         tcp_websock,
-        tls_websock
+        tls_websock,
+        ktls_websock,
+        native_tcp_websock,
+        native_tls_websock,
+        native_ktls_websock
     >;
 
+    /// Construct Beast if the codec is beast, otherwise Native.
+    /// The native codec takes over rxbuf. Beast reads with rxbuf_ instead.
+    template<class Beast, class Native, class Transport>
+    static var_type
+    make_websock(Transport&& t, beast::flat_buffer& rxbuf, websocket_codec codec);
+
     var_type ws_;
     boost::beast::flat_buffer rxbuf_;
 
     condvar write_condition_;
     condvar join_condition_;
-    std::queue<std::string, std::deque<std::string>> txqueue_;
+    condvar tx_ready_;
+    std::queue<queued_frame, std::deque<queued_frame>> txqueue_;
     std::size_t outstanding_writes_ = 0;
+    std::uint64_t enqueued_seq_ = 0;
+    std::uint64_t flushed_seq_ = 0;
+    bool flushing_ = false;
+    bool writer_idle_ = false;
+    bool read_failed_ = false;
+    write_stats stats_;
     std::size_t last_read_size_ = 0;
+    websocket_read_limits read_limits_;
+
+    /// frames of the batch being sent by the native codec
+    std::vector<native_outbound> native_batch_;
+
+    /// metrics of the thread the websocket runs on
+    thread_metrics& metrics_ = this_thread_metrics();
+    std::size_t compression_reserved_ = 0;
     bool closing_ = false;
 };
 
 
-/// coroutine to perform write of a string to a shared websocket.
+/// coroutine to perform write of a payload to a shared websocket.
 /// @param impl is a shared_ptr to the websocket
-/// @param s is the string to write
+/// @param s is the payload to write. It is shared, not copied.
 /// @param type is the type of frame to write, defaults to text
 /// @return awaitable void
 /// @throw May throw if the write fails for any reason. This is an expected return path.
@@ -154,18 +302,29 @@ private:
 /// at any one time and the implementation must survive until the last remaining operation has completed.
 ///
 asio::awaitable<void>
-write(std::shared_ptr<any_websocket> impl, std::string s, frame_type type = frame_type::text);
+write(std::shared_ptr<any_websocket> impl, shared_payload s, frame_type type = frame_type::text);
 
-/// Add a string to the write queue of an any_websocket and return immediately.
+/// Add a payload to the write queue of an any_websocket and return immediately.
 /// Delivery of the write is not assured.
 /// The write will either be initiated immediately (if there is no other write in progress)
-/// or will await its turn in the write queue.
+/// or will be sent with the next batch of queued frames. No coroutine is started unless
+/// the queue was idle and no run_writer() coroutine is waiting for work.
 /// @param pws is a shared_ptr to an any_websocket. The shared_ptr is necessary in case the write
 /// is deferred.
-/// @param s is a string containing the bytes to write
+/// @param s is the payload to write. Queueing the same payload on many websockets shares 
+/// a single copy of its bytes.
 /// @param type is the type of frame to send. Defaults to text
 ///
 void 
-queue_write(std::shared_ptr<any_websocket> pws, std::string s, frame_type type = frame_type::text);
+queue_write(std::shared_ptr<any_websocket> pws, shared_payload s, frame_type type = frame_type::text);
+
+/// Coroutine which sends frames queued on a websocket as soon as they arrive, until a read on
+/// the websocket fails. While it runs, queue_write() only has to wake it, rather than start a
+/// new coroutine, when the queue was idle. Useful for websockets receiving a steady stream of
+/// messages from elsewhere, such as broadcast hub subscribers.
+/// @param impl is a shared_ptr to the websocket, which is kept alive while the writer runs.
+///
+asio::awaitable<void>
+run_writer(std::shared_ptr<any_websocket> impl);
 
 #endif
@@ -13,4 +13,13 @@ namespace asioex = asio::experimental;
 using error_code = boost::system::error_code;
 using system_error = boost::system::system_error;
 
+/// The backend asio performs i/o through, for logs and benchmark reports.
+/// Building with WEBSERVER_IO_URING selects io_uring, otherwise it is epoll.
+inline constexpr const char* asio_backend =
+#if defined(BOOST_ASIO_HAS_IO_URING_AS_DEFAULT)
+    "io_uring";
+#else
+    "epoll";
+#endif
+
 #endif
@@ -0,0 +1,186 @@
+#ifndef WEBSERVER_BROADCAST_HUB_HPP
+#define WEBSERVER_BROADCAST_HUB_HPP
+
+#include "any_websocket.hpp"
+#include "shared_payload.hpp"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/// A publish/subscribe hub which fans messages out to subscribers by topic.
+/// Subscribe, unsubscribe and publish do not depend on the number of subscribers, other
+/// than publish visiting each subscriber of its topic once. A published payload is shared
+/// by every subscriber's write queue, never copied.
+/// Delivery is by an unqualified call to queue_write(subscriber, payload, type).
+/// @note A hub is not thread safe. Use one hub per io_context.
+template < class Subscriber >
+struct basic_broadcast_hub
+{
+private:
+    struct topic;
+
+    struct entry
+    {
+        Subscriber subscriber;
+        topic* owner;
+        std::size_t index;
+    };
+
+    struct topic
+    {
+        std::string name;
+        std::vector< std::unique_ptr< entry > > entries;
+    };
+
+    struct string_hash
+    {
+        using is_transparent = void;
+
+        std::size_t
+        operator()(std::string_view s) const
+        {
+            return std::hash< std::string_view >()(s);
+        }
+    };
+
+public:
+    /// A subscriber's membership of a topic. Unsubscribes on destruction.
+    struct subscription
+    {
+        subscription() = default;
+
+        subscription(subscription&& other) noexcept
+        : hub_(std::exchange(other.hub_, nullptr))
+        , entry_(std::exchange(other.entry_, nullptr))
+        {
+        }
+
+        subscription&
+        operator=(subscription&& other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                hub_   = std::exchange(other.hub_, nullptr);
+                entry_ = std::exchange(other.entry_, nullptr);
+            }
+            return *this;
+        }
+
+        ~subscription() { reset(); }
+
+        /// Leave the topic now.
+        void
+        reset()
+        {
+            if (hub_)
+                hub_->unsubscribe(entry_);
+            hub_   = nullptr;
+            entry_ = nullptr;
+        }
+
+    private:
+        friend basic_broadcast_hub;
+
+        subscription(basic_broadcast_hub* hub, entry* e)
+        : hub_(hub)
+        , entry_(e)
+        {
+        }
+
+        basic_broadcast_hub* hub_ = nullptr;
+        entry* entry_             = nullptr;
+    };
+
+    basic_broadcast_hub() = default;
+    basic_broadcast_hub(basic_broadcast_hub const&) = delete;
+    basic_broadcast_hub& operator=(basic_broadcast_hub const&) = delete;
+
+    /// Add a subscriber to a topic, creating the topic if necessary.
+    /// @return the subscription, which must not outlive the hub.
+    [[nodiscard]] subscription
+    subscribe(std::string_view name, Subscriber s);
+
+    /// Queue a payload on every subscriber to a topic.
+    /// @return the number of subscribers reached.
+    std::size_t
+    publish(std::string_view name, shared_payload const& payload, frame_type type = frame_type::text);
+
+    std::size_t
+    subscriber_count(std::string_view name) const;
+
+    std::size_t
+    topic_count() const { return topics_.size(); }
+
+private:
+    void
+    unsubscribe(entry* e);
+
+    std::unordered_map< std::string, topic, string_hash, std::equal_to<> > topics_;
+};
+
+template < class Subscriber >
+auto
+basic_broadcast_hub< Subscriber >::subscribe(std::string_view name, Subscriber s) -> subscription
+{
+    auto i = topics_.find(name);
+    if (i == topics_.end())
+    {
+        i = topics_.emplace(std::string(name), topic()).first;
+        i->second.name = i->first;
+    }
+
+    auto& t = i->second;
+    auto& e = t.entries.emplace_back(std::make_unique< entry >(entry { std::move(s), &t, t.entries.size() }));
+    return subscription(this, e.get());
+}
+
+template < class Subscriber >
+void
+basic_broadcast_hub< Subscriber >::unsubscribe(entry* e)
+{
+    // swap with the last entry and pop
+    auto& t       = *e->owner;
+    auto const at = e->index;
+    if (at + 1 != t.entries.size())
+    {
+        std::swap(t.entries[at], t.entries.back());
+        t.entries[at]->index = at;
+    }
+    t.entries.pop_back();
+
+    if (t.entries.empty())
+        topics_.erase(topics_.find(t.name));
+}
+
+template < class Subscriber >
+std::size_t
+basic_broadcast_hub< Subscriber >::publish(std::string_view name, shared_payload const& payload, frame_type type)
+{
+    auto i = topics_.find(name);
+    if (i == topics_.end())
+        return 0;
+
+    auto& entries = i->second.entries;
+    for (auto& e : entries)
+        queue_write(e->subscriber, payload, type);
+    return entries.size();
+}
+
+template < class Subscriber >
+std::size_t
+basic_broadcast_hub< Subscriber >::subscriber_count(std::string_view name) const
+{
+    auto i = topics_.find(name);
+    return i == topics_.end() ? 0 : i->second.entries.size();
+}
+
+/// A hub whose subscribers are websockets.
+using broadcast_hub = basic_broadcast_hub< std::shared_ptr< any_websocket > >;
+
+#endif
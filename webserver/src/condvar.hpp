@@ -0,0 +1,41 @@
+#ifndef WEBSERVER_CONDVAR_HPP
+#define WEBSERVER_CONDVAR_HPP
+
+#include "asio.hpp"
+
+struct condvar
+{
+    using timer_type = asio::steady_timer;
+    using time_point = timer_type::time_point;
+
+    condvar(asio::any_io_executor exec)
+    : timer_(std::move(exec))
+    {
+        timer_.expires_at(time_point::max());
+    }
+
+    void
+    notify_all()
+    {
+        timer_.cancel();
+    }
+
+    void
+    notify_one()
+    {
+        timer_.cancel_one();
+    }
+
+    asio::awaitable<void>
+    wait()
+    {
+        auto [ec] = co_await timer_.async_wait(asioex::as_tuple(asio::use_awaitable));
+        if (ec && ec != asio::error::operation_aborted)
+            throw system_error(ec);
+        co_return;
+    }
+
+    asio::steady_timer timer_;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#include "connection_limiter.hpp"
+
+std::atomic< std::uint64_t > connection_limiter::accepted_ { 0 };
+std::atomic< std::uint64_t > connection_limiter::live_ { 0 };
+
+connection_limiter::connection_limiter(asio::any_io_executor exec, std::size_t max_connections)
+: slot_freed_(std::move(exec))
+, max_(max_connections ? max_connections : 1)
+{
+}
+
+asio::awaitable<void>
+connection_limiter::acquire()
+{
+    while (in_use_ >= max_)
+    {
+        co_await slot_freed_.wait();
+
+        // condvar treats cancellation as a notification, so check for it here
+        auto const cancelled = (co_await asio::this_coro::cancellation_state).cancelled();
+        if (cancelled != asio::cancellation_type::none)
+            throw system_error(asio::error::operation_aborted);
+    }
+    ++in_use_;
+}
+
+void
+connection_limiter::release()
+{
+    --in_use_;
+    slot_freed_.notify_one();
+}
+
+void
+connection_limiter::admitted()
+{
+    accepted_.fetch_add(1, std::memory_order_relaxed);
+    live_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void
+connection_limiter::closed()
+{
+    live_.fetch_sub(1, std::memory_order_relaxed);
+    release();
+}
+
+connection_totals
+connection_limiter::totals()
+{
+    return connection_totals { 
+        accepted_.load(std::memory_order_relaxed), 
+        live_.load(std::memory_order_relaxed) 
+    };
+}
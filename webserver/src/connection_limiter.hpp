@@ -0,0 +1,65 @@
+#ifndef WEBSERVER_CONNECTION_LIMITER_HPP
+#define WEBSERVER_CONNECTION_LIMITER_HPP
+
+#include "asio.hpp"
+#include "condvar.hpp"
+
+#include <atomic>
+#include <cstdint>
+
+/// Counts of connections across every limiter in the program
+struct connection_totals
+{
+    /// Connections accepted since the program started
+    std::uint64_t accepted = 0;
+
+    /// Connections currently open
+    std::uint64_t live = 0;
+};
+
+/// Admission control for one listener.
+/// Each accept first takes a slot. While every slot is taken, the listener's accept loops
+/// wait, and new connections queue in the kernel's listen backlog. Clients then see a slow
+/// connect rather than a server which has run out of file descriptors or memory.
+/// A limiter belongs to one io_context and must only be used from its thread.
+struct connection_limiter
+{
+    connection_limiter(asio::any_io_executor exec, std::size_t max_connections);
+
+    /// Coroutine which waits for a free slot and takes it. Supports cancellation.
+    /// @throw system_error(asio::error::operation_aborted) if cancelled.
+    asio::awaitable<void>
+    acquire();
+
+    /// Give back a slot taken by acquire() which was not used for a connection.
+    void
+    release();
+
+    /// Count a connection accepted on a slot.
+    void
+    admitted();
+
+    /// Give back the slot of a connection which has closed.
+    void
+    closed();
+
+    std::size_t
+    max_connections() const { return max_; }
+
+    /// Connections open on this listener, plus slots taken for accepts in progress
+    std::size_t
+    in_use() const { return in_use_; }
+
+    static connection_totals
+    totals();
+
+private:
+    condvar slot_freed_;
+    std::size_t max_;
+    std::size_t in_use_ = 0;
+
+    static std::atomic< std::uint64_t > accepted_;
+    static std::atomic< std::uint64_t > live_;
+};
+
+#endif
@@ -0,0 +1,352 @@
+#ifndef WEBSERVER_CORKED_STREAM_HPP
+#define WEBSERVER_CORKED_STREAM_HPP
+
+#include "asio.hpp"
+#include "beast.hpp"
+
+#include <boost/beast/core/buffers_cat.hpp>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/// A stream layer which can hold back small writes and send them together.
+/// While corked, writes complete immediately and their buffers are held back. Bytes which the
+/// caller has declared with hold() are kept by reference. Any others, such as the frame headers
+/// beast formats into a buffer it reuses, are copied, up to max_pending bytes. The first write
+/// which does not fit, or the first write after uncork(), sends everything held back followed
+/// by its own buffers in a single gather write.
+/// NextLayer may be a reference, for a layer wrapped around a stream owned elsewhere.
+/// @note Writes must not overlap. This is the case when the layer sits below a
+/// beast::websocket::stream, which serialises all of its writes.
+template < class NextLayer >
+struct corked_stream
+{
+    using next_layer_type = std::remove_reference_t< NextLayer >;
+    using executor_type   = typename next_layer_type::executor_type;
+
+    /// Largest number of bytes copied while corked
+    static constexpr std::size_t max_pending = 64 * 1024;
+
+    /// Largest number of buffers held back while corked
+    static constexpr std::size_t max_buffers = 128;
+
+    template < class... Args >
+    explicit corked_stream(Args&&... args)
+    : next_(std::forward< Args >(args)...)
+    {
+    }
+
+    executor_type
+    get_executor() noexcept
+    {
+        return next_.get_executor();
+    }
+
+    next_layer_type&
+    next_layer() noexcept
+    {
+        return next_;
+    }
+
+    next_layer_type const&
+    next_layer() const noexcept
+    {
+        return next_;
+    }
+
+    /// Start holding back writes.
+    void
+    cork()
+    {
+        corked_ = true;
+    }
+
+    /// Stop holding back writes. Pending bytes go out with the next write.
+    void
+    uncork()
+    {
+        corked_ = false;
+    }
+
+    bool
+    is_corked() const
+    {
+        return corked_;
+    }
+
+    /// Drop everything held back, and every hold(), without sending it. For use after a
+    /// write above this layer has failed, once what it held back is no longer wanted.
+    void
+    discard()
+    {
+        clear_pending();
+    }
+
+    /// Declare that the bytes of range stay valid until the writes held back have been sent,
+    /// because owner keeps them alive or, with no owner, because they are never freed.
+    /// Writes of those bytes are then held back by reference rather than copied.
+    /// Has no effect unless the layer is corked.
+    void
+    hold(asio::const_buffer range, std::shared_ptr< void const > owner = {})
+    {
+        if (!corked_)
+            return;
+        held_.push_back(range);
+        if (owner)
+            owners_.push_back(std::move(owner));
+    }
+
+    /// Send pending bytes before each read, so that nothing is held back while waiting for
+    /// the peer. Only safe where reads and writes never overlap, as on an http/1.1 connection.
+    void
+    flush_before_read(bool enable)
+    {
+        flush_before_read_ = enable;
+    }
+
+    /// Send the pending bytes, if any. Completes as if by post.
+    template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code)) FlushHandler >
+    BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(FlushHandler, void(error_code))
+    async_flush(FlushHandler&& handler);
+
+    template < class MutableBufferSequence,
+               BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code, std::size_t)) ReadHandler >
+    BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(ReadHandler, void(error_code, std::size_t))
+    async_read_some(MutableBufferSequence const& buffers, ReadHandler&& handler);
+
+    template < class ConstBufferSequence,
+               BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code, std::size_t)) WriteHandler >
+    BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(WriteHandler, void(error_code, std::size_t))
+    async_write_some(ConstBufferSequence const& buffers, WriteHandler&& handler);
+
+private:
+    /// A buffer held back: the caller's bytes, or, if ref.data() is null, ref.size() bytes
+    /// of copied_ from offset
+    struct piece
+    {
+        asio::const_buffer ref;
+        std::size_t offset = 0;
+    };
+
+    bool
+    has_pending() const
+    {
+        return !pieces_.empty();
+    }
+
+    bool
+    is_held(asio::const_buffer b) const
+    {
+        auto const p = static_cast< char const* >(b.data());
+
+        // the latest range is the likeliest, as hold() is called just before the write
+        for (auto it = held_.rbegin(); it != held_.rend(); ++it)
+        {
+            auto const first = static_cast< char const* >(it->data());
+            if (p >= first && p + b.size() <= first + it->size())
+                return true;
+        }
+        return false;
+    }
+
+    /// @return true if buffers can be held back within max_pending and max_buffers
+    template < class ConstBufferSequence >
+    bool
+    fits(ConstBufferSequence const& buffers) const
+    {
+        auto copied = copied_.size();
+        auto count  = pieces_.size();
+        for (auto it = asio::buffer_sequence_begin(buffers); it != asio::buffer_sequence_end(buffers); ++it)
+        {
+            auto const b = asio::const_buffer(*it);
+            if (b.size() == 0)
+                continue;
+            ++count;
+            if (!is_held(b))
+                copied += b.size();
+        }
+        return copied <= max_pending && count <= max_buffers;
+    }
+
+    template < class ConstBufferSequence >
+    void
+    append(ConstBufferSequence const& buffers)
+    {
+        for (auto it = asio::buffer_sequence_begin(buffers); it != asio::buffer_sequence_end(buffers); ++it)
+        {
+            auto const b = asio::const_buffer(*it);
+            if (b.size() == 0)
+                continue;
+            if (is_held(b))
+            {
+                pieces_.push_back(piece { b });
+                continue;
+            }
+
+            // bytes copied one after another form one piece
+            if (!pieces_.empty() && !pieces_.back().ref.data())
+                pieces_.back().ref = asio::const_buffer(nullptr, pieces_.back().ref.size() + b.size());
+            else
+                pieces_.push_back(piece { asio::const_buffer(nullptr, b.size()), copied_.size() });
+            copied_.append(static_cast< char const* >(b.data()), b.size());
+        }
+    }
+
+    /// The buffers held back, in order
+    std::vector< asio::const_buffer > const&
+    gather()
+    {
+        gather_.clear();
+        for (auto const& p : pieces_)
+            gather_.push_back(p.ref.data() ? p.ref : asio::const_buffer(copied_.data() + p.offset, p.ref.size()));
+        return gather_;
+    }
+
+    /// Forget everything held back, once it has been sent
+    void
+    clear_pending()
+    {
+        pieces_.clear();
+        gather_.clear();
+        held_.clear();
+        owners_.clear();
+        copied_.clear();
+
+        // an idle connection keeps no more than a small copy buffer
+        if (copied_.capacity() > 4096)
+            std::string().swap(copied_);
+    }
+
+    NextLayer next_;
+    std::vector< piece > pieces_;
+    std::string copied_;
+    std::vector< asio::const_buffer > gather_;
+    std::vector< asio::const_buffer > held_;
+    std::vector< std::shared_ptr< void const > > owners_;
+    bool corked_ = false;
+    bool flush_before_read_ = false;
+};
+
+template < class NextLayer >
+template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code)) FlushHandler >
+BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(FlushHandler, void(error_code))
+corked_stream< NextLayer >::async_flush(FlushHandler&& handler)
+{
+    return asio::async_compose< FlushHandler, void(error_code) >(
+        [this, coro = asio::coroutine()](auto& self, error_code ec = {}, std::size_t = 0) mutable
+        {
+            BOOST_ASIO_CORO_REENTER(coro)
+            {
+                if (!has_pending())
+                {
+                    BOOST_ASIO_CORO_YIELD
+                        asio::post(std::move(self));
+                    self.complete(error_code());
+                    return;
+                }
+
+                BOOST_ASIO_CORO_YIELD
+                    asio::async_write(next_, gather(), std::move(self));
+                clear_pending();
+                self.complete(ec);
+            }
+        },
+        handler,
+        next_);
+}
+
+template < class NextLayer >
+template < class MutableBufferSequence, BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code, std::size_t)) ReadHandler >
+BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(ReadHandler, void(error_code, std::size_t))
+corked_stream< NextLayer >::async_read_some(MutableBufferSequence const& buffers, ReadHandler&& handler)
+{
+    return asio::async_compose< ReadHandler, void(error_code, std::size_t) >(
+        [this, buffers, coro = asio::coroutine()]
+        (auto& self, error_code ec = {}, std::size_t n = 0) mutable
+        {
+            BOOST_ASIO_CORO_REENTER(coro)
+            {
+                if (flush_before_read_ && has_pending())
+                {
+                    BOOST_ASIO_CORO_YIELD
+                        async_flush(std::move(self));
+                    if (ec)
+                    {
+                        self.complete(ec, 0);
+                        return;
+                    }
+                }
+
+                BOOST_ASIO_CORO_YIELD
+                    next_.async_read_some(buffers, std::move(self));
+                self.complete(ec, n);
+            }
+        },
+        handler,
+        next_);
+}
+
+template < class NextLayer >
+template < class ConstBufferSequence, BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code, std::size_t)) WriteHandler >
+BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(WriteHandler, void(error_code, std::size_t))
+corked_stream< NextLayer >::async_write_some(ConstBufferSequence const& buffers, WriteHandler&& handler)
+{
+    return asio::async_compose< WriteHandler, void(error_code, std::size_t) >(
+        [this, buffers, size = asio::buffer_size(buffers), coro = asio::coroutine()]
+        (auto& self, error_code ec = {}, std::size_t n = 0) mutable
+        {
+            BOOST_ASIO_CORO_REENTER(coro)
+            {
+                if (!has_pending() && (!corked_ || !fits(buffers)))
+                {
+                    // nothing held back: pass straight through
+                    BOOST_ASIO_CORO_YIELD
+                        next_.async_write_some(buffers, std::move(self));
+                    self.complete(ec, n);
+                    return;
+                }
+
+                if (corked_ && fits(buffers))
+                {
+                    append(buffers);
+
+                    // complete as if by post
+                    BOOST_ASIO_CORO_YIELD
+                        asio::post(std::move(self));
+                    self.complete(error_code(), size);
+                    return;
+                }
+
+                // send everything held back, followed by these buffers, in one gather write
+                BOOST_ASIO_CORO_YIELD
+                    asio::async_write(next_,
+                        beast::buffers_cat(gather(), buffers),
+                        std::move(self));
+                clear_pending();
+                self.complete(ec, ec ? 0 : size);
+            }
+        },
+        handler,
+        next_);
+}
+
+template < class NextLayer >
+void
+teardown(beast::role_type role, corked_stream< NextLayer >& s, error_code& ec)
+{
+    using beast::teardown;
+    using beast::websocket::teardown;
+    teardown(role, s.next_layer(), ec);
+}
+
+template < class NextLayer, class TeardownHandler >
+void
+async_teardown(beast::role_type role, corked_stream< NextLayer >& s, TeardownHandler&& handler)
+{
+    using beast::async_teardown;
+    using beast::websocket::async_teardown;
+    async_teardown(role, s.next_layer(), std::forward< TeardownHandler >(handler));
+}
+
+#endif
@@ -0,0 +1,202 @@
+#include "detail/route_tree.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace detail
+{
+
+namespace
+{
+    bool
+    is_integer(std::string_view s)
+    {
+        if (!s.empty() && s.front() == '-')
+            s.remove_prefix(1);
+        return !s.empty() && std::all_of(s.begin(), s.end(), [](char c) { return c >= '0' && c <= '9'; });
+    }
+}
+
+route_tree::route_tree()
+: root_(std::make_unique< node >())
+{
+}
+
+route_tree::route_tree(route_tree&&) noexcept = default;
+
+route_tree&
+route_tree::operator=(route_tree&&) noexcept = default;
+
+route_tree::~route_tree() = default;
+
+void
+route_tree::insert(std::string_view pattern, std::size_t index)
+{
+    auto n = root_.get();
+    auto rest = pattern;
+    std::size_t nparams = 0;
+
+    while (!rest.empty())
+    {
+        auto const brace = rest.find('{');
+        if (auto literal = rest.substr(0, brace); !literal.empty())
+            n = &insert_literal(*n, literal);
+        if (brace == std::string_view::npos)
+            break;
+
+        auto const close = rest.find('}', brace);
+        if (close == std::string_view::npos)
+            throw std::invalid_argument("unterminated parameter in route");
+        auto const spec  = rest.substr(brace + 1, close - brace - 1);
+        rest             = rest.substr(close + 1);
+
+        auto const colon = spec.find(':');
+        auto const name  = spec.substr(0, colon);
+        auto const type  = colon == std::string_view::npos ? std::string_view() : spec.substr(colon + 1);
+        if (name.empty())
+            throw std::invalid_argument("unnamed parameter in route");
+        if (++nparams > route_params::max_params)
+            throw std::invalid_argument("too many parameters in route");
+
+        auto kind = param_kind::segment;
+        if (type == "int")
+            kind = param_kind::integer;
+        else if (type == "path")
+            kind = param_kind::path;
+        else if (!type.empty())
+            throw std::invalid_argument("unknown parameter type in route");
+
+        auto check_name = [name](node const& p)
+        {
+            if (p.name != name)
+                throw std::invalid_argument("conflicting parameter names in route");
+        };
+
+        if (kind == param_kind::path)
+        {
+            if (!rest.empty())
+                throw std::invalid_argument("path parameter must be last in route");
+            if (!n->rest)
+            {
+                n->rest       = std::make_unique< node >();
+                n->rest->kind = kind;
+                n->rest->name.assign(name.begin(), name.end());
+            }
+            check_name(*n->rest);
+            n = n->rest.get();
+        }
+        else
+        {
+            auto i = std::find_if(n->params.begin(), n->params.end(), [kind](auto& p) { return p->kind == kind; });
+            if (i == n->params.end())
+            {
+                auto p  = std::make_unique< node >();
+                p->kind = kind;
+                p->name.assign(name.begin(), name.end());
+                i = kind == param_kind::integer ? n->params.insert(n->params.begin(), std::move(p))
+                                                : n->params.insert(n->params.end(), std::move(p));
+            }
+            check_name(**i);
+            n = i->get();
+        }
+    }
+
+    if (n->index != npos)
+        throw std::invalid_argument("duplicate route");
+    n->index = index;
+}
+
+auto
+route_tree::insert_literal(node& n, std::string_view text) -> node&
+{
+    auto cur = &n;
+    while (!text.empty())
+    {
+        auto i = std::find_if(cur->children.begin(), cur->children.end(), [c = text.front()](auto& child) {
+            return child->prefix.front() == c;
+        });
+
+        if (i == cur->children.end())
+        {
+            auto& child = cur->children.emplace_back(std::make_unique< node >());
+            child->prefix.assign(text.begin(), text.end());
+            return *child;
+        }
+
+        auto& child  = *i;
+        auto common  = std::size_t(0);
+        auto limit   = std::min(child->prefix.size(), text.size());
+        while (common < limit && child->prefix[common] == text[common])
+            ++common;
+
+        if (common < child->prefix.size())
+        {
+            // split the edge at the end of the common prefix
+            auto tail = std::move(child);
+            child     = std::make_unique< node >();
+            child->prefix = tail->prefix.substr(0, common);
+            tail->prefix.erase(0, common);
+            child->children.push_back(std::move(tail));
+        }
+
+        cur = child.get();
+        text.remove_prefix(common);
+    }
+    return *cur;
+}
+
+std::size_t
+route_tree::match(std::string_view target, route_params& params) const
+{
+    params.clear();
+    auto const path = target.substr(0, target.find('?'));
+    auto index      = npos;
+    if (!match(*root_, path, params, index))
+        params.clear();
+    return index;
+}
+
+bool
+route_tree::match(node const& n, std::string_view path, route_params& params, std::size_t& index)
+{
+    if (path.empty())
+    {
+        index = n.index;
+        return index != npos;
+    }
+
+    for (auto& child : n.children)
+        if (child->prefix.front() == path.front())
+        {
+            if (path.substr(0, child->prefix.size()) == child->prefix &&
+                match(*child, path.substr(child->prefix.size()), params, index))
+                return true;
+            break;
+        }
+
+    if (!n.params.empty())
+    {
+        auto const segment = path.substr(0, path.find('/'));
+        if (!segment.empty())
+            for (auto& p : n.params)
+            {
+                if (p->kind == param_kind::integer && !is_integer(segment))
+                    continue;
+                if (!params.push(p->name, segment))
+                    continue;
+                if (match(*p, path.substr(segment.size()), params, index))
+                    return true;
+                params.pop();
+            }
+    }
+
+    if (n.rest && n.rest->index != npos && params.push(n.rest->name, path))
+    {
+        index = n.rest->index;
+        return true;
+    }
+
+    return false;
+}
+
+}
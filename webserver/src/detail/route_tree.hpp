@@ -0,0 +1,69 @@
+#ifndef DETAIL__ROUTE_TREE_HPP
+#define DETAIL__ROUTE_TREE_HPP
+
+#include "route_params.hpp"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace detail
+{
+
+/// A radix tree of compiled route patterns, mapping each to an index.
+/// Patterns are literal text with parameters in braces:
+///   {name}       - one non-empty path segment
+///   {name:int}   - one path segment of decimal digits, with optional leading '-'
+///   {name:path}  - the non-empty remainder of the path. Must be last.
+/// Literal text is preferred over parameters, and int parameters over untyped ones.
+struct route_tree
+{
+    static constexpr std::size_t npos = static_cast< std::size_t >(-1);
+
+    route_tree();
+    route_tree(route_tree&&) noexcept;
+    route_tree& operator=(route_tree&&) noexcept;
+    ~route_tree();
+
+    /// Add a pattern.
+    /// @throw std::invalid_argument if the pattern is malformed or is already present.
+    void
+    insert(std::string_view pattern, std::size_t index);
+
+    /// Match a target. Any query string is ignored.
+    /// @return the index of the matching pattern, or npos. On success params holds the captures.
+    std::size_t
+    match(std::string_view target, route_params& params) const;
+
+private:
+    enum class param_kind
+    {
+        segment,
+        integer,
+        path
+    };
+
+    struct node
+    {
+        std::string prefix;
+        std::vector< std::unique_ptr< node > > children;   // literal children, distinct first characters
+        std::vector< std::unique_ptr< node > > params;     // parameter children, integer before segment
+        std::unique_ptr< node > rest;                      // {name:path} child
+        param_kind kind = param_kind::segment;
+        std::string name;
+        std::size_t index = npos;
+    };
+
+    static node&
+    insert_literal(node& n, std::string_view text);
+
+    static bool
+    match(node const& n, std::string_view path, route_params& params, std::size_t& index);
+
+    std::unique_ptr< node > root_;
+};
+
+}
+
+#endif
@@ -0,0 +1,72 @@
+#include "io_context_pool.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+    void
+    pin_to_core(std::size_t index)
+    {
+#ifdef __linux__
+        auto ncores = std::thread::hardware_concurrency();
+        if (!ncores)
+            return;
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(index % ncores, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+        (void)index;
+#endif
+    }
+}
+
+io_context_pool::io_context_pool(std::size_t size)
+{
+    if (size == 0)
+        size = std::max(1u, std::thread::hardware_concurrency());
+
+    contexts_.reserve(size);
+    while (contexts_.size() < size)
+        contexts_.push_back(std::make_unique< asio::io_context >(1));
+}
+
+std::size_t
+io_context_pool::size() const
+{
+    return contexts_.size();
+}
+
+asio::io_context&
+io_context_pool::operator[](std::size_t i)
+{
+    return *contexts_[i];
+}
+
+void
+io_context_pool::run()
+{
+    auto threads = std::vector< std::thread >();
+    threads.reserve(contexts_.size() - 1);
+
+    for (std::size_t i = 1; i < contexts_.size(); ++i)
+        threads.emplace_back([this, i]
+        {
+            pin_to_core(i);
+            contexts_[i]->run();
+        });
+
+    if (contexts_.size() > 1)
+        pin_to_core(0);
+    contexts_[0]->run();
+
+    for (auto& t : threads)
+        t.join();
+}
@@ -0,0 +1,34 @@
+#ifndef WEBSERVER_IO_CONTEXT_POOL_HPP
+#define WEBSERVER_IO_CONTEXT_POOL_HPP
+
+#include "asio.hpp"
+
+#include <memory>
+#include <vector>
+
+/// A set of single-threaded io_contexts, one per thread.
+/// Each io_context is run by exactly one thread, so objects bound to a context's executor
+/// need no further synchronisation.
+struct io_context_pool
+{
+    /// Construct the pool.
+    /// @param size is the number of io_contexts. If zero, one per hardware thread is created.
+    explicit io_context_pool(std::size_t size);
+
+    std::size_t
+    size() const;
+
+    asio::io_context&
+    operator[](std::size_t i);
+
+    /// Run all io_contexts until they run out of work.
+    /// Context 0 is run on the calling thread, the others on their own threads, each pinned to a core
+    /// where the platform allows it. Returns once every thread has been joined.
+    void
+    run();
+
+private:
+    std::vector< std::unique_ptr< asio::io_context > > contexts_;
+};
+
+#endif
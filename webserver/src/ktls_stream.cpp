@@ -0,0 +1,194 @@
+#include "ktls_stream.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <sys/socket.h>
+
+namespace
+{
+    /// State of a BIO which returns some bytes already read from a socket, then reads the socket.
+    struct prefixed_socket
+    {
+        int fd;
+        std::string prefix;
+        std::size_t pos = 0;
+    };
+
+    int
+    prefixed_read(BIO* b, char* out, int len)
+    {
+        auto p = static_cast< prefixed_socket* >(BIO_get_data(b));
+        BIO_clear_retry_flags(b);
+
+        if (p->pos < p->prefix.size())
+        {
+            auto n = std::min(p->prefix.size() - p->pos, static_cast< std::size_t >(len));
+            std::memcpy(out, p->prefix.data() + p->pos, n);
+            p->pos += n;
+            if (p->pos == p->prefix.size())
+            {
+                p->prefix = std::string();
+                p->pos    = 0;
+            }
+            return static_cast< int >(n);
+        }
+
+        for (;;)
+        {
+            auto n = ::recv(p->fd, out, static_cast< std::size_t >(len), 0);
+            if (n >= 0)
+                return static_cast< int >(n);
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                BIO_set_retry_read(b);
+            return -1;
+        }
+    }
+
+    long
+    prefixed_ctrl(BIO*, int cmd, long, void*)
+    {
+        // everything else, including BIO_CTRL_SET_KTLS, is unsupported. Received records
+        // are therefore always decrypted by OpenSSL.
+        return cmd == BIO_CTRL_FLUSH ? 1 : 0;
+    }
+
+    int
+    prefixed_create(BIO* b)
+    {
+        BIO_set_init(b, 1);
+        return 1;
+    }
+
+    int
+    prefixed_destroy(BIO* b)
+    {
+        delete static_cast< prefixed_socket* >(BIO_get_data(b));
+        BIO_set_data(b, nullptr);
+        return 1;
+    }
+
+    BIO_METHOD*
+    prefixed_socket_method()
+    {
+        static BIO_METHOD* const method = []
+        {
+            auto m = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "prefixed socket");
+            BIO_meth_set_read(m, &prefixed_read);
+            BIO_meth_set_ctrl(m, &prefixed_ctrl);
+            BIO_meth_set_create(m, &prefixed_create);
+            BIO_meth_set_destroy(m, &prefixed_destroy);
+            return m;
+        }();
+        return method;
+    }
+}
+
+void
+enable_ktls(asio::ssl::context& ctx)
+{
+    auto native = ctx.native_handle();
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(native, SSL_OP_ENABLE_KTLS);
+#endif
+
+    // Linux offloads AES-GCM. Prefer it over the client's choice.
+    SSL_CTX_set_options(native, SSL_OP_CIPHER_SERVER_PREFERENCE);
+    SSL_CTX_set_ciphersuites(native, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256");
+    SSL_CTX_set_cipher_list(native, "ECDHE+AESGCM:DHE+AESGCM:HIGH:!aNULL:!MD5:!RC4");
+}
+
+bool
+ktls_enabled(asio::ssl::context& ctx)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+    return (SSL_CTX_get_options(ctx.native_handle()) & SSL_OP_ENABLE_KTLS) != 0;
+#else
+    return false;
+#endif
+}
+
+ktls_stream::ktls_stream(next_layer_type&& sock, asio::ssl::context& ctx)
+: sock_(std::move(sock))
+, ssl_(SSL_new(ctx.native_handle()))
+{
+    if (!ssl_)
+        throw system_error(error_code(static_cast< int >(ERR_get_error()), asio::error::get_ssl_category()));
+
+    sock_.native_non_blocking(true);
+    SSL_set_mode(ssl_.get(), SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    auto rbio = BIO_new(prefixed_socket_method());
+    BIO_set_data(rbio, new prefixed_socket { sock_.native_handle() });
+    auto wbio = BIO_new_socket(sock_.native_handle(), BIO_NOCLOSE);
+    SSL_set_bio(ssl_.get(), rbio, wbio);
+    SSL_set_accept_state(ssl_.get());
+}
+
+void
+ktls_stream::set_initial_data(asio::const_buffer initial)
+{
+    auto p = static_cast< prefixed_socket* >(BIO_get_data(SSL_get_rbio(ssl_.get())));
+    p->prefix.assign(static_cast< const char* >(initial.data()), initial.size());
+    p->pos = 0;
+}
+
+bool
+ktls_stream::kernel_send() const
+{
+    return BIO_get_ktls_send(SSL_get_wbio(ssl_.get())) != 0;
+}
+
+auto
+ktls_stream::classify(int result, error_code& ec) -> io_state
+{
+    switch (SSL_get_error(ssl_.get(), result))
+    {
+    case SSL_ERROR_NONE:
+        return io_state::done;
+    case SSL_ERROR_WANT_READ:
+        return io_state::want_read;
+    case SSL_ERROR_WANT_WRITE:
+        return io_state::want_write;
+    case SSL_ERROR_ZERO_RETURN:
+        ec = asio::error::eof;
+        return io_state::done;
+    case SSL_ERROR_SYSCALL:
+        if (errno)
+            ec = error_code(errno, asio::error::get_system_category());
+        else
+            ec = asio::ssl::error::stream_truncated;
+        return io_state::done;
+    default:
+    {
+        auto e = ERR_get_error();
+#ifdef SSL_R_UNEXPECTED_EOF_WHILE_READING
+        if (ERR_GET_REASON(e) == SSL_R_UNEXPECTED_EOF_WHILE_READING)
+        {
+            ec = asio::ssl::error::stream_truncated;
+            return io_state::done;
+        }
+#endif
+        ec = error_code(static_cast< int >(e), asio::error::get_ssl_category());
+        return io_state::done;
+    }
+    }
+}
+
+void
+ktls_stream::shutdown(error_code& ec)
+{
+    ERR_clear_error();
+    SSL_shutdown(ssl_.get());
+    ec = {};
+}
+
+void
+teardown(beast::role_type, ktls_stream& s, error_code& ec)
+{
+    s.shutdown(ec);
+}
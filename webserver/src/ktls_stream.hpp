@@ -0,0 +1,263 @@
+#ifndef WEBSERVER_KTLS_STREAM_HPP
+#define WEBSERVER_KTLS_STREAM_HPP
+
+#include "asio.hpp"
+#include "beast.hpp"
+
+#include <memory>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+/// Enable kernel TLS offload on a server context.
+/// Sets SSL_OP_ENABLE_KTLS and prefers the AES-GCM ciphers which Linux can offload.
+/// Connections accepted with the context should use ktls_stream rather than asio::ssl::stream.
+void
+enable_ktls(asio::ssl::context& ctx);
+
+/// @return true if enable_ktls() has been called on the context.
+bool
+ktls_enabled(asio::ssl::context& ctx);
+
+/// A tls stream which lets OpenSSL hand record encryption to the kernel.
+/// asio::ssl::stream drives OpenSSL through a pair of memory BIOs, so every record is encrypted
+/// in user space and copied. This stream gives OpenSSL the socket itself. When the kernel
+/// supports kTLS and an AES-GCM suite is negotiated, OpenSSL installs the session keys in the
+/// kernel after the handshake: writes then copy plain text into the kernel once, and files can
+/// be sent with sendfile(2). Otherwise the stream carries on in user space, unchanged.
+/// Reads are always decrypted by OpenSSL.
+/// @note As with asio::ssl::stream, at most one read and one write may be outstanding.
+struct ktls_stream
+{
+    using next_layer_type = asio::ip::tcp::socket;
+    using executor_type   = next_layer_type::executor_type;
+
+    /// Construct the stream.
+    /// @param sock is the connected socket. It is put into non-blocking mode.
+    /// @param ctx is the context to take the certificate and settings from.
+    ktls_stream(next_layer_type&& sock, asio::ssl::context& ctx);
+
+    ktls_stream(ktls_stream&&) noexcept = default;
+    ktls_stream& operator=(ktls_stream&&) noexcept = default;
+
+    executor_type
+    get_executor() noexcept
+    {
+        return sock_.get_executor();
+    }
+
+    next_layer_type&
+    next_layer() noexcept
+    {
+        return sock_;
+    }
+
+    next_layer_type const&
+    next_layer() const noexcept
+    {
+        return sock_;
+    }
+
+    SSL*
+    native_handle() noexcept
+    {
+        return ssl_.get();
+    }
+
+    /// Perform the server side of the handshake.
+    /// @param initial is data already read from the socket, such as by beast::async_detect_ssl,
+    /// which OpenSSL reads before anything else.
+    /// @return the number of bytes of initial consumed, which is always all of them.
+    template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code, std::size_t)) HandshakeHandler >
+    BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(HandshakeHandler, void(error_code, std::size_t))
+    async_handshake(asio::const_buffer initial, HandshakeHandler&& handler)
+    {
+        set_initial_data(initial);
+        return async_io([size = initial.size()](SSL* ssl, std::size_t& n)
+                        {
+                            n = size;
+                            return SSL_do_handshake(ssl);
+                        },
+                        false,
+                        std::forward< HandshakeHandler >(handler));
+    }
+
+    /// @return true if records sent on this stream are encrypted by the kernel.
+    bool
+    kernel_send() const;
+
+    template < class MutableBufferSequence,
+               BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code, std::size_t)) ReadHandler >
+    BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(ReadHandler, void(error_code, std::size_t))
+    async_read_some(MutableBufferSequence const& buffers, ReadHandler&& handler)
+    {
+        auto b = beast::buffers_front(buffers);
+        return async_io([b](SSL* ssl, std::size_t& n) { return SSL_read_ex(ssl, b.data(), b.size(), &n); },
+                        b.size() == 0,
+                        std::forward< ReadHandler >(handler));
+    }
+
+    template < class ConstBufferSequence,
+               BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code, std::size_t)) WriteHandler >
+    BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(WriteHandler, void(error_code, std::size_t))
+    async_write_some(ConstBufferSequence const& buffers, WriteHandler&& handler)
+    {
+        auto b = beast::buffers_front(buffers);
+        return async_io([b](SSL* ssl, std::size_t& n) { return SSL_write_ex(ssl, b.data(), b.size(), &n); },
+                        b.size() == 0,
+                        std::forward< WriteHandler >(handler));
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    /// Send a range of an open file, encrypted by the kernel straight from the page cache.
+    /// @pre kernel_send()
+    /// @return the number of bytes sent. May be less than count.
+    template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code, std::size_t)) WriteHandler >
+    BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(WriteHandler, void(error_code, std::size_t))
+    async_sendfile_some(int fd, off_t offset, std::size_t count, WriteHandler&& handler)
+    {
+        return async_io([fd, offset, count](SSL* ssl, std::size_t& n)
+                        {
+                            auto r = SSL_sendfile(ssl, fd, offset, count, 0);
+                            n      = r > 0 ? static_cast< std::size_t >(r) : 0;
+                            return r > 0 ? 1 : static_cast< int >(r);
+                        },
+                        count == 0,
+                        std::forward< WriteHandler >(handler));
+    }
+#endif
+
+    /// Send a close_notify alert. Does not wait for the peer's.
+    template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code)) ShutdownHandler >
+    BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(ShutdownHandler, void(error_code))
+    async_shutdown(ShutdownHandler&& handler);
+
+    /// Send a close_notify alert if it can be sent without blocking.
+    void
+    shutdown(error_code& ec);
+
+private:
+    enum class io_state
+    {
+        done,
+        want_read,
+        want_write
+    };
+
+    struct ssl_deleter
+    {
+        void
+        operator()(SSL* ssl) const
+        {
+            SSL_free(ssl);
+        }
+    };
+
+    /// Call an OpenSSL function once and classify the result.
+    template < class Op >
+    io_state
+    perform(Op& op, std::size_t& n, error_code& ec);
+
+    io_state
+    classify(int result, error_code& ec);
+
+    /// Give OpenSSL bytes to read before it reads from the socket.
+    void
+    set_initial_data(asio::const_buffer initial);
+
+    /// Run an OpenSSL function until it succeeds or fails, waiting on the socket as it asks.
+    /// Completes as if by post.
+    template < class Op, class CompletionToken >
+    auto
+    async_io(Op op, bool empty, CompletionToken&& token);
+
+    next_layer_type sock_;
+    std::unique_ptr< SSL, ssl_deleter > ssl_;
+};
+
+template < class Op >
+auto
+ktls_stream::perform(Op& op, std::size_t& n, error_code& ec) -> io_state
+{
+    ERR_clear_error();
+    return classify(op(ssl_.get(), n), ec);
+}
+
+template < class Op, class CompletionToken >
+auto
+ktls_stream::async_io(Op op, bool empty, CompletionToken&& token)
+{
+    return asio::async_compose< CompletionToken, void(error_code, std::size_t) >(
+        [this, op, empty, coro = asio::coroutine(), state = io_state::done, n = std::size_t(0), result = error_code()]
+        (auto& self, error_code ec = {}) mutable
+        {
+            BOOST_ASIO_CORO_REENTER(coro)
+            {
+                if (!empty)
+                {
+                    for (;;)
+                    {
+                        state = perform(op, n, result);
+                        if (state == io_state::done)
+                            break;
+
+                        BOOST_ASIO_CORO_YIELD
+                            sock_.async_wait(state == io_state::want_read
+                                    ? next_layer_type::wait_read
+                                    : next_layer_type::wait_write,
+                                std::move(self));
+                        if (ec)
+                        {
+                            self.complete(ec, 0);
+                            return;
+                        }
+                    }
+                }
+
+                // complete as if by post, even if no wait was needed
+                BOOST_ASIO_CORO_YIELD
+                    asio::post(sock_.get_executor(), std::move(self));
+                self.complete(result, n);
+            }
+        },
+        token,
+        sock_);
+}
+
+template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code)) ShutdownHandler >
+BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(ShutdownHandler, void(error_code))
+ktls_stream::async_shutdown(ShutdownHandler&& handler)
+{
+    return asio::async_compose< ShutdownHandler, void(error_code) >(
+        [this, coro = asio::coroutine()](auto& self, error_code ec = {}, std::size_t = 0) mutable
+        {
+            BOOST_ASIO_CORO_REENTER(coro)
+            {
+                BOOST_ASIO_CORO_YIELD
+                    async_io([](SSL* ssl, std::size_t& n)
+                               {
+                                   // 0 means our close_notify is sent, which is all we wait for
+                                   n = 0;
+                                   auto r = SSL_shutdown(ssl);
+                                   return r == 0 ? 1 : r;
+                               },
+                               false,
+                               std::move(self));
+                self.complete(ec);
+            }
+        },
+        handler,
+        sock_);
+}
+
+void
+teardown(beast::role_type role, ktls_stream& s, error_code& ec);
+
+template < class TeardownHandler >
+void
+async_teardown(beast::role_type role, ktls_stream& s, TeardownHandler&& handler)
+{
+    s.async_shutdown(std::forward< TeardownHandler >(handler));
+}
+
+#endif
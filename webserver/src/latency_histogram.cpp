@@ -0,0 +1,94 @@
+#include "latency_histogram.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+std::size_t
+latency_histogram::bucket_index(std::uint64_t value)
+{
+    if (value < sub_bucket_count)
+        return static_cast< std::size_t >(value);
+
+    // keep the top sub_bucket_bits bits of the value
+    auto const shift = static_cast< unsigned >(std::bit_width(value)) - sub_bucket_bits;
+    auto const sub   = static_cast< std::size_t >(value >> shift) - sub_bucket_half;
+    return sub_bucket_count + (shift - 1) * sub_bucket_half + sub;
+}
+
+std::uint64_t
+latency_histogram::lowest_equivalent(std::size_t index)
+{
+    if (index < sub_bucket_count)
+        return index;
+
+    auto const shift = (index - sub_bucket_count) / sub_bucket_half + 1;
+    auto const sub   = (index - sub_bucket_count) % sub_bucket_half + sub_bucket_half;
+    return std::uint64_t(sub) << shift;
+}
+
+std::uint64_t
+latency_histogram::highest_equivalent(std::size_t index)
+{
+    if (index + 1 == bucket_count)
+        return std::numeric_limits< std::uint64_t >::max();
+    return lowest_equivalent(index + 1) - 1;
+}
+
+void
+latency_histogram::record(std::uint64_t value)
+{
+    ++counts_[bucket_index(value)];
+    ++count_;
+    sum_ += value;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+}
+
+void
+latency_histogram::record(std::uint64_t value, std::uint64_t times)
+{
+    if (!times)
+        return;
+    counts_[bucket_index(value)] += times;
+    count_ += times;
+    sum_ += value * times;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+}
+
+void
+latency_histogram::merge(latency_histogram const& other)
+{
+    for (std::size_t i = 0; i < bucket_count; ++i)
+        counts_[i] += other.counts_[i];
+    count_ += other.count_;
+    sum_ += other.sum_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+}
+
+void
+latency_histogram::reset()
+{
+    *this = latency_histogram();
+}
+
+std::uint64_t
+latency_histogram::value_at_percentile(double percentile) const
+{
+    if (!count_)
+        return 0;
+
+    percentile = std::clamp(percentile, 0.0, 100.0);
+    auto const wanted = std::max< std::uint64_t >(1, static_cast< std::uint64_t >(std::ceil(percentile / 100.0 * double(count_))));
+
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < bucket_count; ++i)
+    {
+        seen += counts_[i];
+        if (seen >= wanted)
+            return std::min(highest_equivalent(i), max_);
+    }
+    return max_;
+}
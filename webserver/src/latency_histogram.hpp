@@ -0,0 +1,80 @@
+#ifndef WEBSERVER_LATENCY_HISTOGRAM_HPP
+#define WEBSERVER_LATENCY_HISTOGRAM_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+/// A histogram of non-negative integer values, such as latencies in nanoseconds, in the
+/// style of HdrHistogram.
+/// Values are counted in log-linear buckets: every power of two range is split into 64
+/// equal sub-buckets, so any recorded value is reported to within 1.6% of its true value
+/// over the whole 64 bit range. Recording is a few instructions and never allocates.
+/// @note Not thread safe. Record into one histogram per thread and merge() them for reporting.
+struct latency_histogram
+{
+    static constexpr unsigned sub_bucket_bits      = 7;
+    static constexpr std::size_t sub_bucket_count  = std::size_t(1) << sub_bucket_bits;
+    static constexpr std::size_t sub_bucket_half   = sub_bucket_count / 2;
+    static constexpr std::size_t bucket_count      = sub_bucket_count + (64 - sub_bucket_bits) * sub_bucket_half;
+
+    void
+    record(std::uint64_t value);
+
+    /// Record a value several times over.
+    void
+    record(std::uint64_t value, std::uint64_t times);
+
+    void
+    merge(latency_histogram const& other);
+
+    void
+    reset();
+
+    std::uint64_t
+    count() const { return count_; }
+
+    std::uint64_t
+    min() const { return count_ ? min_ : 0; }
+
+    std::uint64_t
+    max() const { return max_; }
+
+    double
+    mean() const { return count_ ? double(sum_) / double(count_) : 0.0; }
+
+    /// The value below which the given percentage of recorded values fall.
+    /// @param percentile is in the range [0, 100].
+    /// @return the highest value equivalent to the bucket holding that percentile, or zero if empty.
+    std::uint64_t
+    value_at_percentile(double percentile) const;
+
+    /// Visit each non-empty bucket in ascending order, as f(upper_bound, count).
+    template < class F >
+    void
+    for_each_bucket(F&& f) const
+    {
+        for (std::size_t i = 0; i < bucket_count; ++i)
+            if (counts_[i])
+                f(highest_equivalent(i), counts_[i]);
+    }
+
+    static std::size_t
+    bucket_index(std::uint64_t value);
+
+    static std::uint64_t
+    lowest_equivalent(std::size_t index);
+
+    static std::uint64_t
+    highest_equivalent(std::size_t index);
+
+private:
+    std::array< std::uint64_t, bucket_count > counts_ {};
+    std::uint64_t count_ = 0;
+    std::uint64_t sum_   = 0;
+    std::uint64_t min_   = std::numeric_limits< std::uint64_t >::max();
+    std::uint64_t max_   = 0;
+};
+
+#endif
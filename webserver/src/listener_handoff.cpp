@@ -0,0 +1,282 @@
+#include "listener_handoff.hpp"
+#include "logger.hpp"
+#include "object_id.hpp"
+#include "timer_wheel.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace
+{
+    /// Most sockets passed in one message, of as many as are needed. The kernel's limit is 253.
+    constexpr std::size_t max_fds = 64;
+
+    /// The descriptor at which the successor finds the handoff socket
+    constexpr int successor_fd = 3;
+
+    system_error
+    last_error(const char* what)
+    {
+        return system_error(error_code(errno, asio::error::get_system_category()), what);
+    }
+
+    /// In the child, between fork and exec: keep only stdio and the handoff socket.
+    /// Only async-signal-safe calls may be made here.
+    [[noreturn]] void
+    exec_successor(int handoff, const char* executable, char** argv, char** envp)
+    {
+        if (handoff != successor_fd)
+            ::dup2(handoff, successor_fd);
+        else
+            ::fcntl(successor_fd, F_SETFD, 0);
+
+#ifdef SYS_close_range
+        if (::syscall(SYS_close_range, successor_fd + 1, ~0U, 0) != 0)
+#endif
+        {
+            for (int fd = successor_fd + 1, last = int(::sysconf(_SC_OPEN_MAX)); fd < last; ++fd)
+                ::close(fd);
+        }
+
+        // not /proc/self/exe, which is the build already running even once a new one is deployed
+        ::execve(executable, argv, envp);
+        ::_exit(127);
+    }
+
+    /// Send one batch of at most max_fds sockets. The data byte is their number, and zero ends
+    /// the handoff.
+    void
+    send_batch(int sock, int const* fds, std::size_t count)
+    {
+        auto n = static_cast< unsigned char >(count);
+        auto iov = ::iovec { &n, 1 };
+
+        alignas(::cmsghdr) char control[CMSG_SPACE(sizeof(int) * max_fds)] = {};
+        auto msg = ::msghdr();
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if (count)
+        {
+            msg.msg_control = control;
+            msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+            auto cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+            std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+        }
+
+        if (::sendmsg(sock, &msg, MSG_NOSIGNAL) < 0)
+            throw last_error("sendmsg");
+    }
+
+    /// Send the sockets in batches of max_fds, then an empty batch to end the handoff.
+    void
+    send_fds(int sock, std::vector<int> const& fds)
+    {
+        for (std::size_t i = 0; i < fds.size(); i += max_fds)
+            send_batch(sock, fds.data() + i, std::min(max_fds, fds.size() - i));
+        send_batch(sock, nullptr, 0);
+    }
+
+    /// Receive one batch of sockets sent by send_batch(), appending them to fds.
+    /// @return the number of sockets in the batch, which is zero at the end of the handoff.
+    std::size_t
+    receive_batch(int sock, std::vector<int>& fds)
+    {
+        unsigned char count = 0;
+        auto iov = ::iovec { &count, 1 };
+        alignas(::cmsghdr) char control[CMSG_SPACE(sizeof(int) * max_fds)] = {};
+        auto msg = ::msghdr();
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        auto n = ::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0)
+            throw last_error("recvmsg");
+        if (n == 0)
+            throw std::runtime_error("predecessor closed the handoff socket");
+
+        auto const first = fds.size();
+        for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+                continue;
+            auto const received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            auto const end = fds.size();
+            fds.resize(end + received);
+            std::memcpy(fds.data() + end, CMSG_DATA(cmsg), received * sizeof(int));
+        }
+
+        if (fds.size() - first != count || (msg.msg_flags & MSG_CTRUNC))
+            throw std::runtime_error("expected " + std::to_string(count) + " sockets from predecessor, received " 
+                + std::to_string(fds.size() - first));
+        return count;
+    }
+}
+
+std::string
+successor_executable(const char* argv0)
+{
+    namespace fs = std::filesystem;
+
+    if (auto env = std::getenv(successor_exe_env))
+        return fs::absolute(env).lexically_normal().string();
+
+    auto const name = std::string_view(argv0);
+    if (name.find('/') != std::string_view::npos)
+        return fs::absolute(name).lexically_normal().string();
+
+    // found on PATH, as the shell found it. An empty entry is the working directory.
+    auto const path = std::getenv("PATH");
+    auto dirs = std::string_view(path ? path : "");
+    for (;;)
+    {
+        auto const colon = dirs.find(':');
+        auto const dir = dirs.substr(0, colon);
+        auto candidate = fs::absolute(dir.empty() ? fs::path(".") : fs::path(dir)) / name;
+        if (::access(candidate.c_str(), X_OK) == 0)
+            return candidate.string();
+        if (colon == std::string_view::npos)
+            break;
+        dirs.remove_prefix(colon + 1);
+    }
+    throw std::runtime_error(std::string(name) + " not found on PATH, set " + successor_exe_env);
+}
+
+asio::awaitable<bool>
+hand_off_listeners(std::vector<int> const& fds, 
+    std::string const& executable, 
+    char** argv, 
+    std::chrono::milliseconds timeout)
+{
+    using namespace asioex::awaitable_operators;
+
+    auto me = object_id(__func__);
+    if (fds.empty())
+    {
+        log_error(me, "cannot hand off ", fds.size(), " sockets");
+        co_return false;
+    }
+
+    int pair[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0)
+    {
+        log_error(me, "socketpair: ", std::strerror(errno));
+        co_return false;
+    }
+
+    // the successor's environment, built before fork because the child may not allocate
+    auto env_strings = std::vector< std::string >();
+    for (auto e = environ; *e; ++e)
+        if (!std::string_view(*e).starts_with(std::string(handoff_fd_env) + '='))
+            env_strings.emplace_back(*e);
+    env_strings.push_back(std::string(handoff_fd_env) + '=' + std::to_string(successor_fd));
+    auto envp = std::vector< char* >();
+    for (auto& s : env_strings)
+        envp.push_back(s.data());
+    envp.push_back(nullptr);
+
+    auto const pid = ::fork();
+    if (pid == 0)
+        exec_successor(pair[1], executable.c_str(), argv, envp.data());
+    ::close(pair[1]);
+    if (pid < 0)
+    {
+        log_error(me, "fork: ", std::strerror(errno));
+        ::close(pair[0]);
+        co_return false;
+    }
+
+    auto exec = co_await asio::this_coro::executor;
+    auto sock = asio::local::stream_protocol::socket(exec, asio::local::stream_protocol(), pair[0]);
+    auto ok = false;
+    try
+    {
+        send_fds(sock.native_handle(), fds);
+
+        char ack = 0;
+        auto which = co_await (
+            sock.async_read_some(asio::buffer(&ack, 1), asio::use_awaitable) ||
+            timer_wheel::of(exec).async_wait(timeout, asio::use_awaitable)
+        );
+        ok = which.index() == 0;
+        if (!ok)
+            log_error(me, "successor ", pid, " did not take the sockets in time");
+    }
+    catch (std::exception& e)
+    {
+        log_error(me, "successor ", pid, ": ", e.what());
+    }
+
+    if (ok)
+        log_info(me, "listening sockets taken by successor ", pid);
+    else
+    {
+        ::kill(pid, SIGKILL);
+        ::waitpid(pid, nullptr, 0);
+    }
+    co_return ok;
+}
+
+inherited_listeners
+inherited_listeners::receive()
+{
+    auto result = inherited_listeners();
+    auto env = std::getenv(handoff_fd_env);
+    if (!env)
+        return result;
+
+    auto const value = std::string_view(env);
+    auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), result.handoff_fd_);
+    if (ec != std::errc() || ptr != value.data() + value.size())
+        throw std::invalid_argument(std::string(handoff_fd_env) + " must be a descriptor number");
+    ::fcntl(result.handoff_fd_, F_SETFD, FD_CLOEXEC);
+
+    while (receive_batch(result.handoff_fd_, result.fds))
+        ;
+    return result;
+}
+
+inherited_listeners::inherited_listeners(inherited_listeners&& other) noexcept
+: fds(std::move(other.fds))
+, handoff_fd_(std::exchange(other.handoff_fd_, -1))
+{
+}
+
+inherited_listeners::~inherited_listeners()
+{
+    if (handoff_fd_ >= 0)
+        ::close(handoff_fd_);
+}
+
+void
+inherited_listeners::acknowledge()
+{
+    if (handoff_fd_ < 0)
+        return;
+
+    char const ack = 1;
+    if (::send(handoff_fd_, &ack, 1, MSG_NOSIGNAL) != 1)
+        log_warn(object_id(__func__), "could not acknowledge handoff: ", std::strerror(errno));
+    ::close(std::exchange(handoff_fd_, -1));
+}
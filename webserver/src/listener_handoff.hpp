@@ -0,0 +1,68 @@
+#ifndef WEBSERVER_LISTENER_HANDOFF_HPP
+#define WEBSERVER_LISTENER_HANDOFF_HPP
+
+#include "asio.hpp"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+/// The environment variable through which a successor finds its end of the handoff socket
+inline constexpr const char* handoff_fd_env = "WEBSERVER_HANDOFF_FD";
+
+/// The environment variable which overrides the executable a successor is started from
+inline constexpr const char* successor_exe_env = "WEBSERVER_EXE";
+
+/// The path of the executable to start a successor from: WEBSERVER_EXE if set, otherwise
+/// argv[0], searched for on PATH if it has no slash. It is made absolute, so call this at
+/// startup, before the working directory can change. Symbolic links are not resolved, so a
+/// deploy which renames a new build into place, or repoints a link at it, is picked up.
+/// @throw std::runtime_error if argv[0] is not found on PATH.
+std::string
+successor_executable(const char* argv0);
+
+/// Start a new instance of the program and pass it the listening sockets, for a restart
+/// which refuses no connections.
+/// The successor runs executable with the same arguments and environment, plus
+/// WEBSERVER_HANDOFF_FD naming its end of a unix socket. It inherits no other descriptors.
+/// The listening sockets are sent over the unix socket with SCM_RIGHTS. They stay open in
+/// both processes, so connections queue in their backlogs throughout.
+/// @param fds are the listening sockets.
+/// @param executable is the path returned by successor_executable().
+/// @param argv is the program's argument vector, as passed to main.
+/// @param timeout is how long to wait for the successor to take the sockets.
+/// @return true once the successor has taken the sockets, after which the caller should stop
+/// accepting. On false, the successor has been stopped and the caller carries on as before.
+asio::awaitable<bool>
+hand_off_listeners(std::vector<int> const& fds, 
+    std::string const& executable, 
+    char** argv, 
+    std::chrono::milliseconds timeout);
+
+/// The listening sockets passed to this instance by its predecessor, if any.
+struct inherited_listeners
+{
+    /// Take the sockets from the predecessor, if WEBSERVER_HANDOFF_FD is set. Blocks until
+    /// they arrive.
+    /// @throw system_error if they cannot be received.
+    static inherited_listeners
+    receive();
+
+    inherited_listeners() = default;
+    inherited_listeners(inherited_listeners&& other) noexcept;
+    inherited_listeners& operator=(inherited_listeners&&) = delete;
+    ~inherited_listeners();
+
+    /// Tell the predecessor that its sockets have been taken, so that it stops accepting.
+    /// Call once the sockets are in use. Does nothing if there was no predecessor.
+    void
+    acknowledge();
+
+    /// The listening sockets, owned by the caller from now on
+    std::vector<int> fds;
+
+private:
+    int handoff_fd_ = -1;
+};
+
+#endif
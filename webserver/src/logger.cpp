@@ -0,0 +1,241 @@
+#include "logger.hpp"
+
+#include <bit>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <unistd.h>
+
+namespace detail
+{
+
+log_ring::log_ring(std::size_t capacity)
+: slots_(new log_record[std::bit_ceil(std::max< std::size_t >(capacity, 2))])
+, mask_(std::bit_ceil(std::max< std::size_t >(capacity, 2)) - 1)
+{
+}
+
+log_record*
+log_ring::try_reserve()
+{
+    auto const head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) > mask_)
+        return nullptr;
+    return &slots_[head & mask_];
+}
+
+void
+log_ring::commit()
+{
+    head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+log_record*
+log_ring::front()
+{
+    auto const tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire))
+        return nullptr;
+    return &slots_[tail & mask_];
+}
+
+void
+log_ring::pop()
+{
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+}
+
+namespace
+{
+    constexpr const char* level_names[] = { "TRACE", "DEBUG", "INFO ", "WARN ", "ERROR" };
+
+    thread_local detail::log_ring* this_thread_ring = nullptr;
+
+    void
+    write_prefix(std::ostream& os, log_level level, std::chrono::system_clock::time_point time)
+    {
+        using namespace std::chrono;
+        auto const t  = system_clock::to_time_t(time);
+        auto const us = duration_cast< microseconds >(time.time_since_epoch()).count() % 1000000;
+        auto tm       = std::tm();
+        gmtime_r(&t, &tm);
+        os << std::put_time(&tm, "%Y-%m-%dT%H:%M:%S") << '.' << std::setw(6) << std::setfill('0') << us
+           << std::setfill(' ') << "Z " << level_names[static_cast< int >(level)] << ' ';
+    }
+
+    void
+    write_fd(int fd, std::string_view s)
+    {
+        while (!s.empty())
+        {
+            auto n = ::write(fd, s.data(), s.size());
+            if (n <= 0)
+                return;
+            s.remove_prefix(static_cast< std::size_t >(n));
+        }
+    }
+}
+
+log_level
+parse_log_level(std::string_view name, log_level fallback)
+{
+    if (name == "trace")
+        return log_level::trace;
+    if (name == "debug")
+        return log_level::debug;
+    if (name == "info")
+        return log_level::info;
+    if (name == "warn")
+        return log_level::warn;
+    if (name == "error")
+        return log_level::error;
+    if (name == "off")
+        return log_level::off;
+    return fallback;
+}
+
+logger&
+logger::instance()
+{
+    static logger l;
+    return l;
+}
+
+void
+logger::start(logger_options const& options)
+{
+    if (running_.load())
+        return;
+
+    level_.store(options.level);
+    overflow_      = options.overflow;
+    ring_capacity_ = options.ring_capacity;
+    running_.store(true, std::memory_order_release);
+    thread_ = std::thread([this] { run(); });
+}
+
+void
+logger::stop()
+{
+    if (!running_.exchange(false))
+        return;
+    thread_.join();
+}
+
+detail::log_record*
+logger::reserve()
+{
+    if (!this_thread_ring)
+    {
+        auto const i = ring_count_.load(std::memory_order_relaxed);
+        if (i == max_threads)
+            return nullptr;
+
+        // rings are registered by their own thread and live until the process exits, because
+        // the background thread may still be draining them after their thread has gone
+        auto ring = new detail::log_ring(ring_capacity_);
+        auto n    = i;
+        while (!ring_count_.compare_exchange_weak(n, n + 1))
+            if (n == max_threads)
+            {
+                delete ring;
+                return nullptr;
+            }
+        rings_[n].store(ring, std::memory_order_release);
+        this_thread_ring = ring;
+    }
+
+    auto rec = this_thread_ring->try_reserve();
+    if (!rec && overflow_ == log_overflow::block)
+        while (!rec && running_.load(std::memory_order_relaxed))
+        {
+            std::this_thread::yield();
+            rec = this_thread_ring->try_reserve();
+        }
+
+    if (!rec)
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    return rec;
+}
+
+void
+logger::commit()
+{
+    this_thread_ring->commit();
+}
+
+void
+logger::write_now(log_level level,
+                  std::chrono::system_clock::time_point time,
+                  detail::log_record::format_fn format,
+                  void* storage)
+{
+    auto os = std::ostringstream();
+    write_prefix(os, level, time);
+    format(os, storage);
+    os << '\n';
+    write_fd(level >= log_level::warn ? STDERR_FILENO : STDOUT_FILENO, os.view());
+}
+
+void
+logger::run()
+{
+    auto out = std::ostringstream();
+    auto err = std::ostringstream();
+    auto reported_drops = std::uint64_t(0);
+    auto idle           = std::chrono::microseconds(0);
+
+    auto drain = [&] {
+        std::size_t count = 0;
+        auto const nrings = ring_count_.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < nrings; ++i)
+        {
+            auto ring = rings_[i].load(std::memory_order_acquire);
+            if (!ring)
+                continue;
+
+            while (auto rec = ring->front())
+            {
+                auto& os = rec->level >= log_level::warn ? err : out;
+                write_prefix(os, rec->level, rec->time);
+                rec->format(os, rec->storage);
+                os << '\n';
+                ring->pop();
+                ++count;
+            }
+        }
+
+        if (auto const d = dropped(); d != reported_drops)
+        {
+            write_prefix(err, log_level::warn, std::chrono::system_clock::now());
+            err << "logger: " << (d - reported_drops) << " records dropped\n";
+            reported_drops = d;
+        }
+
+        auto flush = [](std::ostringstream& os, int fd) {
+            if (os.view().empty())
+                return;
+            write_fd(fd, os.view());
+            os.str(std::string());
+        };
+        flush(out, STDOUT_FILENO);
+        flush(err, STDERR_FILENO);
+        return count;
+    };
+
+    while (running_.load(std::memory_order_acquire))
+    {
+        if (drain())
+            idle = std::chrono::microseconds(0);
+        else
+        {
+            // back off while there is nothing to do
+            idle = std::min(idle * 2 + std::chrono::microseconds(50), std::chrono::microseconds(10000));
+            std::this_thread::sleep_for(idle);
+        }
+    }
+
+    drain();
+}
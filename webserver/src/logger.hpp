@@ -0,0 +1,425 @@
+#ifndef WEBSERVER_LOGGER_HPP
+#define WEBSERVER_LOGGER_HPP
+
+#include "asio.hpp"
+#include "object_id.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <ostream>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+
+enum class log_level : std::uint8_t
+{
+    trace,
+    debug,
+    info,
+    warn,
+    error,
+    off
+};
+
+/// What a producing thread does when its ring buffer is full
+enum class log_overflow : std::uint8_t
+{
+    /// discard the record and count it
+    drop,
+
+    /// wait for the background thread to make room
+    block
+};
+
+struct logger_options
+{
+    log_level level = log_level::info;
+    log_overflow overflow = log_overflow::drop;
+
+    /// Records buffered per producing thread. Rounded up to a power of two.
+    std::size_t ring_capacity = 1024;
+};
+
+/// Parse a level name such as "debug" or "warn".
+/// @return the level, or fallback if the name is not recognised
+log_level
+parse_log_level(std::string_view name, log_level fallback = log_level::info);
+
+namespace detail
+{
+
+/// A log record. Arguments are captured by value into fixed storage by the producer, and
+/// formatted on the background thread.
+struct alignas(64) log_record
+{
+    static constexpr std::size_t storage_size = 288;
+
+    /// formats the captured arguments and destroys them
+    using format_fn = void (*)(std::ostream&, void*);
+
+    std::chrono::system_clock::time_point time;
+    format_fn format;
+    log_level level;
+    alignas(std::max_align_t) unsigned char storage[storage_size];
+};
+
+/// Single-producer, single-consumer ring of log records.
+struct log_ring
+{
+    explicit log_ring(std::size_t capacity);
+
+    /// The next free slot, or nullptr if the ring is full. Producer only.
+    log_record*
+    try_reserve();
+
+    /// Publish the slot returned by try_reserve(). Producer only.
+    void
+    commit();
+
+    /// The oldest record, or nullptr if the ring is empty. Consumer only.
+    log_record*
+    front();
+
+    /// Release the record returned by front(). Consumer only.
+    void
+    pop();
+
+private:
+    std::unique_ptr< log_record[] > slots_;
+    std::size_t mask_;
+    alignas(64) std::atomic< std::size_t > head_ { 0 };
+    alignas(64) std::atomic< std::size_t > tail_ { 0 };
+};
+
+/// A string copied into a record. Strings of up to capacity characters are held in the
+/// record. Longer ones, truncated to max_size, are copied to a heap block, which is freed
+/// once the record has been written.
+struct log_string
+{
+    static constexpr std::size_t capacity = 56;
+    static constexpr std::size_t max_size = 4096;
+
+    log_string(const char* p, std::size_t n)
+    : size_(static_cast< std::uint32_t >(n < max_size ? n : max_size))
+    {
+        if (size_ > capacity)
+            heap_ = new char[size_];
+        std::memcpy(data(), p, size_);
+    }
+
+    log_string(log_string&& other) noexcept
+    : size_(other.size_)
+    {
+        if (size_ > capacity)
+        {
+            heap_ = other.heap_;
+            other.size_ = 0;
+        }
+        else
+            std::memcpy(inline_, other.inline_, size_);
+    }
+
+    log_string& operator=(log_string&&) = delete;
+
+    ~log_string()
+    {
+        if (size_ > capacity)
+            delete[] heap_;
+    }
+
+    friend std::ostream&
+    operator<<(std::ostream& os, log_string const& s)
+    {
+        return os.write(s.data(), s.size_);
+    }
+
+private:
+    char*
+    data() { return size_ > capacity ? heap_ : inline_; }
+
+    const char*
+    data() const { return size_ > capacity ? heap_ : inline_; }
+
+    union
+    {
+        char inline_[capacity];
+        char* heap_;
+    };
+    std::uint32_t size_;
+};
+
+/// A character array copied into a record, up to its first NUL, in storage no larger than the
+/// array, so that literals cost little more than a pointer. Larger arrays are captured as a
+/// log_string.
+template < std::size_t N >
+struct log_chars
+{
+    explicit log_chars(const char (&s)[N])
+    {
+        auto const end = static_cast< const char* >(std::memchr(s, '\0', N));
+        size_ = static_cast< std::uint8_t >(end ? end - s : N);
+        std::memcpy(data_, s, size_);
+    }
+
+    friend std::ostream&
+    operator<<(std::ostream& os, log_chars const& s)
+    {
+        return os.write(s.data_, s.size_);
+    }
+
+private:
+    char data_[N];
+    std::uint8_t size_;
+};
+
+/// A socket's remote endpoint, captured at the time of logging.
+struct log_endpoint
+{
+    explicit log_endpoint(asio::ip::tcp::socket const& sock)
+    {
+        auto ec = error_code();
+        ep_        = sock.remote_endpoint(ec);
+        connected_ = !ec;
+    }
+
+    friend std::ostream&
+    operator<<(std::ostream& os, log_endpoint const& e)
+    {
+        if (e.connected_)
+            return os << e.ep_;
+        return os << "unconnected";
+    }
+
+private:
+    asio::ip::tcp::endpoint ep_;
+    bool connected_;
+};
+
+template < class... Captured >
+struct log_object_id
+{
+    log_string name;
+    std::tuple< Captured... > params;
+
+    friend std::ostream&
+    operator<<(std::ostream& os, log_object_id const& oid)
+    {
+        os << oid.name;
+        if constexpr (sizeof...(Captured) > 0)
+        {
+            const char* sep = "[";
+            std::apply([&](auto const&... x) { ((os << sep << x, sep = ", "), ...); }, oid.params);
+            os << ']';
+        }
+        return os << " : ";
+    }
+};
+
+template < class T >
+concept string_like = requires(T const& t)
+{
+    { t.data() } -> std::convertible_to< const char* >;
+    { t.size() } -> std::convertible_to< std::size_t >;
+};
+
+template < class T >
+struct is_object_id : std::false_type
+{
+};
+
+template < class... Params >
+struct is_object_id< object_id< Params... > > : std::true_type
+{
+};
+
+/// Convert a log argument to the value stored in the record
+template < class T >
+auto
+capture(T const& x)
+{
+    if constexpr (std::is_array_v< T > && std::extent_v< T > <= log_string::capacity)
+        return log_chars< std::extent_v< T > >(x);
+    else if constexpr (std::is_array_v< T >)
+        return log_string(x, static_cast< std::size_t >(
+            std::find(x, x + std::extent_v< T >, '\0') - x));
+    else if constexpr (std::is_convertible_v< T const&, const char* >)
+        return log_string(x, std::strlen(x));
+    else if constexpr (std::is_same_v< T, asio::ip::tcp::socket >)
+        return log_endpoint(x);
+    else if constexpr (string_like< T >)
+        return log_string(x.data(), x.size());
+    else if constexpr (is_object_id< T >::value)
+        return std::apply(
+            [&](auto&... params) {
+                return log_object_id< decltype(capture(params))... > {
+                    log_string(x.name.data(), x.name.size()), { capture(params)... }
+                };
+            },
+            x.params);
+    else
+        return x;
+}
+
+template < class T >
+using capture_t = decltype(capture(std::declval< std::remove_cvref_t< T > const& >()));
+
+template < class Tuple >
+void
+format_record(std::ostream& os, void* storage)
+{
+    auto& args = *std::launder(reinterpret_cast< Tuple* >(storage));
+    std::apply([&os](auto const&... a) { (os << ... << a); }, args);
+    args.~Tuple();
+}
+
+}
+
+/// An asynchronous logger.
+/// Each producing thread writes records into its own lock-free ring buffer. A background
+/// thread formats the records and writes them to stdout (stderr for warnings and errors).
+/// Until start() is called, or after stop(), records are formatted and written synchronously.
+struct logger
+{
+    static logger&
+    instance();
+
+    /// Start the background thread.
+    void
+    start(logger_options const& options = {});
+
+    /// Write out every buffered record and stop the background thread.
+    void
+    stop();
+
+    bool
+    enabled(log_level level) const
+    {
+        return level >= level_.load(std::memory_order_relaxed);
+    }
+
+    void
+    set_level(log_level level)
+    {
+        level_.store(level, std::memory_order_relaxed);
+    }
+
+    /// Number of records discarded because a ring was full
+    std::uint64_t
+    dropped() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+    /// Log a record made of the arguments streamed in order.
+    /// Arguments are captured by value: strings and character arrays are copied (to the heap
+    /// beyond 56 characters, and truncated at 4096), sockets are captured as their remote
+    /// endpoint and object_ids are captured with their parameters.
+    template < class... Args >
+    void
+    write(log_level level, Args const&... args);
+
+private:
+    static constexpr std::size_t max_threads = 256;
+
+    logger() = default;
+
+    detail::log_record*
+    reserve();
+
+    void
+    commit();
+
+    void
+    write_now(log_level level, std::chrono::system_clock::time_point time, detail::log_record::format_fn format, void* storage);
+
+    void
+    run();
+
+    std::atomic< log_level > level_ { log_level::info };
+    std::atomic< bool > running_ { false };
+    log_overflow overflow_ = log_overflow::drop;
+    std::size_t ring_capacity_ = 1024;
+
+    std::array< std::atomic< detail::log_ring* >, max_threads > rings_ {};
+    std::atomic< std::size_t > ring_count_ { 0 };
+    std::atomic< std::uint64_t > dropped_ { 0 };
+    std::thread thread_;
+};
+
+template < class... Args >
+void
+logger::write(log_level level, Args const&... args)
+{
+    if (!enabled(level))
+        return;
+
+    using tuple_type = std::tuple< detail::capture_t< Args >... >;
+    static_assert(sizeof(tuple_type) <= detail::log_record::storage_size, "log arguments too large for a record");
+    static_assert(alignof(tuple_type) <= alignof(std::max_align_t));
+
+    auto const time   = std::chrono::system_clock::now();
+    auto const format = &detail::format_record< tuple_type >;
+
+    if (!running_.load(std::memory_order_acquire))
+    {
+        alignas(std::max_align_t) unsigned char storage[sizeof(tuple_type)];
+        new (storage) tuple_type(detail::capture(args)...);
+        write_now(level, time, format, storage);
+        return;
+    }
+
+    if (auto rec = reserve())
+    {
+        rec->time   = time;
+        rec->format = format;
+        rec->level  = level;
+        new (rec->storage) tuple_type(detail::capture(args)...);
+        commit();
+    }
+}
+
+template < class... Args >
+void
+log_trace(Args const&... args)
+{
+    logger::instance().write(log_level::trace, args...);
+}
+
+template < class... Args >
+void
+log_debug(Args const&... args)
+{
+    logger::instance().write(log_level::debug, args...);
+}
+
+template < class... Args >
+void
+log_info(Args const&... args)
+{
+    logger::instance().write(log_level::info, args...);
+}
+
+template < class... Args >
+void
+log_warn(Args const&... args)
+{
+    logger::instance().write(log_level::warn, args...);
+}
+
+template < class... Args >
+void
+log_error(Args const&... args)
+{
+    logger::instance().write(log_level::error, args...);
+}
+
+#endif
@@ -0,0 +1,201 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+    struct registry
+    {
+        std::mutex mutex;
+        std::vector< std::unique_ptr< thread_metrics > > threads;
+        std::vector< std::string > routes;
+    };
+
+    registry&
+    the_registry()
+    {
+        static registry r;
+        return r;
+    }
+
+    /// Render a summary of nanosecond latencies, in seconds.
+    void
+    render_summary(std::ostream& os, 
+        std::string_view name, 
+        std::string_view labels, 
+        latency_histogram const& h, 
+        std::uint64_t count, 
+        std::uint64_t sum,
+        double scale)
+    {
+        static constexpr double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+        auto const sep = labels.empty() ? "" : ",";
+        for (auto q : quantiles)
+            os << name << "{" << labels << sep << "quantile=\"" << q << "\"} " 
+               << double(h.value_at_percentile(q * 100)) * scale << '\n';
+        os << name << "_sum";
+        if (!labels.empty())
+            os << '{' << labels << '}';
+        os << ' ' << double(sum) * scale << '\n';
+        os << name << "_count";
+        if (!labels.empty())
+            os << '{' << labels << '}';
+        os << ' ' << count << '\n';
+    }
+
+    void
+    render_header(std::ostream& os, std::string_view name, std::string_view type, std::string_view help)
+    {
+        os << "# HELP " << name << ' ' << help << '\n'
+           << "# TYPE " << name << ' ' << type << '\n';
+    }
+}
+
+void
+metric_histogram::merge_into(latency_histogram& out) const
+{
+    for (std::size_t i = 0; i < buckets_.size(); ++i)
+        out.record(latency_histogram::lowest_equivalent(i), buckets_[i].load(std::memory_order_relaxed));
+}
+
+thread_metrics&
+this_thread_metrics()
+{
+    thread_local thread_metrics* mine = []
+    {
+        auto& r = the_registry();
+        auto lock = std::lock_guard(r.mutex);
+        return r.threads.emplace_back(std::make_unique< thread_metrics >()).get();
+    }();
+    return *mine;
+}
+
+route_metric_id
+register_route_metric(std::string_view route)
+{
+    auto& r = the_registry();
+    auto lock = std::lock_guard(r.mutex);
+
+    auto it = std::find(r.routes.begin(), r.routes.end(), route);
+    if (it != r.routes.end())
+        return static_cast< route_metric_id >(it - r.routes.begin());
+
+    if (r.routes.size() + 1 < thread_metrics::max_routes)
+    {
+        r.routes.emplace_back(route);
+        return r.routes.size() - 1;
+    }
+
+    r.routes.resize(thread_metrics::max_routes);
+    r.routes.back() = "other";
+    return thread_metrics::max_routes - 1;
+}
+
+std::uint64_t
+metric_total(metric_counter thread_metrics::* counter)
+{
+    auto& r = the_registry();
+    auto lock = std::lock_guard(r.mutex);
+
+    std::uint64_t total = 0;
+    for (auto& t : r.threads)
+        total += ((*t).*counter).value();
+    return total;
+}
+
+std::string
+render_metrics()
+{
+    auto& r = the_registry();
+    auto lock = std::lock_guard(r.mutex);
+
+    auto sum_counter = [&](auto member) {
+        std::uint64_t total = 0;
+        for (auto& t : r.threads)
+            total += ((*t).*member).value();
+        return total;
+    };
+
+    auto sum_gauge = [&](auto member) {
+        std::int64_t total = 0;
+        for (auto& t : r.threads)
+            total += ((*t).*member).value();
+        return total;
+    };
+
+    struct merged
+    {
+        latency_histogram h;
+        std::uint64_t count = 0;
+        std::uint64_t sum = 0;
+    };
+
+    auto merge = [&](auto select) {
+        auto m = merged();
+        for (auto& t : r.threads)
+        {
+            metric_histogram const& src = select(*t);
+            src.merge_into(m.h);
+            m.count += src.count();
+            m.sum += src.sum();
+        }
+        return m;
+    };
+
+    auto os = std::ostringstream();
+    constexpr double ns = 1e-9;
+
+    render_header(os, "webserver_connections_accepted_total", "counter", "Connections accepted.");
+    os << "webserver_connections_accepted_total " << sum_counter(&thread_metrics::connections_accepted) << '\n';
+
+    render_header(os, "webserver_connections_total", "counter", "Connections by the transport detected on them.");
+    os << "webserver_connections_total{transport=\"tls\"} " << sum_counter(&thread_metrics::connections_tls) << '\n'
+       << "webserver_connections_total{transport=\"plain\"} " << sum_counter(&thread_metrics::connections_plain) << '\n';
+
+    render_header(os, "webserver_http_requests_total", "counter", "HTTP requests whose header was read.");
+    os << "webserver_http_requests_total " << sum_counter(&thread_metrics::http_requests) << '\n';
+
+    render_header(os, "webserver_tls_handshake_seconds", "summary", "Time to complete a TLS handshake.");
+    {
+        auto m = merge([](thread_metrics const& t) -> auto& { return t.tls_handshake; });
+        render_summary(os, "webserver_tls_handshake_seconds", "", m.h, m.count, m.sum, ns);
+    }
+
+    render_header(os, "webserver_http_header_read_seconds", "summary", 
+        "Time from starting to read a request until its header is complete, including client idle time.");
+    {
+        auto m = merge([](thread_metrics const& t) -> auto& { return t.http_header_read; });
+        render_summary(os, "webserver_http_header_read_seconds", "", m.h, m.count, m.sum, ns);
+    }
+
+    render_header(os, "webserver_http_handler_seconds", "summary", "Time taken by an http route's handler.");
+    for (std::size_t i = 0; i < r.routes.size(); ++i)
+    {
+        auto m = merge([i](thread_metrics const& t) -> auto& { return t.http_handler[i]; });
+        auto labels = "route=\"" + r.routes[i] + '"';
+        render_summary(os, "webserver_http_handler_seconds", labels, m.h, m.count, m.sum, ns);
+    }
+
+    render_header(os, "webserver_websocket_frames_total", "counter", "Websocket messages.");
+    os << "webserver_websocket_frames_total{direction=\"in\"} " << sum_counter(&thread_metrics::websocket_frames_in) << '\n'
+       << "webserver_websocket_frames_total{direction=\"out\"} " << sum_counter(&thread_metrics::websocket_frames_out) << '\n';
+
+    render_header(os, "webserver_websocket_bytes_total", "counter", "Websocket message payload bytes.");
+    os << "webserver_websocket_bytes_total{direction=\"in\"} " << sum_counter(&thread_metrics::websocket_bytes_in) << '\n'
+       << "webserver_websocket_bytes_total{direction=\"out\"} " << sum_counter(&thread_metrics::websocket_bytes_out) << '\n';
+
+    render_header(os, "webserver_websocket_queued_frames", "gauge", "Frames waiting in websocket write queues.");
+    os << "webserver_websocket_queued_frames " << sum_gauge(&thread_metrics::websocket_queued_frames) << '\n';
+
+    render_header(os, "webserver_websocket_write_batch", "summary", "Frames in a websocket write queue when it is flushed.");
+    {
+        auto m = merge([](thread_metrics const& t) -> auto& { return t.websocket_write_batch; });
+        render_summary(os, "webserver_websocket_write_batch", "", m.h, m.count, m.sum, 1.0);
+    }
+
+    return os.str();
+}
@@ -0,0 +1,149 @@
+#ifndef WEBSERVER_METRICS_HPP
+#define WEBSERVER_METRICS_HPP
+
+#include "latency_histogram.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/// A count written by one thread and read by any.
+/// An increment is a relaxed load and store, with no locked instruction, because only the
+/// owning thread writes.
+struct metric_counter
+{
+    void
+    add(std::uint64_t n = 1)
+    {
+        value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::uint64_t
+    value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic< std::uint64_t > value_ { 0 };
+};
+
+/// A level which goes up and down, written by one thread and read by any.
+struct metric_gauge
+{
+    void
+    add(std::int64_t n)
+    {
+        value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::int64_t
+    value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic< std::int64_t > value_ { 0 };
+};
+
+/// A latency_histogram written by one thread and read by any.
+/// Recording touches one bucket, the count and the sum, each with a relaxed load and store.
+/// A reader may see a recording partly done, which is harmless for reporting.
+struct metric_histogram
+{
+    using clock_type = std::chrono::steady_clock;
+
+    void
+    record(std::uint64_t value)
+    {
+        auto bump = [](std::atomic< std::uint64_t >& a, std::uint64_t n) {
+            a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        };
+        bump(buckets_[latency_histogram::bucket_index(value)], 1);
+        bump(count_, 1);
+        bump(sum_, value);
+    }
+
+    /// Record the nanoseconds since a start time.
+    void
+    record_since(clock_type::time_point start)
+    {
+        record(static_cast< std::uint64_t >(
+            std::chrono::duration_cast< std::chrono::nanoseconds >(clock_type::now() - start).count()));
+    }
+
+    /// Add the recorded values to a histogram. Each is counted at the low end of its bucket.
+    void
+    merge_into(latency_histogram& out) const;
+
+    std::uint64_t
+    count() const { return count_.load(std::memory_order_relaxed); }
+
+    std::uint64_t
+    sum() const { return sum_.load(std::memory_order_relaxed); }
+
+private:
+    std::array< std::atomic< std::uint64_t >, latency_histogram::bucket_count > buckets_ {};
+    std::atomic< std::uint64_t > count_ { 0 };
+    std::atomic< std::uint64_t > sum_ { 0 };
+};
+
+/// Identifies an http route's handler latency histogram. See register_route_metric().
+using route_metric_id = std::size_t;
+
+/// The metrics of one io thread. Only that thread records into them. They are summed over
+/// every thread, including threads which have exited, when the metrics are rendered.
+struct thread_metrics
+{
+    /// Most routes whose handler latency is recorded separately
+    static constexpr std::size_t max_routes = 16;
+
+    metric_counter connections_accepted;
+    metric_counter connections_tls;
+    metric_counter connections_plain;
+
+    /// requests whose header has been read
+    metric_counter http_requests;
+
+    /// nanoseconds
+    metric_histogram tls_handshake;
+
+    /// nanoseconds from starting to read a request until its header is complete. On a
+    /// persistent connection, this includes the time the client spent idle.
+    metric_histogram http_header_read;
+
+    /// nanoseconds taken by each route's handler, by route_metric_id
+    std::array< metric_histogram, max_routes > http_handler;
+
+    metric_counter websocket_frames_in;
+    metric_counter websocket_bytes_in;
+    metric_counter websocket_frames_out;
+    metric_counter websocket_bytes_out;
+
+    /// frames waiting in websocket write queues
+    metric_gauge websocket_queued_frames;
+
+    /// frames in a websocket write queue each time it is flushed
+    metric_histogram websocket_write_batch;
+};
+
+/// The calling thread's metrics. Created and registered on first use.
+thread_metrics&
+this_thread_metrics();
+
+/// Name a route whose handler latency is recorded, such as "/file/{path:path}".
+/// Call while building the routes, before io threads start recording.
+/// @return the route's index into thread_metrics::http_handler. Routes beyond max_routes
+/// share the last index, which is labelled "other".
+route_metric_id
+register_route_metric(std::string_view route);
+
+/// Sum a counter over every thread, including threads which have exited.
+/// @param counter selects the counter, such as &thread_metrics::http_requests.
+std::uint64_t
+metric_total(metric_counter thread_metrics::* counter);
+
+/// Render every thread's metrics, summed, in the Prometheus text exposition format.
+/// Safe to call from any thread while the io threads are recording.
+std::string
+render_metrics();
+
+#endif
@@ -0,0 +1,58 @@
+#include "mime_type.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <utility>
+
+namespace
+{
+    bool
+    iequals(std::string_view a, std::string_view b)
+    {
+        return a.size() == b.size() &&
+            std::equal(a.begin(), a.end(), b.begin(), [](char x, char y)
+            {
+                return std::tolower(static_cast< unsigned char >(x)) == std::tolower(static_cast< unsigned char >(y));
+            });
+    }
+}
+
+std::string_view
+mime_type(std::string_view path)
+{
+    static const std::pair< std::string_view, std::string_view > types[] = {
+        { ".htm",  "text/html" },
+        { ".html", "text/html" },
+        { ".php",  "text/html" },
+        { ".css",  "text/css" },
+        { ".txt",  "text/plain" },
+        { ".js",   "application/javascript" },
+        { ".json", "application/json" },
+        { ".xml",  "application/xml" },
+        { ".swf",  "application/x-shockwave-flash" },
+        { ".flv",  "video/x-flv" },
+        { ".png",  "image/png" },
+        { ".jpe",  "image/jpeg" },
+        { ".jpeg", "image/jpeg" },
+        { ".jpg",  "image/jpeg" },
+        { ".gif",  "image/gif" },
+        { ".bmp",  "image/bmp" },
+        { ".ico",  "image/vnd.microsoft.icon" },
+        { ".tiff", "image/tiff" },
+        { ".tif",  "image/tiff" },
+        { ".svg",  "image/svg+xml" },
+        { ".svgz", "image/svg+xml" },
+        { ".wasm", "application/wasm" },
+    };
+
+    auto const pos = path.rfind('.');
+    if (pos == std::string_view::npos)
+        return "application/octet-stream";
+
+    auto const ext = path.substr(pos);
+    for (auto&& [e, type] : types)
+        if (iequals(e, ext))
+            return type;
+
+    return "application/octet-stream";
+}
@@ -0,0 +1,12 @@
+#ifndef WEBSERVER_MIME_TYPE_HPP
+#define WEBSERVER_MIME_TYPE_HPP
+
+#include <string_view>
+
+/// Return a reasonable mime type based on the extension of a file.
+/// @param path is the path of the file
+/// @return the mime type, or application/octet-stream if the extension is not recognised
+std::string_view
+mime_type(std::string_view path);
+
+#endif
@@ -0,0 +1,596 @@
+#include "native_websock.hpp"
+#include "corked_stream.hpp"
+#include "ktls_stream.hpp"
+#include "response_template.hpp"
+
+#include <boost/beast/websocket/detail/frame.hpp>
+#include <boost/beast/websocket/detail/hybi13.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define WEBSERVER_UNMASK_X86 1
+#include <immintrin.h>
+#endif
+
+namespace ws_codec
+{
+    bool
+    parse_header(std::uint8_t const* p, std::size_t n, frame_header& h, error_code& ec)
+    {
+        using beast::websocket::error;
+
+        if (n < 2)
+            return false;
+
+        if (p[0] & 0x70)
+        {
+            // no extension is negotiated, so no reserved bit may be set
+            ec = error::bad_reserved_bits;
+            return false;
+        }
+
+        h.fin = (p[0] & 0x80) != 0;
+        h.op = static_cast< opcode >(p[0] & 0x0F);
+        switch (h.op)
+        {
+        case opcode::continuation:
+        case opcode::text:
+        case opcode::binary:
+        case opcode::close:
+        case opcode::ping:
+        case opcode::pong:
+            break;
+        default:
+            ec = error::bad_opcode;
+            return false;
+        }
+
+        h.masked = (p[1] & 0x80) != 0;
+        h.payload_size = p[1] & 0x7F;
+        h.size = 2;
+        if (h.payload_size == 126)
+            h.size += 2;
+        else if (h.payload_size == 127)
+            h.size += 8;
+        if (h.masked)
+            h.size += 4;
+        if (n < h.size)
+            return false;
+
+        auto q = p + 2;
+        if (h.payload_size == 126)
+        {
+            h.payload_size = (std::uint64_t(q[0]) << 8) | q[1];
+            q += 2;
+            if (h.payload_size < 126)
+            {
+                ec = error::bad_size;
+                return false;
+            }
+        }
+        else if (h.payload_size == 127)
+        {
+            h.payload_size = 0;
+            for (int i = 0; i < 8; ++i)
+                h.payload_size = (h.payload_size << 8) | q[i];
+            q += 8;
+            if (h.payload_size <= 0xFFFF || (h.payload_size >> 63))
+            {
+                ec = error::bad_size;
+                return false;
+            }
+        }
+
+        if (h.masked)
+            std::memcpy(h.key.data(), q, 4);
+        return true;
+    }
+
+    std::size_t
+    encode_header(std::uint8_t* out, opcode op, std::uint64_t payload_size)
+    {
+        out[0] = 0x80 | static_cast< std::uint8_t >(op);
+        if (payload_size < 126)
+        {
+            out[1] = static_cast< std::uint8_t >(payload_size);
+            return 2;
+        }
+        if (payload_size <= 0xFFFF)
+        {
+            out[1] = 126;
+            out[2] = static_cast< std::uint8_t >(payload_size >> 8);
+            out[3] = static_cast< std::uint8_t >(payload_size);
+            return 4;
+        }
+        out[1] = 127;
+        for (int i = 0; i < 8; ++i)
+            out[2 + i] = static_cast< std::uint8_t >(payload_size >> (56 - 8 * i));
+        return 10;
+    }
+
+    namespace
+    {
+        /// Mask 8 bytes at a time, then the rest byte by byte.
+        /// @return the number of bytes done, a multiple of 8.
+        std::size_t
+        unmask_words(std::uint8_t* p, std::size_t n, std::array< std::uint8_t, 4 > const& key)
+        {
+            std::uint8_t key8[8];
+            std::memcpy(key8, key.data(), 4);
+            std::memcpy(key8 + 4, key.data(), 4);
+            std::uint64_t k;
+            std::memcpy(&k, key8, 8);
+
+            std::size_t i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                std::uint64_t w;
+                std::memcpy(&w, p + i, 8);
+                w ^= k;
+                std::memcpy(p + i, &w, 8);
+            }
+            return i;
+        }
+
+#ifdef WEBSERVER_UNMASK_X86
+        __attribute__((target("sse2"))) std::size_t
+        unmask_sse2(std::uint8_t* p, std::size_t n, std::array< std::uint8_t, 4 > const& key)
+        {
+            std::uint32_t k;
+            std::memcpy(&k, key.data(), 4);
+            auto const mask = _mm_set1_epi32(static_cast< int >(k));
+
+            std::size_t i = 0;
+            for (; i + 16 <= n; i += 16)
+            {
+                auto const v = _mm_loadu_si128(reinterpret_cast< __m128i const* >(p + i));
+                _mm_storeu_si128(reinterpret_cast< __m128i* >(p + i), _mm_xor_si128(v, mask));
+            }
+            return i;
+        }
+
+        __attribute__((target("avx2"))) std::size_t
+        unmask_avx2(std::uint8_t* p, std::size_t n, std::array< std::uint8_t, 4 > const& key)
+        {
+            std::uint32_t k;
+            std::memcpy(&k, key.data(), 4);
+            auto const mask = _mm256_set1_epi32(static_cast< int >(k));
+
+            std::size_t i = 0;
+            for (; i + 64 <= n; i += 64)
+            {
+                auto const a = _mm256_loadu_si256(reinterpret_cast< __m256i const* >(p + i));
+                auto const b = _mm256_loadu_si256(reinterpret_cast< __m256i const* >(p + i + 32));
+                _mm256_storeu_si256(reinterpret_cast< __m256i* >(p + i), _mm256_xor_si256(a, mask));
+                _mm256_storeu_si256(reinterpret_cast< __m256i* >(p + i + 32), _mm256_xor_si256(b, mask));
+            }
+            for (; i + 32 <= n; i += 32)
+            {
+                auto const v = _mm256_loadu_si256(reinterpret_cast< __m256i const* >(p + i));
+                _mm256_storeu_si256(reinterpret_cast< __m256i* >(p + i), _mm256_xor_si256(v, mask));
+            }
+            return i;
+        }
+#endif
+
+        using unmask_fn = std::size_t (*)(std::uint8_t*, std::size_t, std::array< std::uint8_t, 4 > const&);
+
+        unmask_fn
+        best_unmask()
+        {
+#ifdef WEBSERVER_UNMASK_X86
+            if (__builtin_cpu_supports("avx2"))
+                return unmask_avx2;
+            if (__builtin_cpu_supports("sse2"))
+                return unmask_sse2;
+#endif
+            return unmask_words;
+        }
+    }
+
+    void
+    unmask(std::uint8_t* p, std::size_t n, std::array< std::uint8_t, 4 > const& key)
+    {
+        static const auto vectorised = best_unmask();
+
+        // each pass stops at a multiple of 8 bytes, so the key stays in phase
+        auto i = n >= 32 ? vectorised(p, n, key) : 0;
+        i += unmask_words(p + i, n - i, key);
+        for (; i < n; ++i)
+            p[i] ^= key[i % 4];
+    }
+}
+
+template < class NextLayer >
+asio::awaitable< void >
+native_websock< NextLayer >::accept(request_type const& request)
+{
+    namespace http = beast::http;
+    using beast::websocket::error;
+
+    auto ec = error_code();
+    auto const key = request[http::field::sec_websocket_key];
+    if (!beast::websocket::is_upgrade(request))
+        ec = error::no_upgrade_websocket;
+    else if (key.empty())
+        ec = error::no_sec_key;
+    else if (key.size() > beast::websocket::detail::sec_ws_key_type().max_size())
+        ec = error::bad_sec_key;
+    else if (request[http::field::sec_websocket_version] != "13")
+        ec = error::bad_sec_version;
+
+    if (ec)
+    {
+        auto const out = response_buffers(common_response(http::status::bad_request), request,
+            "not a websocket upgrade\n");
+        auto [wec, n] = co_await asio::async_write(next_, out.data(), asioex::as_tuple(asio::use_awaitable));
+        throw system_error(ec);
+    }
+
+    auto accept_key = beast::websocket::detail::sec_ws_accept_type();
+    beast::websocket::detail::make_sec_ws_accept(accept_key, key);
+
+    auto response = std::string("HTTP/1.1 101 Switching Protocols\r\n"
+                                "Upgrade: websocket\r\n"
+                                "Connection: Upgrade\r\n"
+                                "Sec-WebSocket-Accept: ");
+    response.append(accept_key.data(), accept_key.size());
+    response += "\r\n\r\n";
+
+    auto const buffer = asio::const_buffer(response.data(), response.size());
+    co_await send(std::span(&buffer, 1));
+}
+
+template < class NextLayer >
+asio::awaitable< void >
+native_websock< NextLayer >::read_until(std::size_t size)
+{
+    while (rxbuf_.size() < size)
+    {
+        // a frame's declared size is not memory to commit before its bytes arrive, so read
+        // at most as much again as is buffered, and let the buffer grow geometrically
+        auto const wanted = std::clamp(size - rxbuf_.size(), read_size, std::max(read_size, rxbuf_.size()));
+        auto space = rxbuf_.prepare(wanted);
+        auto n = co_await next_.async_read_some(space, asio::use_awaitable);
+        rxbuf_.commit(n);
+    }
+}
+
+template < class NextLayer >
+asio::awaitable< ws_codec::frame_header >
+native_websock< NextLayer >::read_header(std::size_t pos, bool in_message, std::uint64_t message_size)
+{
+    using ws_codec::opcode;
+    using beast::websocket::error;
+    using beast::websocket::close_code;
+
+    auto h = ws_codec::frame_header();
+    auto ec = error_code();
+    while (!ws_codec::parse_header(data() + pos, rxbuf_.size() - pos, h, ec) && !ec)
+        co_await read_until(rxbuf_.size() + 1);
+
+    auto const control = ws_codec::is_control(h.op);
+    auto code = close_code::protocol_error;
+    if (ec)
+        ;
+    else if (!h.masked)
+        ec = error::bad_unmasked_frame;
+    else if (control && !h.fin)
+        ec = error::bad_control_fragment;
+    else if (control && h.payload_size > 125)
+        ec = error::bad_control_size;
+    else if (!control && h.op == opcode::continuation && !in_message)
+        ec = error::bad_continuation;
+    else if (!control && h.op != opcode::continuation && in_message)
+        ec = error::bad_data_frame;
+    else if (!control && (message_size > read_message_max_ || h.payload_size > read_message_max_ - message_size))
+    {
+        ec = error::message_too_big;
+        code = close_code::too_big;
+    }
+
+    if (ec)
+    {
+        co_await send_close(code);
+        throw system_error(ec);
+    }
+    co_return h;
+}
+
+template < class NextLayer >
+asio::awaitable< native_message >
+native_websock< NextLayer >::read()
+{
+    using ws_codec::opcode;
+    using beast::websocket::error;
+    using beast::websocket::close_code;
+
+    rxbuf_.consume(consumed_);
+    consumed_ = 0;
+    utf8_.reset();
+
+    std::size_t pos = 0;             // start of the next frame
+    std::size_t message_begin = 0;   // payload of the message, assembled in place
+    std::size_t message_size = 0;
+    auto in_message = false;
+    auto binary = false;
+
+    for (;;)
+    {
+        auto const h = co_await read_header(pos, in_message, message_size);
+        auto const payload_begin = pos + h.size;
+        auto const frame_end = payload_begin + h.payload_size;
+        co_await read_until(frame_end);
+        ws_codec::unmask(data() + payload_begin, h.payload_size, h.key);
+        pos = frame_end;
+
+        if (ws_codec::is_control(h.op))
+        {
+            co_await on_control(h.op, data() + payload_begin, h.payload_size);
+            continue;
+        }
+
+        if (!in_message)
+        {
+            in_message = true;
+            binary = h.op == opcode::binary;
+            message_begin = payload_begin;
+        }
+        else if (payload_begin != message_begin + message_size)
+        {
+            // a later fragment: close the gap left by the headers in between
+            std::memmove(data() + message_begin + message_size, data() + payload_begin, h.payload_size);
+        }
+
+        auto ec = error_code();
+        if (!binary && !utf8_.write(data() + message_begin + message_size, h.payload_size))
+            ec = error::bad_frame_payload;
+        message_size += h.payload_size;
+        if (!binary && h.fin && !utf8_.finish())
+            ec = error::bad_frame_payload;
+        if (ec)
+        {
+            co_await send_close(close_code::bad_payload);
+            throw system_error(ec);
+        }
+
+        if (h.fin)
+        {
+            consumed_ = pos;
+            co_return native_message { asio::const_buffer(data() + message_begin, message_size), binary };
+        }
+    }
+}
+
+template < class NextLayer >
+asio::awaitable< native_message >
+native_websock< NextLayer >::read_some(std::size_t limit)
+{
+    using ws_codec::opcode;
+    using beast::websocket::error;
+    using beast::websocket::close_code;
+
+    rxbuf_.consume(consumed_);
+    consumed_ = 0;
+
+    std::size_t pos = 0;    // start of the unread part of the current frame
+    for (;;)
+    {
+        if (partial_.remaining == 0)
+        {
+            auto const h = co_await read_header(pos, partial_.in_message, partial_.size);
+            if (ws_codec::is_control(h.op))
+            {
+                auto const payload_begin = pos + h.size;
+                co_await read_until(payload_begin + h.payload_size);
+                ws_codec::unmask(data() + payload_begin, h.payload_size, h.key);
+                pos = payload_begin + h.payload_size;
+                co_await on_control(h.op, data() + payload_begin, h.payload_size);
+                continue;
+            }
+
+            if (!partial_.in_message)
+            {
+                partial_.in_message = true;
+                partial_.binary = h.op == opcode::binary;
+                partial_.size = 0;
+                utf8_.reset();
+            }
+            partial_.fin = h.fin;
+            partial_.remaining = h.payload_size;
+            partial_.key = h.key;
+            pos += h.size;
+
+            // an empty fragment ends nothing, so there is nothing to return for it
+            if (h.payload_size == 0 && !h.fin)
+                continue;
+        }
+
+        // as much of the frame as has arrived, and at least one byte of it
+        if (partial_.remaining)
+            co_await read_until(pos + 1);
+        auto const n = static_cast< std::size_t >(
+            std::min< std::uint64_t >({ partial_.remaining, rxbuf_.size() - pos, limit }));
+        auto const p = data() + pos;
+        ws_codec::unmask(p, n, partial_.key);
+
+        // the next chunk of the frame starts n bytes further into the key
+        std::rotate(partial_.key.begin(), partial_.key.begin() + n % 4, partial_.key.end());
+        partial_.remaining -= n;
+        partial_.size += n;
+        auto const fin = partial_.fin && partial_.remaining == 0;
+
+        if (!partial_.binary && (!utf8_.write(p, n) || (fin && !utf8_.finish())))
+        {
+            co_await send_close(close_code::bad_payload);
+            throw system_error(error::bad_frame_payload);
+        }
+
+        if (fin)
+            partial_.in_message = false;
+        consumed_ = pos + n;
+        co_return native_message { asio::const_buffer(p, n), partial_.binary, fin };
+    }
+}
+
+template < class NextLayer >
+asio::awaitable< void >
+native_websock< NextLayer >::on_control(ws_codec::opcode op, std::uint8_t const* payload, std::size_t size)
+{
+    using ws_codec::opcode;
+    using beast::websocket::error;
+
+    if (op == opcode::ping)
+    {
+        if (close_sent_)
+            co_return;
+
+        auto header = std::array< std::uint8_t, ws_codec::max_server_header_size >();
+        auto const header_size = ws_codec::encode_header(header.data(), opcode::pong, size);
+        std::array< asio::const_buffer, 2 > const buffers = {
+            asio::const_buffer(header.data(), header_size),
+            asio::const_buffer(payload, size)
+        };
+        co_await send(buffers);
+    }
+    else if (op == opcode::close)
+    {
+        auto reason = beast::websocket::close_reason(beast::websocket::close_code::normal);
+        if (size == 1)
+        {
+            co_await send_close(beast::websocket::close_code::protocol_error);
+            throw system_error(error::bad_close_size);
+        }
+        if (size >= 2)
+        {
+            reason.code = static_cast< std::uint16_t >((payload[0] << 8) | payload[1]);
+
+            // as beast: reserved codes, and codes only for local use, must not be sent
+            if (!beast::websocket::detail::is_valid_close_code(reason.code))
+            {
+                co_await send_close(beast::websocket::close_code::protocol_error);
+                throw system_error(error::bad_close_code);
+            }
+            if (!is_valid_utf8(payload + 2, size - 2))
+            {
+                co_await send_close(beast::websocket::close_code::bad_payload);
+                throw system_error(error::bad_close_payload);
+            }
+        }
+
+        // the reason is not needed in the reply
+        co_await send_close(reason.code);
+
+        // the teardown functions take a handler, not a completion token
+        auto token = asioex::as_tuple(asio::use_awaitable);
+        auto [ec] = co_await asio::async_initiate< decltype(token), void(error_code) >(
+            [this](auto handler) { async_teardown(beast::role_type::server, next_, std::move(handler)); },
+            token);
+        throw system_error(error::closed);
+    }
+}
+
+template < class NextLayer >
+asio::awaitable< std::size_t >
+native_websock< NextLayer >::send(std::span< asio::const_buffer const > buffers)
+{
+    while (writing_)
+        co_await write_idle_.wait();
+
+    writing_ = true;
+    auto [ec, n] = co_await asio::async_write(next_, buffers, asioex::as_tuple(asio::use_awaitable));
+    writing_ = false;
+    write_idle_.notify_all();
+
+    if (ec)
+        throw system_error(ec);
+    co_return n;
+}
+
+template < class NextLayer >
+asio::awaitable< std::size_t >
+native_websock< NextLayer >::write(asio::const_buffer payload, bool binary)
+{
+    auto header = std::array< std::uint8_t, ws_codec::max_server_header_size >();
+    auto const header_size = ws_codec::encode_header(header.data(),
+        binary ? ws_codec::opcode::binary : ws_codec::opcode::text, payload.size());
+    std::array< asio::const_buffer, 2 > const buffers = {
+        asio::const_buffer(header.data(), header_size),
+        payload
+    };
+    co_await send(buffers);
+    co_return payload.size();
+}
+
+template < class NextLayer >
+asio::awaitable< std::size_t >
+native_websock< NextLayer >::write_batch(std::span< native_outbound const > messages)
+{
+    // size the header storage first, so that the buffers can point into it
+    headers_.resize(messages.size());
+    buffers_.clear();
+
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < messages.size(); ++i)
+    {
+        auto const& m = messages[i];
+        auto const header_size = ws_codec::encode_header(headers_[i].data(),
+            m.binary ? ws_codec::opcode::binary : ws_codec::opcode::text, m.payload.size());
+        buffers_.push_back(asio::const_buffer(headers_[i].data(), header_size));
+        buffers_.push_back(m.payload);
+        total += m.payload.size();
+    }
+
+    co_await send(buffers_);
+    co_return total;
+}
+
+template < class NextLayer >
+asio::awaitable< void >
+native_websock< NextLayer >::send_close(beast::websocket::close_reason const& reason)
+{
+    if (close_sent_)
+        co_return;
+    close_sent_ = true;
+
+    auto payload = std::array< std::uint8_t, 125 >();
+    std::size_t size = 0;
+    if (reason.code != beast::websocket::close_code::none)
+    {
+        payload[0] = static_cast< std::uint8_t >(reason.code >> 8);
+        payload[1] = static_cast< std::uint8_t >(reason.code);
+        auto const text = std::min< std::size_t >(reason.reason.size(), payload.size() - 2);
+        std::memcpy(payload.data() + 2, reason.reason.data(), text);
+        size = 2 + text;
+    }
+
+    auto header = std::array< std::uint8_t, ws_codec::max_server_header_size >();
+    auto const header_size = ws_codec::encode_header(header.data(), ws_codec::opcode::close, size);
+    std::array< asio::const_buffer, 2 > const buffers = {
+        asio::const_buffer(header.data(), header_size),
+        asio::const_buffer(payload.data(), size)
+    };
+
+    // a failure here shows up on the next read
+    try
+    {
+        co_await send(buffers);
+    }
+    catch (system_error&)
+    {
+    }
+}
+
+template < class NextLayer >
+asio::awaitable< void >
+native_websock< NextLayer >::close(beast::websocket::close_reason const& reason)
+{
+    co_await send_close(reason);
+}
+
+template struct native_websock< corked_stream< asio::ip::tcp::socket > >;
+template struct native_websock< corked_stream< asio::ssl::stream< asio::ip::tcp::socket > > >;
+template struct native_websock< corked_stream< ktls_stream > >;
@@ -0,0 +1,269 @@
+#ifndef WEBSERVER_NATIVE_WEBSOCK_HPP
+#define WEBSERVER_NATIVE_WEBSOCK_HPP
+
+#include "asio.hpp"
+#include "beast.hpp"
+#include "condvar.hpp"
+#include "utf8_validator.hpp"
+
+#include <boost/beast/http.hpp>
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+/// Frame encoding and decoding for native_websock, as RFC 6455 section 5.
+namespace ws_codec
+{
+    enum class opcode : std::uint8_t
+    {
+        continuation = 0x0,
+        text = 0x1,
+        binary = 0x2,
+        close = 0x8,
+        ping = 0x9,
+        pong = 0xA
+    };
+
+    /// @return true if op is ping, pong or close
+    constexpr bool
+    is_control(opcode op)
+    {
+        return (static_cast< std::uint8_t >(op) & 0x08) != 0;
+    }
+
+    /// Longest header a client can send: 2 bytes, 8 of extended length and 4 of mask key
+    constexpr std::size_t max_header_size = 14;
+
+    /// Longest header a server sends, which is never masked
+    constexpr std::size_t max_server_header_size = 10;
+
+    struct frame_header
+    {
+        bool fin = false;
+        opcode op = opcode::continuation;
+        bool masked = false;
+        std::uint64_t payload_size = 0;
+        std::array< std::uint8_t, 4 > key = {};
+
+        /// size of the header itself
+        std::size_t size = 0;
+    };
+
+    /// Parse the header of a frame from the start of a buffer.
+    /// @return true once the whole header is in the buffer and has been parsed, or false if
+    /// more bytes are needed or ec is set.
+    /// @param ec is set if the header is malformed, or uses reserved bits or opcodes.
+    bool
+    parse_header(std::uint8_t const* p, std::size_t n, frame_header& h, error_code& ec);
+
+    /// Write the header of an unmasked frame with the fin bit set.
+    /// @param out has room for max_server_header_size bytes.
+    /// @return the size of the header.
+    std::size_t
+    encode_header(std::uint8_t* out, opcode op, std::uint64_t payload_size);
+
+    /// Apply a masking key to a payload in place, starting at the first byte of the key.
+    /// 32 or 16 bytes are done at a time where the cpu allows, chosen at run time.
+    void
+    unmask(std::uint8_t* p, std::size_t n, std::array< std::uint8_t, 4 > const& key);
+}
+
+/// A received message, or part of one, viewed in place in the read buffer of the websocket.
+struct native_message
+{
+    asio::const_buffer data;
+    bool binary = false;
+
+    /// true if data ends the message
+    bool fin = true;
+};
+
+/// An outgoing message for native_websock::write_batch()
+struct native_outbound
+{
+    asio::const_buffer payload;
+    bool binary = false;
+};
+
+/// The server side of a websocket, framed without beast::websocket::stream.
+/// Frames are read into a single buffer, their headers parsed and their payloads unmasked in
+/// place. A message is handed out as a view into that buffer, so it is never copied unless it
+/// arrives in fragments, whose payloads are moved together behind the first. Outgoing headers
+/// are built next to the payloads they describe, and any number of messages go out in one
+/// gather write. Text is validated by utf8_validator as each frame arrives.
+/// permessage-deflate is not supported, so it is never negotiated.
+/// @note At most one read may be outstanding. Writes are serialised internally, so pings can be
+/// answered from within read() while a write is in progress.
+template < class NextLayer >
+struct native_websock
+{
+    using next_layer_type = NextLayer;
+    using executor_type   = typename NextLayer::executor_type;
+    using request_type    = beast::http::request< beast::http::string_body >;
+
+    /// Largest message accepted unless read_message_max() says otherwise, as beast's default
+    static constexpr std::size_t max_message_size = 16 * 1024 * 1024;
+
+    /// Least read from the transport at once
+    static constexpr std::size_t read_size = 16 * 1024;
+
+    /// Construct the websocket.
+    /// @param t is the transport, which next_layer_type is constructed from.
+    /// @param rxbuf is the buffer the upgrade request was read with. Its storage is reused,
+    /// and any bytes it holds are read as the first frames.
+    template < class Transport >
+    native_websock(Transport&& t, beast::flat_buffer&& rxbuf)
+    : next_(std::forward< Transport >(t))
+    , rxbuf_(std::move(rxbuf))
+    , write_idle_(next_.get_executor())
+    {
+    }
+
+    executor_type
+    get_executor() noexcept
+    {
+        return next_.get_executor();
+    }
+
+    next_layer_type&
+    next_layer() noexcept
+    {
+        return next_;
+    }
+
+    next_layer_type const&
+    next_layer() const noexcept
+    {
+        return next_;
+    }
+
+    /// Set the largest message accepted. A larger one is answered with close code 1009.
+    void
+    read_message_max(std::uint64_t n) noexcept
+    {
+        read_message_max_ = n;
+    }
+
+    /// Answer an upgrade request with 101 Switching Protocols.
+    /// @throw system_error if the request is not a valid websocket upgrade, in which case it
+    /// has been answered with 400 Bad Request.
+    asio::awaitable< void >
+    accept(request_type const& request);
+
+    /// Read the next message.
+    /// Pings are answered on the way. A close from the peer is answered, the connection torn
+    /// down and the read fails with beast::websocket::error::closed.
+    /// @return a view of the message, which is valid until the next read.
+    /// @throw system_error if the connection fails, or a protocol error is found, in which
+    /// case a close frame has been sent with the appropriate code.
+    /// @pre no message is part read by read_some()
+    asio::awaitable< native_message >
+    read();
+
+    /// Read the next part of a message, as soon as any of it has arrived.
+    /// Only the part of the message returned is held in memory, so messages of any size up to
+    /// the limit of read_message_max() can be read in constant space.
+    /// @param limit is the most bytes returned
+    /// @return a view of the part, which is valid until the next read. Its fin member is set
+    /// on the last part of the message, which may be empty.
+    /// @throw as read()
+    /// @pre limit > 0
+    asio::awaitable< native_message >
+    read_some(std::size_t limit);
+
+    /// Send a message as a single frame.
+    /// @return the size of the payload.
+    asio::awaitable< std::size_t >
+    write(asio::const_buffer payload, bool binary);
+
+    /// Send several messages, each as a single frame, in one gather write.
+    /// @return the total size of the payloads.
+    asio::awaitable< std::size_t >
+    write_batch(std::span< native_outbound const > messages);
+
+    /// Send a close frame. A read in progress ends when the peer replies.
+    asio::awaitable< void >
+    close(beast::websocket::close_reason const& reason);
+
+private:
+    std::uint8_t*
+    data()
+    {
+        return static_cast< std::uint8_t* >(rxbuf_.data().data());
+    }
+
+    /// Read the header of the frame at pos, and check it against the state of the message.
+    /// @throw system_error on a protocol error, once a close frame has been sent.
+    asio::awaitable< ws_codec::frame_header >
+    read_header(std::size_t pos, bool in_message, std::uint64_t message_size);
+
+    /// Read at least until the buffer holds size bytes.
+    asio::awaitable< void >
+    read_until(std::size_t size);
+
+    /// Write buffers once no other write is in progress.
+    asio::awaitable< std::size_t >
+    send(std::span< asio::const_buffer const > buffers);
+
+    /// Send a close frame with a code, unless one has been sent already.
+    asio::awaitable< void >
+    send_close(beast::websocket::close_reason const& reason);
+
+    /// Answer a control frame.
+    asio::awaitable< void >
+    on_control(ws_codec::opcode op, std::uint8_t const* payload, std::size_t size);
+
+    NextLayer next_;
+    beast::flat_buffer rxbuf_;
+
+    /// bytes at the front of rxbuf_ taken by the message last returned
+    std::size_t consumed_ = 0;
+    std::uint64_t read_message_max_ = max_message_size;
+    utf8_validator utf8_;
+
+    /// progress through the message being read by read_some()
+    struct partial_message
+    {
+        bool in_message = false;
+        bool binary = false;
+
+        /// the current frame ends the message
+        bool fin = false;
+
+        /// payload of the current frame not yet returned
+        std::uint64_t remaining = 0;
+
+        /// payload of the message returned so far
+        std::uint64_t size = 0;
+
+        /// masking key of the current frame, rotated to line up with its next byte
+        std::array< std::uint8_t, 4 > key = {};
+    };
+    partial_message partial_;
+
+    condvar write_idle_;
+    bool writing_ = false;
+    bool close_sent_ = false;
+
+    /// storage for write_batch(), reused from one batch to the next
+    std::vector< std::array< std::uint8_t, ws_codec::max_server_header_size > > headers_;
+    std::vector< asio::const_buffer > buffers_;
+};
+
+template < class T >
+struct is_native_websock : std::false_type
+{
+};
+
+template < class NextLayer >
+struct is_native_websock< native_websock< NextLayer > > : std::true_type
+{
+};
+
+template < class T >
+inline constexpr bool is_native_websock_v = is_native_websock< T >::value;
+
+#endif
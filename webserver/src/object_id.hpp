@@ -0,0 +1,108 @@
+#ifndef WEBSERVER_OBJECT_ID_HPP
+#define WEBSERVER_OBJECT_ID_HPP
+
+#include "asio.hpp"
+
+#include <boost/mp11/tuple.hpp>
+
+#include <iostream>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+template<class T, class = void>
+struct emitter
+{
+    void operator()(std::ostream& os) const
+    {
+        os << arg;
+    }
+
+    T& arg;
+};
+
+template<class T>
+emitter(T&) -> emitter<T>;
+
+template<class T>
+std::ostream&
+operator<<(std::ostream& os, emitter<T> const& e)
+{
+    e(os);
+    return os;
+}
+
+template<class T>
+struct emitter <
+    T, 
+    std::enable_if_t<
+        std::is_same_v<
+            std::decay_t<T>, 
+            asio::ip::tcp::socket
+        > ||
+        std::is_same_v<
+            std::decay_t<T>,
+            asio::basic_stream_socket<asio::ip::tcp>
+        >
+    >
+>
+{
+    void operator()(std::ostream& os) const
+    {
+        auto ec = error_code();
+        auto ep = arg.remote_endpoint(ec);
+        if (ec)
+            os << "unconnected";
+        else
+            os << arg.remote_endpoint();
+    }
+
+    T& arg;
+};
+
+template<class T>
+auto emit(T& x, std::ostream& os = std::cout)
+{
+    os << emitter<T>{ x };
+}
+
+template<class...Params>
+struct object_id
+{
+    object_id(std::string_view name_, Params&...params_)
+    : name { name_ }
+    , params { params_ ... }
+    {
+    }
+
+    friend 
+    std::ostream&
+    operator << (std::ostream& os, object_id const& oid) 
+    {
+        os << oid.name;
+        if constexpr (sizeof...(Params) > 0)
+        {
+            const char* sep = "[";
+            boost::mp11::tuple_for_each(oid.params, 
+                [&os, &sep](auto&& x)
+            {
+                os << sep;
+                sep = ", ";
+                emit(x, os);
+            });
+            os << ']';
+        }
+        os << " : ";
+
+        return os;
+    }
+
+    std::string_view name;
+    std::tuple<Params&...> params;
+};
+
+
+template<class...Params>
+object_id(std::string_view, Params&...) -> object_id<Params...>;
+
+#endif
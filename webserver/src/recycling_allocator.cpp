@@ -0,0 +1,152 @@
+#include "recycling_allocator.hpp"
+
+#include <atomic>
+#include <bit>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    constexpr std::size_t min_class_size = 64;
+    constexpr std::size_t size_classes = 11;    // 64 bytes to 64 KiB
+    static_assert((min_class_size << (size_classes - 1)) == recycling_allocator::max_recycled_size);
+
+    /// Precedes every block, keeping the user's pointer aligned for any fundamental type.
+    struct alignas(std::max_align_t) block_header
+    {
+        std::uint32_t size_class;
+    };
+
+    constexpr std::uint32_t large_block = ~std::uint32_t(0);
+
+    struct free_block
+    {
+        free_block* next;
+    };
+
+    /// Trivially destructible, so that it can still be used while other thread_local objects
+    /// are destroyed, after the thread's lists have been drained.
+    struct thread_cache
+    {
+        free_block* lists[size_classes];
+        std::size_t counts[size_classes];
+        recycling_stats stats;
+        bool registered;
+        bool retired;
+    };
+
+    thread_local thread_cache cache {};
+
+    std::atomic< bool > enabled { true };
+    std::atomic< std::uint64_t > retired_allocations { 0 };
+    std::atomic< std::uint64_t > retired_recycled { 0 };
+
+    /// Drains the thread's lists when the thread exits.
+    struct cache_guard
+    {
+        ~cache_guard()
+        {
+            cache.retired = true;
+            for (std::size_t c = 0; c < size_classes; ++c)
+            {
+                while (auto b = cache.lists[c])
+                {
+                    cache.lists[c] = b->next;
+                    std::free(reinterpret_cast< block_header* >(b) - 1);
+                }
+                cache.counts[c] = 0;
+            }
+            retired_allocations.fetch_add(cache.stats.allocations, std::memory_order_relaxed);
+            retired_recycled.fetch_add(cache.stats.recycled, std::memory_order_relaxed);
+            cache.stats = recycling_stats();
+        }
+    };
+
+    thread_local cache_guard guard;
+
+    std::uint32_t
+    size_class_of(std::size_t size)
+    {
+        // 64 is 1 << 6
+        return size <= min_class_size ? 0 : static_cast< std::uint32_t >(std::bit_width(size - 1) - 6);
+    }
+
+    std::size_t
+    class_size(std::uint32_t c)
+    {
+        return min_class_size << c;
+    }
+}
+
+void*
+recycling_allocator::allocate(std::size_t size)
+{
+    if (!cache.registered)
+    {
+        // registering the guard's destructor may itself allocate, so mark it first
+        cache.registered = true;
+        (void)&guard;
+    }
+    ++cache.stats.allocations;
+
+    auto c = size <= max_recycled_size ? size_class_of(size) : large_block;
+    if (c != large_block && cache.lists[c] && enabled.load(std::memory_order_relaxed))
+    {
+        auto b = cache.lists[c];
+        cache.lists[c] = b->next;
+        --cache.counts[c];
+        ++cache.stats.recycled;
+        return b;
+    }
+
+    auto const bytes = c == large_block ? size : class_size(c);
+    auto h = static_cast< block_header* >(std::malloc(sizeof(block_header) + bytes));
+    if (!h)
+        throw std::bad_alloc();
+    h->size_class = c;
+    return h + 1;
+}
+
+void
+recycling_allocator::deallocate(void* p) noexcept
+{
+    if (!p)
+        return;
+
+    auto h = static_cast< block_header* >(p) - 1;
+    auto const c = h->size_class;
+    if (c == large_block 
+        || cache.retired
+        || !enabled.load(std::memory_order_relaxed)
+        || (cache.counts[c] + 1) * class_size(c) > max_cached_bytes)
+    {
+        std::free(h);
+        return;
+    }
+
+    auto b = static_cast< free_block* >(p);
+    b->next = cache.lists[c];
+    cache.lists[c] = b;
+    ++cache.counts[c];
+}
+
+void
+recycling_allocator::enable(bool on)
+{
+    enabled.store(on, std::memory_order_relaxed);
+}
+
+recycling_stats
+recycling_allocator::thread_stats()
+{
+    return cache.stats;
+}
+
+recycling_stats
+recycling_allocator::total_stats()
+{
+    auto s = cache.stats;
+    s.allocations += retired_allocations.load(std::memory_order_relaxed);
+    s.recycled += retired_recycled.load(std::memory_order_relaxed);
+    return s;
+}
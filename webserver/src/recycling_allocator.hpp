@@ -0,0 +1,56 @@
+#ifndef WEBSERVER_RECYCLING_ALLOCATOR_HPP
+#define WEBSERVER_RECYCLING_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+struct recycling_stats
+{
+    /// Blocks handed out
+    std::uint64_t allocations = 0;
+
+    /// Blocks handed out from a thread's free lists, without calling malloc
+    std::uint64_t recycled = 0;
+
+    /// Blocks which had to come from malloc
+    std::uint64_t
+    heap() const { return allocations - recycled; }
+};
+
+/// A per-thread allocator which keeps freed blocks for reuse.
+/// Serving a request creates and destroys the same coroutine frames, awaitable operator
+/// states and completion handlers every time, at the same sizes. Freed blocks of up to
+/// max_recycled_size bytes are kept on the freeing thread, in one list per power of two size
+/// class, and handed out again without calling malloc. Each list keeps at most
+/// max_cached_bytes, and a thread's lists are returned to malloc when the thread exits.
+/// A block may be freed on a thread other than the one which allocated it.
+struct recycling_allocator
+{
+    /// Largest block which is recycled. Larger blocks go straight to malloc.
+    static constexpr std::size_t max_recycled_size = 64 * 1024;
+
+    /// Most bytes held in each of a thread's free lists
+    static constexpr std::size_t max_cached_bytes = 1024 * 1024;
+
+    /// @throw std::bad_alloc if malloc fails.
+    static void*
+    allocate(std::size_t size);
+
+    static void
+    deallocate(void* p) noexcept;
+
+    /// Turn recycling on or off for every thread. When off, every block comes from malloc and
+    /// goes straight back to it, but is still counted. On by default.
+    static void
+    enable(bool on);
+
+    /// Counts for the calling thread
+    static recycling_stats
+    thread_stats();
+
+    /// Counts for the calling thread and every thread which has exited
+    static recycling_stats
+    total_stats();
+};
+
+#endif
@@ -0,0 +1,114 @@
+#include "response_template.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <stdexcept>
+
+namespace
+{
+    /// The Date header of the second it was formatted in
+    struct date_header
+    {
+        std::time_t second = -1;
+        std::size_t size = 0;
+        char text[64];
+    };
+
+    thread_local date_header this_thread_date;
+
+    std::map< beast::http::status, response_template > const&
+    common_responses()
+    {
+        using beast::http::status;
+
+        static auto const responses = []
+        {
+            auto m = std::map< status, response_template >();
+            for (auto s : { status::bad_request, status::forbidden, status::not_found, status::method_not_allowed,
+                     status::payload_too_large, status::service_unavailable, status::moved_permanently,
+                     status::found, status::temporary_redirect, status::permanent_redirect })
+                m.emplace(s, response_template(s));
+            return m;
+        }();
+        return responses;
+    }
+}
+
+response_template::response_template(beast::http::status status, std::string_view content_type)
+: status_(status)
+{
+    auto const reason = beast::http::obsolete_reason(status);
+    head_ = "HTTP/1.1 ";
+    head_ += std::to_string(static_cast< unsigned >(status));
+    head_ += ' ';
+    head_.append(reason.data(), reason.size());
+    head_ += "\r\nContent-Type: ";
+    head_ += content_type;
+    head_ += "\r\n";
+}
+
+response_template const&
+common_response(beast::http::status status)
+{
+    auto& responses = common_responses();
+    auto it = responses.find(status);
+    if (it == responses.end())
+        throw std::invalid_argument("no response template for status " + 
+            std::to_string(static_cast< unsigned >(status)));
+    return it->second;
+}
+
+std::string_view
+current_date_header()
+{
+    auto& date = this_thread_date;
+    auto const now = std::time(nullptr);
+    if (now != date.second)
+    {
+        std::tm tm;
+        gmtime_r(&now, &tm);
+        date.size = std::strftime(date.text, sizeof(date.text), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+        date.second = now;
+    }
+    return std::string_view(date.text, date.size);
+}
+
+response_buffers::response_buffers(response_template const& tmpl,
+    unsigned version,
+    bool keep_alive,
+    std::string_view body,
+    std::string_view location)
+{
+    static constexpr std::string_view length_prefix = "Content-Length: ";
+    std::memcpy(content_length_, length_prefix.data(), length_prefix.size());
+    auto const end = std::to_chars(content_length_ + length_prefix.size(), 
+        content_length_ + sizeof(content_length_) - 2, body.size()).ptr;
+    std::memcpy(end, "\r\n", 2);
+
+    // HTTP/1.1 persists unless told otherwise, HTTP/1.0 only when asked
+    auto connection = std::string_view();
+    if (version >= 11 && !keep_alive)
+        connection = "Connection: close\r\n";
+    else if (version < 11 && keep_alive)
+        connection = "Connection: keep-alive\r\n";
+
+    // the thread's date text changes each second, and the write may outlast one
+    auto const date = current_date_header();
+    auto const date_size = std::min(date.size(), sizeof(date_));
+    std::memcpy(date_, date.data(), date_size);
+
+    buffers_ = {
+        asio::buffer(tmpl.head()),
+        asio::const_buffer(date_, date_size),
+        asio::const_buffer(content_length_, std::size_t(end + 2 - content_length_)),
+        asio::buffer(connection),
+        location.empty() ? asio::const_buffer() : asio::buffer(std::string_view("Location: ")),
+        asio::buffer(location),
+        location.empty() ? asio::const_buffer() : asio::buffer(std::string_view("\r\n")),
+        asio::buffer(std::string_view("\r\n")),
+        asio::buffer(body)
+    };
+}
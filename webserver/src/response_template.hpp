@@ -0,0 +1,103 @@
+#ifndef WEBSERVER_RESPONSE_TEMPLATE_HPP
+#define WEBSERVER_RESPONSE_TEMPLATE_HPP
+
+#include "asio.hpp"
+#include "beast.hpp"
+
+#include <boost/beast/http.hpp>
+
+#include <array>
+#include <string>
+#include <string_view>
+
+/// A response whose status line and fixed headers are serialized once, when the template is
+/// built. Each response made from it adds only a Date, a Content-Length, a Connection header
+/// where the request needs one, and the body. It is sent with a single gather write.
+/// Templates are immutable, so they may be shared by every io thread.
+struct response_template
+{
+    /// Build a template.
+    /// @param status is the status of every response made from the template.
+    /// @param content_type is the type of the bodies which will be sent with it.
+    explicit response_template(beast::http::status status, std::string_view content_type = "text/plain");
+
+    beast::http::status
+    status() const
+    {
+        return status_;
+    }
+
+    /// The serialized status line and fixed headers
+    std::string_view
+    head() const
+    {
+        return head_;
+    }
+
+private:
+    beast::http::status status_;
+    std::string head_;
+};
+
+/// The prepared template for a common response: 400, 403, 404, 405, 413, 503, or one of the
+/// redirects 301, 302, 307 and 308. Each body is text/plain.
+/// @throw std::invalid_argument if no template is prepared for the status.
+response_template const&
+common_response(beast::http::status status);
+
+/// The Date header line, with its CRLF, for the current second. It is formatted at most once
+/// a second on each thread, and the view is valid until the next call on the same thread.
+std::string_view
+current_date_header();
+
+/// The buffers of one response made from a template. Holds copies of the Date and the formatted
+/// Content-Length, so it must outlive the write. Refers to the template, the body and the
+/// location without copying.
+struct response_buffers
+{
+    /// Prepare a response.
+    /// @param tmpl is the template to send.
+    /// @param request is the request being answered, which decides the Connection header.
+    /// @param body is the body to send.
+    /// @param location is the target of a redirect, or empty for no Location header.
+    template < class Body >
+    response_buffers(response_template const& tmpl,
+        beast::http::request< Body > const& request,
+        std::string_view body,
+        std::string_view location = {})
+    : response_buffers(tmpl, request.version(), request.keep_alive(), body, location)
+    {
+    }
+
+    /// Prepare a response to a request of the given version, which asked for the connection
+    /// to persist or not.
+    response_buffers(response_template const& tmpl,
+        unsigned version,
+        bool keep_alive,
+        std::string_view body,
+        std::string_view location = {});
+
+    response_buffers(response_buffers const&) = delete;
+    response_buffers& operator=(response_buffers const&) = delete;
+
+    /// The serialized template, which is valid for as long as the template is
+    asio::const_buffer
+    head() const
+    {
+        return buffers_[0];
+    }
+
+    /// The buffer sequence to write. Unused headers are empty buffers.
+    std::array< asio::const_buffer, 9 > const&
+    data() const
+    {
+        return buffers_;
+    }
+
+private:
+    char date_[40];
+    char content_length_[40];
+    std::array< asio::const_buffer, 9 > buffers_;
+};
+
+#endif
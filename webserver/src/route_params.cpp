@@ -0,0 +1,30 @@
+#include "route_params.hpp"
+
+#include <charconv>
+
+std::string_view
+route_params::operator[](std::string_view name) const
+{
+    for (std::size_t i = 0; i < size_; ++i)
+        if (params_[i].name == name)
+            return params_[i].value;
+    return {};
+}
+
+std::int64_t
+route_params::integer(std::string_view name) const
+{
+    auto v = (*this)[name];
+    std::int64_t result = 0;
+    std::from_chars(v.data(), v.data() + v.size(), result);
+    return result;
+}
+
+bool
+route_params::push(std::string_view name, std::string_view value)
+{
+    if (size_ == max_params)
+        return false;
+    params_[size_++] = param { name, value };
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef WEBSERVER_ROUTE_PARAMS_HPP
+#define WEBSERVER_ROUTE_PARAMS_HPP
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+/// The parameters captured by a route match, e.g. {id} in /user/{id:int}.
+/// Storage is fixed-size so that matching never allocates. Names refer to strings owned
+/// by the router, values refer into the matched target.
+struct route_params
+{
+    static constexpr std::size_t max_params = 8;
+
+    /// The value of the named parameter, or an empty view if there is no such parameter.
+    std::string_view
+    operator[](std::string_view name) const;
+
+    /// The value of the named parameter, which must have been declared with the int type.
+    std::int64_t
+    integer(std::string_view name) const;
+
+    std::size_t
+    size() const { return size_; }
+
+    bool
+    push(std::string_view name, std::string_view value);
+
+    void
+    pop() { --size_; }
+
+    void
+    clear() { size_ = 0; }
+
+private:
+    struct param
+    {
+        std::string_view name;
+        std::string_view value;
+    };
+
+    std::array< param, max_params > params_;
+    std::size_t size_ = 0;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef WEBSERVER_ROUTER_HPP
+#define WEBSERVER_ROUTER_HPP
+
+#include "detail/route_tree.hpp"
+#include "route_params.hpp"
+
+#include <string_view>
+#include <vector>
+
+/// Maps request targets to handlers.
+/// Routes are compiled into a radix tree when added. Matching walks the tree once, in time
+/// proportional to the length of the target, and does not allocate.
+/// See detail::route_tree for the pattern syntax.
+template < class Handler >
+struct router
+{
+    /// Add a route.
+    /// @throw std::invalid_argument if the pattern is malformed or already present.
+    router&
+    add(std::string_view pattern, Handler handler);
+
+    /// Find the handler for a target.
+    /// @param target is the request target. Any query string is ignored.
+    /// @param params receives the parameters captured by the match.
+    /// @return a pointer to the handler, or nullptr if no route matches.
+    Handler const*
+    match(std::string_view target, route_params& params) const;
+
+    std::size_t
+    size() const { return handlers_.size(); }
+
+private:
+    detail::route_tree tree_;
+    std::vector< Handler > handlers_;
+};
+
+template < class Handler >
+auto
+router< Handler >::add(std::string_view pattern, Handler handler) -> router&
+{
+    tree_.insert(pattern, handlers_.size());
+    handlers_.push_back(std::move(handler));
+    return *this;
+}
+
+template < class Handler >
+auto
+router< Handler >::match(std::string_view target, route_params& params) const -> Handler const*
+{
+    auto const i = tree_.match(target, params);
+    if (i == detail::route_tree::npos)
+        return nullptr;
+    return &handlers_[i];
+}
+
+#endif
@@ -0,0 +1,109 @@
+#include "send_file.hpp"
+
+#include <memory>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+asio::awaitable<void>
+send_file(asio::ip::tcp::socket& sock, beast::file& file, std::uint64_t offset, std::uint64_t count)
+{
+#ifdef __linux__
+    sock.native_non_blocking(true);
+
+    auto pos = static_cast< off_t >(offset);
+    while (count)
+    {
+        auto n = ::sendfile(sock.native_handle(), file.native_handle(), &pos, count);
+        if (n > 0)
+        {
+            count -= static_cast< std::uint64_t >(n);
+        }
+        else if (n == 0)
+        {
+            // the file is shorter than we were told
+            throw system_error(asio::error::eof);
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            co_await sock.async_wait(asio::ip::tcp::socket::wait_write, asio::use_awaitable);
+        }
+        else if (errno != EINTR)
+        {
+            throw system_error(error_code(errno, asio::error::get_system_category()));
+        }
+    }
+#else
+    // no sendfile on this platform. Fall back to a buffered copy.
+    auto ec = error_code();
+    file.seek(offset, ec);
+    if (ec)
+        throw system_error(ec);
+
+    auto buf = std::make_unique< char[] >(send_file_chunk_size);
+    while (count)
+    {
+        auto n = file.read(buf.get(), std::min< std::uint64_t >(count, send_file_chunk_size), ec);
+        if (ec)
+            throw system_error(ec);
+        if (n == 0)
+            throw system_error(asio::error::eof);
+        co_await asio::async_write(sock, asio::buffer(buf.get(), n), asio::use_awaitable);
+        count -= n;
+    }
+#endif
+}
+
+namespace
+{
+    /// Send a range of a file through a stream which must see every byte, via a fixed-size buffer.
+    template < class Stream >
+    asio::awaitable<void>
+    send_file_buffered(Stream& stream, beast::file& file, std::uint64_t offset, std::uint64_t count)
+    {
+        auto ec = error_code();
+        file.seek(offset, ec);
+        if (ec)
+            throw system_error(ec);
+
+        auto buf = std::make_unique< char[] >(send_file_chunk_size);
+        while (count)
+        {
+            auto n = file.read(buf.get(), std::min< std::uint64_t >(count, send_file_chunk_size), ec);
+            if (ec)
+                throw system_error(ec);
+            if (n == 0)
+                throw system_error(asio::error::eof);
+            co_await asio::async_write(stream, asio::buffer(buf.get(), n), asio::use_awaitable);
+            count -= n;
+        }
+    }
+}
+
+asio::awaitable<void>
+send_file(asio::ssl::stream<asio::ip::tcp::socket>& stream, beast::file& file, std::uint64_t offset, std::uint64_t count)
+{
+    co_await send_file_buffered(stream, file, offset, count);
+}
+
+asio::awaitable<void>
+send_file(ktls_stream& stream, beast::file& file, std::uint64_t offset, std::uint64_t count)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    if (stream.kernel_send())
+    {
+        while (count)
+        {
+            auto n = co_await stream.async_sendfile_some(
+                file.native_handle(), static_cast< off_t >(offset), count, asio::use_awaitable);
+            if (n == 0)
+                throw system_error(asio::error::eof);
+            offset += n;
+            count -= n;
+        }
+        co_return;
+    }
+#endif
+    co_await send_file_buffered(stream, file, offset, count);
+}
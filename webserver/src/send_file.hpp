@@ -0,0 +1,58 @@
+#ifndef WEBSERVER_SEND_FILE_HPP
+#define WEBSERVER_SEND_FILE_HPP
+
+#include "asio.hpp"
+#include "beast.hpp"
+#include "corked_stream.hpp"
+#include "ktls_stream.hpp"
+
+#include <boost/beast/core/file.hpp>
+#include <cstdint>
+
+/// Size of the buffer used to stream file contents through a tls stream.
+inline constexpr std::size_t send_file_chunk_size = 64 * 1024;
+
+/// Coroutine to send a range of an open file to a plain tcp socket.
+/// The bytes are moved by the kernel with sendfile(2) and never enter user space.
+/// @param sock is the connected socket. It is put into non-blocking mode.
+/// @param file is the open file.
+/// @param offset is the position in the file of the first byte to send.
+/// @param count is the number of bytes to send.
+/// @throw system_error if the socket or file fails.
+asio::awaitable<void>
+send_file(asio::ip::tcp::socket& sock, beast::file& file, std::uint64_t offset, std::uint64_t count);
+
+/// Coroutine to send a range of an open file to a tls stream.
+/// The file is read through a fixed-size buffer of send_file_chunk_size bytes, so memory use
+/// does not depend on the size of the file.
+/// @param stream is the established tls stream.
+/// @param file is the open file.
+/// @param offset is the position in the file of the first byte to send.
+/// @param count is the number of bytes to send.
+/// @throw system_error if the stream or file fails.
+asio::awaitable<void>
+send_file(asio::ssl::stream<asio::ip::tcp::socket>& stream, beast::file& file, std::uint64_t offset, std::uint64_t count);
+
+/// Coroutine to send a range of an open file to a ktls stream.
+/// If the kernel encrypts the stream's records, the file is sent with SSL_sendfile and never
+/// enters user space. Otherwise it is read through a buffer, as for any tls stream.
+/// @param stream is the established stream.
+/// @param file is the open file.
+/// @param offset is the position in the file of the first byte to send.
+/// @param count is the number of bytes to send.
+/// @throw system_error if the stream or file fails.
+asio::awaitable<void>
+send_file(ktls_stream& stream, beast::file& file, std::uint64_t offset, std::uint64_t count);
+
+/// Coroutine to send a range of an open file through a corked layer.
+/// Bytes held back by the layer are sent first, then the file goes straight to the next layer.
+/// @throw system_error if the stream or file fails.
+template<class NextLayer>
+asio::awaitable<void>
+send_file(corked_stream<NextLayer>& stream, beast::file& file, std::uint64_t offset, std::uint64_t count)
+{
+    co_await stream.async_flush(asio::use_awaitable);
+    co_await send_file(stream.next_layer(), file, offset, count);
+}
+
+#endif
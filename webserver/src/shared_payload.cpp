@@ -0,0 +1,21 @@
+#include "shared_payload.hpp"
+
+shared_payload::shared_payload(std::string&& s)
+: data_(std::make_shared< std::string const >(std::move(s)))
+{
+}
+
+shared_payload::shared_payload(std::string const& s)
+: data_(std::make_shared< std::string const >(s))
+{
+}
+
+shared_payload::shared_payload(std::string_view s)
+: data_(std::make_shared< std::string const >(s))
+{
+}
+
+shared_payload::shared_payload(const char* s)
+: shared_payload(std::string_view(s))
+{
+}
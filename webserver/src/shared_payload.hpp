@@ -0,0 +1,50 @@
+#ifndef WEBSERVER_SHARED_PAYLOAD_HPP
+#define WEBSERVER_SHARED_PAYLOAD_HPP
+
+#include "asio.hpp"
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+/// An immutable, reference counted message payload.
+/// Copies share the same bytes, so a single serialized message can sit in the write queues
+/// of any number of websockets at once without being copied. The reference count is atomic,
+/// so copies may be handed to websockets running on other threads.
+struct shared_payload
+{
+    shared_payload() = default;
+
+    /// Take ownership of a string's contents. No bytes are copied.
+    shared_payload(std::string&& s);
+
+    /// Copy bytes into a new payload.
+    shared_payload(std::string const& s);
+    shared_payload(std::string_view s);
+    shared_payload(const char* s);
+
+    std::string_view
+    view() const { return data_ ? std::string_view(*data_) : std::string_view(); }
+
+    asio::const_buffer
+    buffer() const { return asio::buffer(view()); }
+
+    std::size_t
+    size() const { return data_ ? data_->size() : 0; }
+
+    bool
+    empty() const { return size() == 0; }
+
+    /// The owner of the bytes, which keeps them alive without a shared_payload
+    std::shared_ptr< void const >
+    owner() const { return data_; }
+
+    /// The number of shared_payload objects referring to these bytes.
+    long
+    use_count() const { return data_.use_count(); }
+
+private:
+    std::shared_ptr< std::string const > data_;
+};
+
+#endif
@@ -0,0 +1,292 @@
+#include "static_file_cache.hpp"
+#include "beast.hpp"
+#include "logger.hpp"
+#include "mime_type.hpp"
+
+#include <boost/beast/http.hpp>
+
+#include <cerrno>
+#include <ctime>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    constexpr auto watch_mask = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF;
+
+    std::string
+    http_date(std::time_t t)
+    {
+        std::tm tm;
+        gmtime_r(&t, &tm);
+        char buf[64];
+        auto len = std::strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        return std::string(buf, len);
+    }
+
+    std::string
+    make_etag(struct stat const& st)
+    {
+        std::ostringstream ss;
+        ss << '"' << std::hex << st.st_size << '-' << st.st_mtim.tv_sec << '.' << st.st_mtim.tv_nsec << '"';
+        return ss.str();
+    }
+
+    struct fd_guard
+    {
+        ~fd_guard()
+        {
+            if (fd >= 0)
+                ::close(fd);
+        }
+
+        int fd;
+    };
+}
+
+static_file_cache::static_file_cache(std::size_t capacity, std::size_t max_entry_size)
+: capacity_(capacity)
+, max_entry_size_(max_entry_size)
+, inotify_fd_(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+{
+    if (inotify_fd_ < 0)
+        throw system_error(error_code(errno, asio::error::get_system_category()), "inotify_init1");
+}
+
+static_file_cache::~static_file_cache()
+{
+    ::close(inotify_fd_);
+}
+
+auto
+static_file_cache::lookup(std::string_view key, std::string const& full_path) -> entry_ptr
+{
+    if (disabled_.load(std::memory_order_relaxed))
+        return nullptr;
+
+    {
+        auto lock = std::scoped_lock(mutex_);
+        if (auto i = index_.find(key); i != index_.end())
+        {
+            lru_.splice(lru_.begin(), lru_, i->second);
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return *i->second;
+        }
+    }
+
+    misses_.fetch_add(1, std::memory_order_relaxed);
+
+    // Files which could never be cached cost one stat, rather than a watch added and removed
+    // under the lock on every request. load() checks again, in case the file changes.
+    struct stat st;
+    if (::stat(full_path.c_str(), &st) < 0 || !S_ISREG(st.st_mode) 
+        || static_cast< std::size_t >(st.st_size) > max_entry_size_)
+        return nullptr;
+
+    // watch before reading, so that a change made while we read is not missed
+    auto wd = ::inotify_add_watch(inotify_fd_, full_path.c_str(), watch_mask);
+    if (wd < 0)
+        return nullptr;
+
+    auto e = load(key, full_path);
+
+    // inotify may have failed during the load, in which case the entry could never be evicted
+    auto lock = std::scoped_lock(mutex_);
+    if (!e || cost(*e) > capacity_ || disabled_.load(std::memory_order_relaxed))
+    {
+        if (!watches_.count(wd))
+            ::inotify_rm_watch(inotify_fd_, wd);
+        return nullptr;
+    }
+
+    if (auto i = index_.find(key); i != index_.end())
+    {
+        // another thread loaded it first
+        return *i->second;
+    }
+
+    e->watch = wd;
+    insert(e);
+    return e;
+}
+
+auto
+static_file_cache::load(std::string_view key, std::string const& full_path) const -> std::shared_ptr< entry >
+{
+    // O_NONBLOCK, so that opening a fifo does not wait for a writer
+    auto fd = fd_guard { ::open(full_path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC) };
+    if (fd.fd < 0)
+        return nullptr;
+
+    struct stat st;
+    if (::fstat(fd.fd, &st) < 0 || !S_ISREG(st.st_mode))
+        return nullptr;
+
+    auto const size = static_cast< std::size_t >(st.st_size);
+    if (size > max_entry_size_)
+        return nullptr;
+
+    auto e = std::make_shared< entry >();
+    e->key.assign(key.begin(), key.end());
+    e->body.resize(size);
+
+    std::size_t pos = 0;
+    while (pos < size)
+    {
+        auto n = ::read(fd.fd, e->body.data() + pos, size - pos);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return nullptr;
+        pos += static_cast< std::size_t >(n);
+    }
+
+    e->etag = make_etag(st);
+
+    namespace http = beast::http;
+
+    auto const type = mime_type(key);
+    auto resp = http::response< http::empty_body >(http::status::ok, 11);
+    resp.set(http::field::content_type, beast::string_view(type.data(), type.size()));
+    resp.set(http::field::etag, e->etag);
+    resp.set(http::field::last_modified, http_date(st.st_mtime));
+    resp.content_length(size);
+
+    auto ss = std::ostringstream();
+    ss << resp.base();
+    e->header = ss.str();
+
+    auto nm = http::response< http::empty_body >(http::status::not_modified, 11);
+    nm.set(http::field::etag, e->etag);
+    ss.str({});
+    ss << nm.base();
+    e->not_modified = ss.str();
+
+    return e;
+}
+
+void
+static_file_cache::insert(entry_ptr e)
+{
+    size_bytes_ += cost(*e);
+    lru_.push_front(e);
+    index_.emplace(e->key, lru_.begin());
+    watches_.emplace(e->watch, e->key);
+
+    while (size_bytes_ > capacity_)
+        erase(std::prev(lru_.end()));
+}
+
+void
+static_file_cache::erase(lru_list::iterator it)
+{
+    auto const& e = **it;
+
+    auto [first, last] = watches_.equal_range(e.watch);
+    for (auto w = first; w != last; ++w)
+        if (w->second.data() == e.key.data())
+        {
+            watches_.erase(w);
+            break;
+        }
+    if (!watches_.count(e.watch))
+        ::inotify_rm_watch(inotify_fd_, e.watch);
+
+    index_.erase(e.key);
+    size_bytes_ -= cost(e);
+    lru_.erase(it);
+}
+
+void
+static_file_cache::clear()
+{
+    auto lock = std::scoped_lock(mutex_);
+    while (!lru_.empty())
+        erase(std::prev(lru_.end()));
+}
+
+void
+static_file_cache::invalidate(int watch)
+{
+    auto lock = std::scoped_lock(mutex_);
+    for (auto i = watches_.find(watch); i != watches_.end(); i = watches_.find(watch))
+        erase(index_.at(i->second));
+}
+
+asio::awaitable<void>
+static_file_cache::watch()
+{
+    auto me = object_id(__func__);
+    auto desc = asio::posix::stream_descriptor(co_await asio::this_coro::executor, ::dup(inotify_fd_));
+
+    // where the watcher waits to be cancelled, should inotify fail
+    auto idle = asio::steady_timer(desc.get_executor(), asio::steady_timer::time_point::max());
+
+    if (auto cslot = (co_await asio::this_coro::cancellation_state).slot() ; cslot.is_connected())
+        cslot.assign([&](asio::cancellation_type) {
+            desc.cancel();
+            idle.cancel();
+        });
+
+    alignas(inotify_event) char buf[4096];
+    for (;;)
+    {
+        auto [ec, n] = co_await desc.async_read_some(asio::buffer(buf), asioex::as_tuple(asio::use_awaitable));
+        if (ec == asio::error::operation_aborted)
+            co_return;
+        if (ec)
+        {
+            // Changes can no longer be seen, so nothing cached can be trusted. Files are sent
+            // from disk from now on, and the server carries on.
+            log_error(me, "inotify read failed, caching disabled: ", ec.message());
+            disabled_.store(true, std::memory_order_relaxed);
+            clear();
+            co_await idle.async_wait(asioex::as_tuple(asio::use_awaitable));
+            co_return;
+        }
+
+        std::size_t pos = 0;
+        while (pos + sizeof(inotify_event) <= n)
+        {
+            auto ev = reinterpret_cast< inotify_event const* >(buf + pos);
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                // events were lost, so any entry may be stale
+                log_warn(me, "inotify queue overflowed, cache cleared");
+                clear();
+            }
+            else
+                invalidate(ev->wd);
+            pos += sizeof(inotify_event) + ev->len;
+        }
+    }
+}
+
+std::uint64_t
+static_file_cache::hits() const
+{
+    return hits_.load(std::memory_order_relaxed);
+}
+
+std::uint64_t
+static_file_cache::misses() const
+{
+    return misses_.load(std::memory_order_relaxed);
+}
+
+std::size_t
+static_file_cache::size_bytes() const
+{
+    auto lock = std::scoped_lock(mutex_);
+    return size_bytes_;
+}
+
+std::size_t
+static_file_cache::cost(entry const& e)
+{
+    return e.key.size() + e.header.size() + e.not_modified.size() + e.body.size();
+}
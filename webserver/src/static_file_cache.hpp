@@ -0,0 +1,124 @@
+#ifndef WEBSERVER_STATIC_FILE_CACHE_HPP
+#define WEBSERVER_STATIC_FILE_CACHE_HPP
+
+#include "asio.hpp"
+
+#include <array>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/// A size-bounded, least-recently-used cache of small static files.
+/// Each entry holds a copy of the file and its fully serialized response headers, so a hit
+/// is served with a single gather write and no per-request formatting.
+/// Entries are invalidated through inotify when the file on disk changes.
+/// The cache may be shared by several io threads.
+struct static_file_cache
+{
+    struct entry
+    {
+        /// Buffers for a 200 response: the serialized header followed by the file contents.
+        std::array< asio::const_buffer, 2 >
+        buffers() const
+        {
+            return { asio::buffer(header), asio::buffer(body) };
+        }
+
+        /// Buffer for a 304 response, sent when the client's If-None-Match matches etag.
+        asio::const_buffer
+        not_modified_buffer() const
+        {
+            return asio::buffer(not_modified);
+        }
+
+        std::string key;
+        std::string etag;
+        std::string header;
+        std::string not_modified;
+        std::string body;
+
+        /// inotify watch descriptor for the file, shared by every entry for the same inode
+        int watch = -1;
+    };
+
+    using entry_ptr = std::shared_ptr< entry const >;
+
+    /// Construct the cache.
+    /// @param capacity is the maximum total size in bytes of cached headers and file contents.
+    /// @param max_entry_size is the largest file that will be cached. Larger files are left
+    /// to the caller to send from disk.
+    static_file_cache(std::size_t capacity, std::size_t max_entry_size);
+
+    static_file_cache(static_file_cache const&) = delete;
+    static_file_cache& operator=(static_file_cache const&) = delete;
+
+    ~static_file_cache();
+
+    /// Find the entry for a validated path, loading it from disk on a miss.
+    /// @param key is the validated path, as requested.
+    /// @param full_path is the location of the file on disk.
+    /// @return the entry, or null if the file does not exist, is not a regular file or is too large to cache.
+    entry_ptr
+    lookup(std::string_view key, std::string const& full_path);
+
+    /// Coroutine which reads inotify events and evicts entries whose file has changed.
+    /// Must be running for the cache to notice changes on disk. Supports cancellation, and
+    /// ends only when cancelled. If inotify's queue overflows, the whole cache is cleared.
+    /// If inotify fails, the error is logged and the cache is disabled, so that every lookup
+    /// misses.
+    asio::awaitable<void>
+    watch();
+
+    std::uint64_t
+    hits() const;
+
+    std::uint64_t
+    misses() const;
+
+    std::size_t
+    size_bytes() const;
+
+private:
+    using lru_list = std::list< entry_ptr >;
+
+    std::shared_ptr< entry >
+    load(std::string_view key, std::string const& full_path) const;
+
+    void
+    insert(entry_ptr e);
+
+    void
+    erase(lru_list::iterator it);
+
+    void
+    invalidate(int watch);
+
+    /// Evict every entry
+    void
+    clear();
+
+    static std::size_t
+    cost(entry const& e);
+
+    std::size_t const capacity_;
+    std::size_t const max_entry_size_;
+    int inotify_fd_ = -1;
+
+    mutable std::mutex mutex_;
+    lru_list lru_;   // most recently used at the front
+    std::unordered_map< std::string_view, lru_list::iterator > index_;
+    std::unordered_multimap< int, std::string_view > watches_;
+    std::size_t size_bytes_ = 0;
+
+    std::atomic< std::uint64_t > hits_ { 0 };
+    std::atomic< std::uint64_t > misses_ { 0 };
+
+    /// set once inotify has failed, after which nothing is cached
+    std::atomic< bool > disabled_ { false };
+};
+
+#endif
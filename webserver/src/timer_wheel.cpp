@@ -0,0 +1,181 @@
+#include "timer_wheel.hpp"
+
+asio::io_context::id timer_wheel::id;
+
+timer_wheel::timer_wheel(asio::io_context& ioc)
+: asio::io_context::service(ioc)
+, ioc_(ioc)
+, timer_(ioc)
+, origin_(clock_type::now())
+{
+}
+
+timer_wheel::~timer_wheel()
+{
+    shutdown();
+}
+
+timer_wheel&
+timer_wheel::of(asio::any_io_executor const& exec)
+{
+    auto& ctx = asio::query(exec, asio::execution::context);
+    return asio::use_service< timer_wheel >(static_cast< asio::io_context& >(ctx));
+}
+
+void
+timer_wheel::shutdown()
+{
+    // destroy the waiting operations without completing them, as the io_context does
+    // with its own
+    for (auto& level : wheel_)
+        for (auto& head : level)
+            while (auto e = head)
+            {
+                head = e->next;
+                e->destroy(e);
+            }
+    size_ = 0;
+    level_size_ = {};
+}
+
+std::uint64_t
+timer_wheel::tick_of(clock_type::time_point t) const
+{
+    if (t <= origin_)
+        return 0;
+    return static_cast< std::uint64_t >((t - origin_) / tick);
+}
+
+void
+timer_wheel::insert(entry* e)
+{
+    auto const span = std::uint64_t(1) << (slot_bits * levels);
+    if (e->expiry < current_)
+        e->expiry = current_;
+    else if (e->expiry - current_ >= span)
+        e->expiry = current_ + span - 1;
+
+    // the lowest level whose span reaches the expiry
+    auto const delta = e->expiry - current_;
+    std::size_t level = 0;
+    while (level + 1 < levels && delta >= (std::uint64_t(1) << (slot_bits * (level + 1))))
+        ++level;
+
+    link(level, (e->expiry >> (slot_bits * level)) & (slots - 1), e);
+}
+
+void
+timer_wheel::link(std::size_t level, std::size_t slot, entry* e)
+{
+    auto& head = wheel_[level][slot];
+    e->level = static_cast< std::uint16_t >(level);
+    e->slot  = static_cast< std::uint16_t >(slot);
+    e->prev  = nullptr;
+    e->next  = head;
+    if (head)
+        head->prev = e;
+    head = e;
+    ++level_size_[level];
+    ++size_;
+}
+
+void
+timer_wheel::unlink(entry* e)
+{
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        wheel_[e->level][e->slot] = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    e->prev = e->next = nullptr;
+    --level_size_[e->level];
+    --size_;
+}
+
+void
+timer_wheel::cascade(std::size_t level)
+{
+    auto& head = wheel_[level][(current_ >> (slot_bits * level)) & (slots - 1)];
+    auto e = std::exchange(head, nullptr);
+    while (e)
+    {
+        auto next = e->next;
+        --level_size_[level];
+        --size_;
+        insert(e);
+        e = next;
+    }
+}
+
+void
+timer_wheel::advance()
+{
+    armed_ = false;
+    auto const now = tick_of(clock_type::now());
+    while (current_ < now)
+    {
+        ++current_;
+
+        // each time the levels below wrap, the next slot of a level comes down, highest first
+        std::size_t top = 0;
+        while (top + 1 < levels && (current_ & ((std::uint64_t(1) << (slot_bits * (top + 1))) - 1)) == 0)
+            ++top;
+        for (auto level = top; level > 0; --level)
+            cascade(level);
+
+        auto e = std::exchange(wheel_[0][current_ & (slots - 1)], nullptr);
+        while (e)
+        {
+            auto next = e->next;
+            --level_size_[0];
+            --size_;
+            e->prev = e->next = nullptr;
+            e->done = true;
+            post_complete(e, error_code());
+            e = next;
+        }
+    }
+    arm();
+}
+
+std::uint64_t
+timer_wheel::next_tick() const
+{
+    // the start of the next revolution of the first level, where the levels above cascade
+    auto next = (current_ | (slots - 1)) + 1;
+
+    if (level_size_[0])
+        for (auto t = current_ + 1; t < current_ + slots; ++t)
+            if (wheel_[0][t & (slots - 1)])
+                return std::min(next, t);
+
+    return next;
+}
+
+void
+timer_wheel::arm()
+{
+    if (size_ == 0)
+        return;
+
+    auto const next = next_tick();
+    if (armed_ && next >= armed_tick_)
+        return;
+
+    armed_      = true;
+    armed_tick_ = next;
+    timer_.expires_at(origin_ + next * tick);
+    timer_.async_wait([this](error_code ec)
+    {
+        // aborted when rearmed for an earlier tick
+        if (!ec)
+            advance();
+    });
+}
+
+void
+timer_wheel::post_complete(entry* e, error_code ec)
+{
+    asio::post(ioc_, completion(e, ec));
+}
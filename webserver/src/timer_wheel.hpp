@@ -0,0 +1,211 @@
+#ifndef WEBSERVER_TIMER_WHEEL_HPP
+#define WEBSERVER_TIMER_WHEEL_HPP
+
+#include "asio.hpp"
+#include "beast.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+/// A hierarchical timer wheel, one per io_context, for coarse timeouts.
+/// asio::steady_timer keeps every timer of an io_context in a heap, so arming and cancelling
+/// cost O(log n), and every connection's idle timeout is rearmed on each request. Timeouts
+/// on the wheel are held in intrusive lists, one per slot, so arming and cancelling are O(1).
+/// The wheel has four levels of 256 slots. The first level covers 256 ticks of `tick` each,
+/// and each level above covers 256 times the span of the one below. Timeouts move down a level
+/// as their time approaches. The wheel runs on a single steady_timer, and every timeout which
+/// falls in the same tick expires in the same pass. A timeout may therefore expire up to one
+/// tick late, but never early. Timeouts beyond the wheel's span, about 497 days, are
+/// shortened to it.
+/// The wheel is an io_context service. It must only be used from the io_context's thread.
+struct timer_wheel : asio::io_context::service
+{
+    using clock_type = std::chrono::steady_clock;
+
+    /// The resolution of the wheel
+    static constexpr std::chrono::milliseconds tick { 10 };
+
+    static asio::io_context::id id;
+
+    explicit timer_wheel(asio::io_context& ioc);
+
+    ~timer_wheel();
+
+    /// The wheel of the io_context on which an executor runs. The executor must belong to an
+    /// asio::io_context.
+    static timer_wheel&
+    of(asio::any_io_executor const& exec);
+
+    /// Wait for a duration.
+    /// Supports per-operation cancellation, so it can take part in awaitable operator races.
+    /// Completes as if by post: with success once the duration has elapsed, or with
+    /// asio::error::operation_aborted if cancelled.
+    template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code)) WaitHandler >
+    BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(WaitHandler, void(error_code))
+    async_wait(clock_type::duration duration, WaitHandler&& handler);
+
+    /// Number of timeouts waiting on the wheel
+    std::size_t
+    size() const { return size_; }
+
+private:
+    static constexpr std::size_t levels = 4;
+    static constexpr std::size_t slot_bits = 8;
+    static constexpr std::size_t slots = std::size_t(1) << slot_bits;
+
+    /// A waiting timeout. Linked into one slot of the wheel.
+    struct entry
+    {
+        entry* prev = nullptr;
+        entry* next = nullptr;
+        std::uint64_t expiry = 0;
+        std::uint16_t level = 0;
+        std::uint16_t slot = 0;
+
+        /// Set once the entry has left the wheel, so that a late cancellation is ignored.
+        bool done = false;
+
+        /// Complete the operation with the given result and destroy it.
+        void (*complete)(entry*, error_code) = nullptr;
+
+        /// Destroy the operation without completing it.
+        void (*destroy)(entry*) = nullptr;
+    };
+
+    /// A posted completion. Destroys the operation if the io_context is shut down first.
+    struct completion
+    {
+        completion(entry* e, error_code ec) : e_(e), ec_(ec) {}
+        completion(completion&& other) noexcept : e_(std::exchange(other.e_, nullptr)), ec_(other.ec_) {}
+        ~completion() { if (e_) e_->destroy(e_); }
+
+        void
+        operator()()
+        {
+            auto e = std::exchange(e_, nullptr);
+            e->complete(e, ec_);
+        }
+
+    private:
+        entry* e_;
+        error_code ec_;
+    };
+
+    template < class Handler >
+    struct wait_op;
+
+    void
+    shutdown() override;
+
+    std::uint64_t
+    tick_of(clock_type::time_point t) const;
+
+    void
+    insert(entry* e);
+
+    void
+    link(std::size_t level, std::size_t slot, entry* e);
+
+    void
+    unlink(entry* e);
+
+    /// Process every tick up to now, then rearm the timer if anything is waiting.
+    void
+    advance();
+
+    /// Move the entries in the current slot of a level down to the levels below.
+    void
+    cascade(std::size_t level);
+
+    /// The next tick at which a slot expires or a level cascades
+    std::uint64_t
+    next_tick() const;
+
+    void
+    arm();
+
+    /// Post the completion of an entry which is no longer on the wheel.
+    void
+    post_complete(entry* e, error_code ec);
+
+    asio::io_context& ioc_;
+    asio::steady_timer timer_;
+    bool armed_ = false;
+    std::uint64_t armed_tick_ = 0;
+    clock_type::time_point origin_;
+    std::uint64_t current_ = 0;
+    std::size_t size_ = 0;
+    std::array< std::size_t, levels > level_size_ {};
+    std::array< std::array< entry*, slots >, levels > wheel_ {};
+};
+
+template < class Handler >
+struct timer_wheel::wait_op : entry
+{
+    wait_op(timer_wheel& w, Handler&& h)
+    : wheel(w)
+    , handler(std::move(h))
+    {
+        complete = &do_complete;
+        destroy  = &do_destroy;
+    }
+
+    static void
+    do_complete(entry* e, error_code ec)
+    {
+        auto op = std::unique_ptr< wait_op >(static_cast< wait_op* >(e));
+
+        // outside of any emit, so the cancellation handler, which refers to op, can go
+        asio::get_associated_cancellation_slot(op->handler).clear();
+
+        auto h  = std::move(op->handler);
+        auto ex = asio::get_associated_executor(h, op->wheel.ioc_.get_executor());
+        op.reset();
+        asio::dispatch(ex, beast::bind_front_handler(std::move(h), ec));
+    }
+
+    static void
+    do_destroy(entry* e)
+    {
+        delete static_cast< wait_op* >(e);
+    }
+
+    timer_wheel& wheel;
+    Handler handler;
+};
+
+template < BOOST_ASIO_COMPLETION_TOKEN_FOR(void(error_code)) WaitHandler >
+BOOST_ASIO_INITFN_AUTO_RESULT_TYPE(WaitHandler, void(error_code))
+timer_wheel::async_wait(clock_type::duration duration, WaitHandler&& handler)
+{
+    return asio::async_initiate< WaitHandler, void(error_code) >(
+        [this, duration](auto handler)
+        {
+            using op_type = wait_op< decltype(handler) >;
+            auto op = new op_type(*this, std::move(handler));
+
+            // round up, so that a timeout never expires early
+            op->expiry = std::max(tick_of(clock_type::now() + duration) + 1, current_ + 1);
+            insert(op);
+
+            auto slot = asio::get_associated_cancellation_slot(op->handler);
+            if (slot.is_connected())
+            {
+                slot.assign([op](asio::cancellation_type type)
+                {
+                    if (type == asio::cancellation_type::none || op->done)
+                        return;
+                    op->done = true;
+                    op->wheel.unlink(op);
+                    op->wheel.post_complete(op, asio::error::operation_aborted);
+                });
+            }
+            arm();
+        },
+        handler);
+}
+
+#endif
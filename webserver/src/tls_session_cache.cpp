@@ -0,0 +1,311 @@
+#include "tls_session_cache.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
+#include <openssl/rand.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
+
+namespace
+{
+    int
+    cache_index()
+    {
+        static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+        return index;
+    }
+
+    std::string
+    session_id(SSL_SESSION const* session)
+    {
+        unsigned int length = 0;
+        auto id = SSL_SESSION_get_id(session, &length);
+        return std::string(reinterpret_cast< const char* >(id), length);
+    }
+
+    template < std::size_t N >
+    void
+    random_fill(std::array< unsigned char, N >& a)
+    {
+        if (RAND_bytes(a.data(), static_cast< int >(a.size())) != 1)
+            throw std::runtime_error("tls_session_cache: RAND_bytes failed");
+    }
+
+    constexpr unsigned char session_id_context[] = "webserver";
+}
+
+tls_session_cache::tls_session_cache(asio::ssl::context& ctx, tls_session_options const& options)
+: ctx_(ctx.native_handle())
+, options_(options)
+, shard_capacity_(std::max< std::size_t >(1, options.cache_size / std::max< std::size_t >(1, options.shards)))
+{
+    shards_.reserve(std::max< std::size_t >(1, options.shards));
+    while (shards_.size() < std::max< std::size_t >(1, options.shards))
+        shards_.push_back(std::make_unique< shard >());
+
+    current_key_ = make_ticket_key();
+
+    SSL_CTX_set_ex_data(ctx_, cache_index(), this);
+    SSL_CTX_set_session_id_context(ctx_, session_id_context, sizeof(session_id_context) - 1);
+    SSL_CTX_set_timeout(ctx_, static_cast< long >(options.session_timeout.count()));
+
+    // all sessions live in our cache, so that every thread sees the same sessions without
+    // contending on the context's single internal cache lock
+    SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+    SSL_CTX_sess_set_new_cb(ctx_, &on_new_session);
+    SSL_CTX_sess_set_get_cb(ctx_, &on_get_session);
+    SSL_CTX_sess_set_remove_cb(ctx_, &on_remove_session);
+
+    SSL_CTX_clear_options(ctx_, SSL_OP_NO_TICKET);
+    SSL_CTX_set_num_tickets(ctx_, options.tls13_tickets);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx_, &on_ticket_key);
+#else
+    SSL_CTX_set_tlsext_ticket_key_cb(ctx_, &on_ticket_key);
+#endif
+}
+
+tls_session_cache::~tls_session_cache()
+{
+    SSL_CTX_sess_set_new_cb(ctx_, nullptr);
+    SSL_CTX_sess_set_get_cb(ctx_, nullptr);
+    SSL_CTX_sess_set_remove_cb(ctx_, nullptr);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx_, nullptr);
+#else
+    SSL_CTX_set_tlsext_ticket_key_cb(ctx_, nullptr);
+#endif
+    SSL_CTX_set_ex_data(ctx_, cache_index(), nullptr);
+}
+
+auto
+tls_session_cache::make_ticket_key() -> ticket_key
+{
+    auto key = ticket_key();
+    random_fill(key.name);
+    random_fill(key.aes_key);
+    random_fill(key.hmac_key);
+    return key;
+}
+
+tls_session_cache*
+tls_session_cache::from(SSL_CTX* ctx)
+{
+    return static_cast< tls_session_cache* >(SSL_CTX_get_ex_data(ctx, cache_index()));
+}
+
+auto
+tls_session_cache::shard_for(std::string const& id) -> shard&
+{
+    return *shards_[std::hash< std::string >()(id) % shards_.size()];
+}
+
+void
+tls_session_cache::rotate_ticket_keys()
+{
+    auto key = make_ticket_key();
+
+    auto lock          = std::lock_guard(keys_mutex_);
+    previous_key_      = current_key_;
+    have_previous_key_ = true;
+    current_key_       = key;
+}
+
+asio::awaitable<void>
+tls_session_cache::run_key_rotation()
+{
+    auto timer = asio::steady_timer(co_await asio::this_coro::executor);
+    for (;;)
+    {
+        timer.expires_after(options_.ticket_key_lifetime);
+        co_await timer.async_wait(asio::use_awaitable);
+        rotate_ticket_keys();
+    }
+}
+
+void
+tls_session_cache::record_handshake(SSL* ssl)
+{
+    if (auto self = from(SSL_get_SSL_CTX(ssl)))
+    {
+        if (SSL_session_reused(ssl))
+            self->resumed_.fetch_add(1, std::memory_order_relaxed);
+        else
+            self->full_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+std::size_t
+tls_session_cache::size() const
+{
+    std::size_t n = 0;
+    for (auto& s : shards_)
+    {
+        auto lock = std::lock_guard(s->mutex);
+        n += s->index.size();
+    }
+    return n;
+}
+
+int
+tls_session_cache::on_new_session(SSL* ssl, SSL_SESSION* session)
+{
+    auto self = from(SSL_get_SSL_CTX(ssl));
+    if (!self)
+        return 0;
+
+    auto der = std::string(static_cast< std::size_t >(i2d_SSL_SESSION(session, nullptr)), '\0');
+    auto p   = reinterpret_cast< unsigned char* >(der.data());
+    i2d_SSL_SESSION(session, &p);
+
+    auto id      = session_id(session);
+    auto expires = std::chrono::steady_clock::now() + std::chrono::seconds(SSL_SESSION_get_timeout(session));
+    auto& s      = self->shard_for(id);
+
+    auto lock = std::lock_guard(s.mutex);
+    if (auto i = s.index.find(id); i != s.index.end())
+    {
+        s.lru.erase(i->second.lru);
+        s.index.erase(i);
+    }
+    while (s.index.size() >= self->shard_capacity_)
+    {
+        s.index.erase(s.lru.back());
+        s.lru.pop_back();
+    }
+    s.lru.push_front(id);
+    s.index.emplace(std::move(id), shard::entry { std::move(der), expires, s.lru.begin() });
+
+    // we keep the serialized copy, not a reference to the session
+    return 0;
+}
+
+SSL_SESSION*
+tls_session_cache::on_get_session(SSL* ssl, const unsigned char* id, int length, int* copy)
+{
+    *copy     = 0;
+    auto self = from(SSL_get_SSL_CTX(ssl));
+    if (!self)
+        return nullptr;
+
+    auto key  = std::string(reinterpret_cast< const char* >(id), static_cast< std::size_t >(length));
+    auto& s   = self->shard_for(key);
+    auto der  = std::string();
+    {
+        auto lock = std::lock_guard(s.mutex);
+        auto i    = s.index.find(key);
+        if (i == s.index.end() || i->second.expires <= std::chrono::steady_clock::now())
+        {
+            if (i != s.index.end())
+            {
+                s.lru.erase(i->second.lru);
+                s.index.erase(i);
+            }
+            self->misses_.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        s.lru.splice(s.lru.begin(), s.lru, i->second.lru);
+        der = i->second.der;
+    }
+
+    self->hits_.fetch_add(1, std::memory_order_relaxed);
+    auto p = reinterpret_cast< const unsigned char* >(der.data());
+    return d2i_SSL_SESSION(nullptr, &p, static_cast< long >(der.size()));
+}
+
+void
+tls_session_cache::on_remove_session(SSL_CTX* ctx, SSL_SESSION* session)
+{
+    auto self = from(ctx);
+    if (!self)
+        return;
+
+    auto id   = session_id(session);
+    auto& s   = self->shard_for(id);
+    auto lock = std::lock_guard(s.mutex);
+    if (auto i = s.index.find(id); i != s.index.end())
+    {
+        s.lru.erase(i->second.lru);
+        s.index.erase(i);
+    }
+}
+
+int
+tls_session_cache::find_ticket_key(unsigned char const* name, ticket_key& key) const
+{
+    auto lock = std::lock_guard(keys_mutex_);
+    if (std::memcmp(name, current_key_.name.data(), current_key_.name.size()) == 0)
+    {
+        key = current_key_;
+        return 1;
+    }
+    if (have_previous_key_ && std::memcmp(name, previous_key_.name.data(), previous_key_.name.size()) == 0)
+    {
+        key = previous_key_;
+        return 2;
+    }
+    return 0;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+int
+tls_session_cache::on_ticket_key(SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cctx, EVP_MAC_CTX* hctx, int enc)
+#else
+int
+tls_session_cache::on_ticket_key(SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cctx, HMAC_CTX* hctx, int enc)
+#endif
+{
+    auto self = from(SSL_get_SSL_CTX(ssl));
+    if (!self)
+        return -1;
+
+    auto key    = ticket_key();
+    auto result = 1;
+    if (enc)
+    {
+        {
+            auto lock = std::lock_guard(self->keys_mutex_);
+            key       = self->current_key_;
+        }
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1)
+            return -1;
+        std::memcpy(name, key.name.data(), key.name.size());
+        if (EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), nullptr, key.aes_key.data(), iv) != 1)
+            return -1;
+    }
+    else
+    {
+        // an unknown key means a full handshake, after which a new ticket is issued.
+        // A ticket from the previous key is accepted, and replaced with one from the current key.
+        result = self->find_ticket_key(name, key);
+        if (result == 0)
+            return 0;
+
+        // a TLS 1.3 client uses each ticket once, so a resumed connection needs a fresh one
+        if (SSL_version(ssl) >= TLS1_3_VERSION)
+            result = 2;
+        if (EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), nullptr, key.aes_key.data(), iv) != 1)
+            return -1;
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    char digest[] = "SHA256";
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac_key.data(), key.hmac_key.size()),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+        OSSL_PARAM_construct_end()
+    };
+    if (EVP_MAC_CTX_set_params(hctx, params) != 1)
+        return -1;
+#else
+    if (HMAC_Init_ex(hctx, key.hmac_key.data(), static_cast< int >(key.hmac_key.size()), EVP_sha256(), nullptr) != 1)
+        return -1;
+#endif
+
+    return result;
+}
@@ -0,0 +1,156 @@
+#ifndef WEBSERVER_TLS_SESSION_CACHE_HPP
+#define WEBSERVER_TLS_SESSION_CACHE_HPP
+
+#include "asio.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/ssl.h>
+
+struct tls_session_options
+{
+    /// Most sessions held in the cache, across all shards
+    std::size_t cache_size = 20480;
+
+    /// Number of independently locked shards. Spreads lock contention between io threads.
+    std::size_t shards = 16;
+
+    /// How long a session, or a ticket, may be resumed after its full handshake
+    std::chrono::seconds session_timeout { 2 * 3600 };
+
+    /// How often a new ticket key is made. Tickets made with the previous key are still
+    /// accepted, and renewed, for one more period.
+    std::chrono::seconds ticket_key_lifetime { 3600 };
+
+    /// Number of TLS 1.3 tickets issued after each full handshake
+    std::size_t tls13_tickets = 2;
+};
+
+/// Server-side TLS session resumption for an ssl::context.
+/// TLS 1.2 clients resume by session id from a sharded, in-memory LRU cache. Clients which
+/// support tickets, which includes every TLS 1.3 client resuming by PSK, resume from a ticket
+/// encrypted with a key held by the server and rotated periodically.
+/// A resumed handshake skips the certificate and key exchange signatures, which dominate the
+/// CPU cost of a full handshake.
+/// The cache may be shared by several io threads.
+struct tls_session_cache
+{
+    /// Install the cache and ticket keys on a context. The cache must outlive the context's use.
+    tls_session_cache(asio::ssl::context& ctx, tls_session_options const& options = {});
+
+    tls_session_cache(tls_session_cache const&) = delete;
+    tls_session_cache& operator=(tls_session_cache const&) = delete;
+
+    ~tls_session_cache();
+
+    /// Make a new ticket key current, keeping the current key to decrypt existing tickets.
+    void
+    rotate_ticket_keys();
+
+    /// Coroutine which rotates the ticket keys every ticket_key_lifetime. Supports cancellation.
+    asio::awaitable<void>
+    run_key_rotation();
+
+    /// Count a completed server handshake as full or resumed.
+    /// Does nothing if the connection's context has no session cache.
+    static void
+    record_handshake(SSL* ssl);
+
+    /// Number of sessions in the cache
+    std::size_t
+    size() const;
+
+    std::uint64_t
+    hits() const { return hits_.load(std::memory_order_relaxed); }
+
+    std::uint64_t
+    misses() const { return misses_.load(std::memory_order_relaxed); }
+
+    std::uint64_t
+    full_handshakes() const { return full_.load(std::memory_order_relaxed); }
+
+    std::uint64_t
+    resumed_handshakes() const { return resumed_.load(std::memory_order_relaxed); }
+
+private:
+    struct ticket_key
+    {
+        std::array< unsigned char, 16 > name;
+        std::array< unsigned char, 32 > aes_key;
+        std::array< unsigned char, 32 > hmac_key;
+    };
+
+    struct shard
+    {
+        struct entry
+        {
+            std::string der;
+            std::chrono::steady_clock::time_point expires;
+            std::list< std::string >::iterator lru;
+        };
+
+        std::mutex mutex;
+        std::unordered_map< std::string, entry > index;
+
+        /// session ids, most recently used first
+        std::list< std::string > lru;
+    };
+
+    static ticket_key
+    make_ticket_key();
+
+    static tls_session_cache*
+    from(SSL_CTX* ctx);
+
+    shard&
+    shard_for(std::string const& id);
+
+    static int
+    on_new_session(SSL* ssl, SSL_SESSION* session);
+
+    static SSL_SESSION*
+    on_get_session(SSL* ssl, const unsigned char* id, int length, int* copy);
+
+    static void
+    on_remove_session(SSL_CTX* ctx, SSL_SESSION* session);
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    static int
+    on_ticket_key(SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cctx, EVP_MAC_CTX* hctx, int enc);
+#else
+    static int
+    on_ticket_key(SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cctx, HMAC_CTX* hctx, int enc);
+#endif
+
+    /// Find the key for a ticket name.
+    /// @return 1 if the key is current, 2 if it is the previous key, or 0 if unknown.
+    int
+    find_ticket_key(unsigned char const* name, ticket_key& key) const;
+
+    SSL_CTX* ctx_;
+    tls_session_options options_;
+    std::size_t shard_capacity_;
+    std::vector< std::unique_ptr< shard > > shards_;
+
+    mutable std::mutex keys_mutex_;
+    ticket_key current_key_;
+    ticket_key previous_key_;
+    bool have_previous_key_ = false;
+
+    std::atomic< std::uint64_t > hits_ { 0 };
+    std::atomic< std::uint64_t > misses_ { 0 };
+    std::atomic< std::uint64_t > full_ { 0 };
+    std::atomic< std::uint64_t > resumed_ { 0 };
+};
+
+#endif
@@ -0,0 +1,452 @@
+#include "utf8_validator.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define WEBSERVER_UTF8_X86 1
+#include <immintrin.h>
+#endif
+
+// The block implementations use the lookup algorithm of Keiser and Lemire, "Validating UTF-8
+// in less than one instruction per byte" (2021). Each byte is classified, through three
+// 16-entry table lookups, by the high nibble of the byte before it, the low nibble of the byte
+// before it and its own high nibble. The three results are ANDed, leaving a bit set for each
+// error the pair of bytes shows. Continuation bytes required by a three or four byte lead two
+// or three bytes back are then checked against that lead's bit.
+
+namespace
+{
+    // error bits of the byte-pair classification
+    constexpr std::uint8_t too_short      = 1 << 0; // 11______ 0_______ or 11______ 11______
+    constexpr std::uint8_t too_long       = 1 << 1; // 0_______ 10______
+    constexpr std::uint8_t overlong_3     = 1 << 2; // 11100000 100_____
+    constexpr std::uint8_t too_large      = 1 << 3; // 11110100 1001____, 11110100 101_____, 11110101+ 1_______
+    constexpr std::uint8_t surrogate      = 1 << 4; // 11101101 101_____
+    constexpr std::uint8_t overlong_2     = 1 << 5; // 1100000_ 10______
+    constexpr std::uint8_t too_large_1000 = 1 << 6; // 11110101+ 1000____
+    constexpr std::uint8_t overlong_4     = 1 << 6; // 11110000 1000____
+    constexpr std::uint8_t two_conts      = 1 << 7; // 10______ 10______
+    constexpr std::uint8_t carry          = too_short | too_long | two_conts;
+
+    alignas(32) constexpr std::uint8_t byte_1_high[32] = {
+        // 0_______ ________ : ascii
+        too_long, too_long, too_long, too_long, too_long, too_long, too_long, too_long,
+        // 10______ ________ : continuation
+        two_conts, two_conts, two_conts, two_conts,
+        // 1100____ ________ : two byte lead
+        too_short | overlong_2,
+        // 1101____ ________ : two byte lead
+        too_short,
+        // 1110____ ________ : three byte lead
+        too_short | overlong_3 | surrogate,
+        // 1111____ ________ : four byte lead
+        too_short | too_large | too_large_1000 | overlong_4,
+
+        // repeated for the second lane of avx2
+        too_long, too_long, too_long, too_long, too_long, too_long, too_long, too_long,
+        two_conts, two_conts, two_conts, two_conts,
+        too_short | overlong_2,
+        too_short,
+        too_short | overlong_3 | surrogate,
+        too_short | too_large | too_large_1000 | overlong_4,
+    };
+
+    alignas(32) constexpr std::uint8_t byte_1_low[32] = {
+        carry | overlong_3 | overlong_2 | overlong_4,   // ____0000
+        carry | overlong_2,                             // ____0001
+        carry,                                          // ____001_
+        carry,
+        carry | too_large,                              // ____0100
+        carry | too_large | too_large_1000,             // ____0101
+        carry | too_large | too_large_1000,             // ____011_
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,             // ____1___
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000 | surrogate, // ____1101
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+
+        carry | overlong_3 | overlong_2 | overlong_4,
+        carry | overlong_2,
+        carry,
+        carry,
+        carry | too_large,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000 | surrogate,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+    };
+
+    alignas(32) constexpr std::uint8_t byte_2_high[32] = {
+        // ________ 0_______ : ascii
+        too_short, too_short, too_short, too_short, too_short, too_short, too_short, too_short,
+        // ________ 1000____
+        too_long | overlong_2 | two_conts | overlong_3 | too_large_1000 | overlong_4,
+        // ________ 1001____
+        too_long | overlong_2 | two_conts | overlong_3 | too_large,
+        // ________ 101_____
+        too_long | overlong_2 | two_conts | surrogate | too_large,
+        too_long | overlong_2 | two_conts | surrogate | too_large,
+        // ________ 11______
+        too_short, too_short, too_short, too_short,
+
+        too_short, too_short, too_short, too_short, too_short, too_short, too_short, too_short,
+        too_long | overlong_2 | two_conts | overlong_3 | too_large_1000 | overlong_4,
+        too_long | overlong_2 | two_conts | overlong_3 | too_large,
+        too_long | overlong_2 | two_conts | surrogate | too_large,
+        too_long | overlong_2 | two_conts | surrogate | too_large,
+        too_short, too_short, too_short, too_short,
+    };
+
+    // A block is incomplete if it ends inside a character: a lead byte in the last three
+    // positions which needs more bytes than remain. Bytes above these limits flag it.
+    alignas(32) constexpr std::uint8_t incomplete_limit[32] = {
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xEF, 0xDF, 0xBF,
+    };
+
+#ifdef WEBSERVER_UTF8_X86
+    /// Errors found so far, and the previous block, which the next block's checks look back into
+    struct sse4_state
+    {
+        __m128i error;
+        __m128i prev_input;
+        __m128i prev_incomplete;
+    };
+
+    __attribute__((target("ssse3,sse4.1"))) inline void
+    check_block_sse4(sse4_state& s, __m128i input)
+    {
+        if (_mm_movemask_epi8(input) == 0)
+        {
+            // all ascii: only a character left open by the previous block can be wrong
+            s.error = _mm_or_si128(s.error, s.prev_incomplete);
+            s.prev_input = input;
+            return;
+        }
+
+        auto const nibble = _mm_set1_epi8(0x0F);
+        auto const prev1 = _mm_alignr_epi8(input, s.prev_input, 15);
+        auto const prev2 = _mm_alignr_epi8(input, s.prev_input, 14);
+        auto const prev3 = _mm_alignr_epi8(input, s.prev_input, 13);
+
+        auto const b1h = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast< __m128i const* >(byte_1_high)),
+            _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+        auto const b1l = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast< __m128i const* >(byte_1_low)),
+            _mm_and_si128(prev1, nibble));
+        auto const b2h = _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast< __m128i const* >(byte_2_high)),
+            _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+        auto const special = _mm_and_si128(_mm_and_si128(b1h, b1l), b2h);
+
+        auto const must_continue = _mm_and_si128(
+            _mm_or_si128(
+                _mm_subs_epu8(prev2, _mm_set1_epi8(char(0xE0 - 0x80))), 
+                _mm_subs_epu8(prev3, _mm_set1_epi8(char(0xF0 - 0x80)))),
+            _mm_set1_epi8(char(0x80)));
+
+        s.error = _mm_or_si128(s.error, _mm_xor_si128(must_continue, special));
+        s.prev_incomplete = _mm_subs_epu8(input, 
+            _mm_loadu_si128(reinterpret_cast< __m128i const* >(incomplete_limit + 16)));
+        s.prev_input = input;
+    }
+
+    __attribute__((target("ssse3,sse4.1")))
+    bool
+    validate_blocks_sse4(std::uint8_t const* p, std::size_t n)
+    {
+        auto s = sse4_state();
+        s.error = s.prev_input = s.prev_incomplete = _mm_setzero_si128();
+        for (; n >= 16; p += 16, n -= 16)
+            check_block_sse4(s, _mm_loadu_si128(reinterpret_cast< __m128i const* >(p)));
+
+        if (n)
+        {
+            // padding with ascii catches a character cut short by the end of the string
+            alignas(16) std::uint8_t tail[16] = {};
+            std::memcpy(tail, p, n);
+            check_block_sse4(s, _mm_load_si128(reinterpret_cast< __m128i const* >(tail)));
+        }
+        s.error = _mm_or_si128(s.error, s.prev_incomplete);
+
+        return _mm_testz_si128(s.error, s.error);
+    }
+
+    struct avx2_state
+    {
+        __m256i error;
+        __m256i prev_input;
+        __m256i prev_incomplete;
+    };
+
+    __attribute__((target("avx2"))) inline void
+    check_block_avx2(avx2_state& s, __m256i input)
+    {
+        if (_mm256_movemask_epi8(input) == 0)
+        {
+            s.error = _mm256_or_si256(s.error, s.prev_incomplete);
+            s.prev_input = input;
+            return;
+        }
+
+        // alignr works within 128 bit lanes, so first line up the 16 bytes before each lane
+        auto const nibble = _mm256_set1_epi8(0x0F);
+        auto const shifted = _mm256_permute2x128_si256(s.prev_input, input, 0x21);
+        auto const prev1 = _mm256_alignr_epi8(input, shifted, 15);
+        auto const prev2 = _mm256_alignr_epi8(input, shifted, 14);
+        auto const prev3 = _mm256_alignr_epi8(input, shifted, 13);
+
+        auto const b1h = _mm256_shuffle_epi8(_mm256_load_si256(reinterpret_cast< __m256i const* >(byte_1_high)),
+            _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+        auto const b1l = _mm256_shuffle_epi8(_mm256_load_si256(reinterpret_cast< __m256i const* >(byte_1_low)),
+            _mm256_and_si256(prev1, nibble));
+        auto const b2h = _mm256_shuffle_epi8(_mm256_load_si256(reinterpret_cast< __m256i const* >(byte_2_high)),
+            _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+        auto const special = _mm256_and_si256(_mm256_and_si256(b1h, b1l), b2h);
+
+        auto const must_continue = _mm256_and_si256(
+            _mm256_or_si256(
+                _mm256_subs_epu8(prev2, _mm256_set1_epi8(char(0xE0 - 0x80))), 
+                _mm256_subs_epu8(prev3, _mm256_set1_epi8(char(0xF0 - 0x80)))),
+            _mm256_set1_epi8(char(0x80)));
+
+        s.error = _mm256_or_si256(s.error, _mm256_xor_si256(must_continue, special));
+        s.prev_incomplete = _mm256_subs_epu8(input, 
+            _mm256_load_si256(reinterpret_cast< __m256i const* >(incomplete_limit)));
+        s.prev_input = input;
+    }
+
+    __attribute__((target("avx2")))
+    bool
+    validate_blocks_avx2(std::uint8_t const* p, std::size_t n)
+    {
+        auto s = avx2_state();
+        s.error = s.prev_input = s.prev_incomplete = _mm256_setzero_si256();
+        for (; n >= 32; p += 32, n -= 32)
+            check_block_avx2(s, _mm256_loadu_si256(reinterpret_cast< __m256i const* >(p)));
+
+        if (n)
+        {
+            alignas(32) std::uint8_t tail[32] = {};
+            std::memcpy(tail, p, n);
+            check_block_avx2(s, _mm256_load_si256(reinterpret_cast< __m256i const* >(tail)));
+        }
+        s.error = _mm256_or_si256(s.error, s.prev_incomplete);
+
+        return _mm256_testz_si256(s.error, s.error);
+    }
+#endif
+
+    using validate_fn = bool (*)(std::uint8_t const*, std::size_t);
+
+    /// The fastest implementation this cpu supports, chosen on first use
+    struct dispatch
+    {
+        validate_fn validate = utf8_detail::validate_scalar;
+        const char* name = "scalar";
+
+        dispatch()
+        {
+            if (utf8_detail::have_avx2())
+            {
+                validate = utf8_detail::validate_avx2;
+                name = "avx2";
+            }
+            else if (utf8_detail::have_sse4())
+            {
+                validate = utf8_detail::validate_sse4;
+                name = "sse4.1";
+            }
+        }
+    };
+
+    dispatch const&
+    best()
+    {
+        static const dispatch d;
+        return d;
+    }
+
+    /// Shorter than this, a write is checked byte by byte rather than paying for the block setup
+    constexpr std::size_t min_block_write = 64;
+}
+
+namespace utf8_detail
+{
+    bool
+    validate_scalar(std::uint8_t const* p, std::size_t n)
+    {
+        auto v = utf8_validator();
+        return v.write_scalar(p, n) && v.finish();
+    }
+
+#ifdef WEBSERVER_UTF8_X86
+    bool
+    validate_sse4(std::uint8_t const* p, std::size_t n)
+    {
+        return validate_blocks_sse4(p, n);
+    }
+
+    bool
+    validate_avx2(std::uint8_t const* p, std::size_t n)
+    {
+        return validate_blocks_avx2(p, n);
+    }
+
+    bool
+    have_sse4()
+    {
+        return __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1");
+    }
+
+    bool
+    have_avx2()
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+#else
+    bool
+    validate_sse4(std::uint8_t const* p, std::size_t n)
+    {
+        return validate_scalar(p, n);
+    }
+
+    bool
+    validate_avx2(std::uint8_t const* p, std::size_t n)
+    {
+        return validate_scalar(p, n);
+    }
+
+    bool
+    have_sse4()
+    {
+        return false;
+    }
+
+    bool
+    have_avx2()
+    {
+        return false;
+    }
+#endif
+}
+
+bool
+is_valid_utf8(void const* data, std::size_t size)
+{
+    return best().validate(static_cast< std::uint8_t const* >(data), size);
+}
+
+const char*
+utf8_validator::implementation()
+{
+    return best().name;
+}
+
+bool
+utf8_validator::write(void const* data, std::size_t size)
+{
+    auto p = static_cast< std::uint8_t const* >(data);
+    if (failed_)
+        return false;
+
+    // finish a character left open by the previous write
+    while (need_ && size)
+    {
+        if (!write_scalar(p, 1))
+            return false;
+        ++p;
+        --size;
+    }
+
+    if (size >= min_block_write && best().validate != utf8_detail::validate_scalar)
+    {
+        // The blocks take everything up to the start of the last character, which may be cut
+        // short by the end of this write. If the input is valid, both parts are valid on their
+        // own; if either part is invalid, so is the input.
+        auto split = size - 1;
+        for (int i = 0; i < 3 && split > 0 && (p[split] & 0xC0) == 0x80; ++i)
+            --split;
+
+        if (!best().validate(p, split))
+        {
+            failed_ = true;
+            return false;
+        }
+        p += split;
+        size -= split;
+    }
+
+    return write_scalar(p, size);
+}
+
+bool
+utf8_validator::write_scalar(std::uint8_t const* p, std::size_t n)
+{
+    auto const end = p + n;
+    while (p != end)
+    {
+        if (need_ == 0)
+        {
+            // skip ascii eight bytes at a time
+            while (end - p >= 8)
+            {
+                std::uint64_t word;
+                std::memcpy(&word, p, 8);
+                if (word & 0x8080808080808080ull)
+                    break;
+                p += 8;
+            }
+            if (p == end)
+                break;
+
+            auto const c = *p++;
+            if (c < 0x80)
+                continue;
+            else if (c < 0xC2)
+                failed_ = true;
+            else if (c < 0xE0)
+            {
+                need_ = 1;
+                lower_ = 0x80;
+                upper_ = 0xBF;
+            }
+            else if (c < 0xF0)
+            {
+                need_ = 2;
+                lower_ = c == 0xE0 ? 0xA0 : 0x80;
+                upper_ = c == 0xED ? 0x9F : 0xBF;
+            }
+            else if (c < 0xF5)
+            {
+                need_ = 3;
+                lower_ = c == 0xF0 ? 0x90 : 0x80;
+                upper_ = c == 0xF4 ? 0x8F : 0xBF;
+            }
+            else
+                failed_ = true;
+        }
+        else
+        {
+            auto const c = *p++;
+            if (c < lower_ || c > upper_)
+                failed_ = true;
+            --need_;
+            lower_ = 0x80;
+            upper_ = 0xBF;
+        }
+
+        if (failed_)
+            return false;
+    }
+    return true;
+}
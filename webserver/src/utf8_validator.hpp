@@ -0,0 +1,82 @@
+#ifndef WEBSERVER_UTF8_VALIDATOR_HPP
+#define WEBSERVER_UTF8_VALIDATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace utf8_detail
+{
+    bool
+    validate_scalar(std::uint8_t const* p, std::size_t n);
+}
+
+/// Incremental UTF-8 validator for websocket text messages, which may arrive in fragments split
+/// anywhere, including inside a character.
+/// Whole blocks are checked with AVX2 or SSE4.1 where the cpu has them, chosen once at run
+/// time, and with a scalar state machine otherwise. Only the few bytes of a character split
+/// across two writes, and the tail of each write, are checked byte by byte.
+/// Rejects overlong forms, surrogates and code points above U+10FFFF, as RFC 3629 requires.
+struct utf8_validator
+{
+    /// Check the next part of a message.
+    /// @return false if the message so far is not valid UTF-8. Once false, always false until reset().
+    bool
+    write(void const* data, std::size_t size);
+
+    /// @return true if everything written is valid UTF-8 and does not end inside a character.
+    bool
+    finish() const
+    {
+        return !failed_ && need_ == 0;
+    }
+
+    /// Prepare to check a new message.
+    void
+    reset()
+    {
+        *this = utf8_validator();
+    }
+
+    /// The name of the block implementation chosen for this cpu: "avx2", "sse4.1" or "scalar"
+    static const char*
+    implementation();
+
+private:
+    friend bool utf8_detail::validate_scalar(std::uint8_t const* p, std::size_t n);
+
+    /// Check bytes one at a time, carrying the state of a partial character between calls.
+    bool
+    write_scalar(std::uint8_t const* p, std::size_t n);
+
+    std::uint8_t need_ = 0;     // continuation bytes still to come
+    std::uint8_t lower_ = 0x80; // bounds of the next continuation byte
+    std::uint8_t upper_ = 0xBF;
+    bool failed_ = false;
+};
+
+/// Check a complete string with the best implementation for this cpu.
+bool
+is_valid_utf8(void const* data, std::size_t size);
+
+/// The individual implementations, for benchmarks. Each checks a complete string.
+namespace utf8_detail
+{
+    bool
+    validate_scalar(std::uint8_t const* p, std::size_t n);
+
+    /// @pre have_sse4()
+    bool
+    validate_sse4(std::uint8_t const* p, std::size_t n);
+
+    /// @pre have_avx2()
+    bool
+    validate_avx2(std::uint8_t const* p, std::size_t n);
+
+    bool
+    have_sse4();
+
+    bool
+    have_avx2();
+}
+
+#endif
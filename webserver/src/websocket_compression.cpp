@@ -0,0 +1,69 @@
+#include "websocket_compression.hpp"
+
+#include <algorithm>
+
+std::atomic< std::size_t > compression_memory::in_use_ { 0 };
+
+bool
+compression_memory::reserve(std::size_t bytes, std::size_t limit)
+{
+    auto current = in_use_.load(std::memory_order_relaxed);
+    do
+    {
+        if (current + bytes > limit)
+            return false;
+    } while (!in_use_.compare_exchange_weak(current, current + bytes, std::memory_order_relaxed));
+    return true;
+}
+
+void
+compression_memory::release(std::size_t bytes)
+{
+    in_use_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+std::size_t
+compression_memory::in_use()
+{
+    return in_use_.load(std::memory_order_relaxed);
+}
+
+std::size_t
+compression_memory_estimate(compression_options const& options)
+{
+    auto const wbits  = std::clamp(options.window_bits, 9, 15);
+    auto const mlevel = std::clamp(options.mem_level, 1, 9);
+
+    auto const deflate = (std::size_t(1) << (wbits + 2)) + (std::size_t(1) << (mlevel + 9));
+    auto const inflate = (std::size_t(1) << wbits) + 7 * 1024;
+    return deflate + inflate;
+}
+
+beast::websocket::permessage_deflate
+make_permessage_deflate(compression_options const& options)
+{
+    auto pmd = beast::websocket::permessage_deflate();
+    pmd.server_enable              = options.enabled;
+    pmd.server_max_window_bits     = std::clamp(options.window_bits, 9, 15);
+    pmd.client_max_window_bits     = std::clamp(options.window_bits, 9, 15);
+    pmd.server_no_context_takeover = !options.context_takeover;
+    pmd.client_no_context_takeover = !options.context_takeover;
+    pmd.compLevel                  = std::clamp(options.level, 0, 9);
+    pmd.memLevel                   = std::clamp(options.mem_level, 1, 9);
+
+    // msg_size_threshold is only present in newer versions of Beast
+    [](auto& p, std::size_t threshold)
+    {
+        if constexpr (requires { p.msg_size_threshold; })
+            p.msg_size_threshold = threshold;
+    }(pmd, options.min_message_size);
+
+    return pmd;
+}
+
+bool
+offers_permessage_deflate(beast::http::request< beast::http::string_body > const& request)
+{
+    auto ext = request[beast::http::field::sec_websocket_extensions];
+    return ext.find("permessage-deflate") != beast::string_view::npos;
+}
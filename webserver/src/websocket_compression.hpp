@@ -0,0 +1,71 @@
+#ifndef WEBSERVER_WEBSOCKET_COMPRESSION_HPP
+#define WEBSERVER_WEBSOCKET_COMPRESSION_HPP
+
+#include "beast.hpp"
+
+#include <boost/beast/http.hpp>
+
+#include <atomic>
+#include <cstddef>
+
+/// Settings for permessage-deflate on accepted websockets.
+struct compression_options
+{
+    /// Offer permessage-deflate to clients which ask for it
+    bool enabled = true;
+
+    /// Maximum LZ77 window size, as a power of two. 9 to 15.
+    int window_bits = 15;
+
+    /// Cap on zlib's memLevel, which sizes the deflate hash table. 1 to 9.
+    int mem_level = 8;
+
+    /// zlib compression level. 0 to 9.
+    int level = 6;
+
+    /// Messages shorter than this are sent uncompressed
+    std::size_t min_message_size = 64;
+
+    /// Keep the compression context between messages. Better ratios, but the
+    /// memory stays allocated for the life of the connection.
+    bool context_takeover = true;
+
+    /// Upper bound on the total zlib memory of all compressed websockets. Once reached,
+    /// further websockets are accepted without compression.
+    std::size_t global_memory_limit = std::size_t(1) << 30;
+};
+
+/// Process-wide accounting of the memory held by websocket compression contexts.
+struct compression_memory
+{
+    /// Try to reserve memory against a limit.
+    /// @return true if the reservation fits, in which case it must later be released.
+    static bool
+    reserve(std::size_t bytes, std::size_t limit);
+
+    static void
+    release(std::size_t bytes);
+
+    /// Bytes currently reserved by all websockets
+    static std::size_t
+    in_use();
+
+private:
+    static std::atomic< std::size_t > in_use_;
+};
+
+/// Estimate the zlib memory used by one compressed server-side websocket: a deflate stream
+/// of (1 << (window_bits + 2)) + (1 << (mem_level + 9)) bytes, and an inflate stream sized by
+/// the window plus a fixed overhead.
+std::size_t
+compression_memory_estimate(compression_options const& options);
+
+/// Build Beast's permessage-deflate option for a server from our settings.
+beast::websocket::permessage_deflate
+make_permessage_deflate(compression_options const& options);
+
+/// Whether a client's upgrade request offers permessage-deflate.
+bool
+offers_permessage_deflate(beast::http::request< beast::http::string_body > const& request);
+
+#endif
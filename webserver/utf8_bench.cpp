@@ -0,0 +1,96 @@
+#include "utf8_validator.hpp"
+
+#include <boost/beast/websocket/detail/utf8_checker.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Compare UTF-8 validation throughput on websocket text payloads: beast's own checker, which
+// is what every text frame went through, against utf8_validator's implementations.
+// Each is run over 1 MiB of ascii and of mixed text (latin, greek, cjk and emoji), whole and,
+// for the incremental validator, in 4 KiB fragments as they would arrive off the wire.
+
+using namespace std::literals;
+using clock_type = std::chrono::steady_clock;
+
+constexpr std::size_t payload_size = 1 << 20;
+
+std::string
+make_payload(std::string_view pattern)
+{
+    auto s = std::string();
+    while (s.size() + pattern.size() <= payload_size)
+        s += pattern;
+    return s;
+}
+
+/// Run check over the payload until half a second has passed.
+/// @return GB/s
+template < class Check >
+double
+measure(std::string const& payload, Check check)
+{
+    auto const data = reinterpret_cast< std::uint8_t const* >(payload.data());
+    auto bytes = std::uint64_t(0);
+    auto valid = true;
+    auto const start = clock_type::now();
+    auto elapsed = clock_type::duration();
+    do
+    {
+        for (int i = 0; i < 16; ++i)
+        {
+            valid = check(data, payload.size()) && valid;
+            bytes += payload.size();
+        }
+        elapsed = clock_type::now() - start;
+    } while (elapsed < 500ms);
+
+    if (!valid)
+        throw std::logic_error("benchmark payload rejected");
+    return double(bytes) / std::chrono::duration< double >(elapsed).count() / 1e9;
+}
+
+void
+run(std::string_view name, std::string const& payload)
+{
+    auto row = [&](std::string_view impl, double gbps)
+    {
+        std::cout << std::left << std::setw(8) << name << std::setw(24) << impl << std::right
+                  << std::fixed << std::setprecision(2) << std::setw(8) << gbps << " GB/s\n";
+    };
+
+    row("beast utf8_checker", measure(payload, [](std::uint8_t const* p, std::size_t n)
+    {
+        auto checker = boost::beast::websocket::detail::utf8_checker();
+        checker.reset();
+        return checker.write(p, n) && checker.finish();
+    }));
+
+    row("scalar", measure(payload, utf8_detail::validate_scalar));
+    if (utf8_detail::have_sse4())
+        row("sse4.1", measure(payload, utf8_detail::validate_sse4));
+    if (utf8_detail::have_avx2())
+        row("avx2", measure(payload, utf8_detail::validate_avx2));
+
+    row("utf8_validator, 4 KiB", measure(payload, [](std::uint8_t const* p, std::size_t n)
+    {
+        auto v = utf8_validator();
+        for (std::size_t pos = 0; pos < n; pos += 4096)
+            v.write(p + pos, std::min< std::size_t >(4096, n - pos));
+        return v.finish();
+    }));
+}
+
+int
+main()
+{
+    std::cout << "dispatched implementation: " << utf8_validator::implementation() << '\n';
+    run("ascii", make_payload("{\"id\":12345,\"name\":\"websocket client\",\"tags\":[\"a\",\"b\"]}\n"));
+    run("mixed", make_payload("caf\xC3\xA9 \xCE\xB1\xCE\xB2\xCE\xB3 \xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E "
+                              "\xF0\x9F\x98\x80 plain ascii text between them\n"));
+}
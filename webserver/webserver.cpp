@@ -1,130 +1,127 @@
 #include "program_stop_source.hpp"
 #include "program_stop_sink.hpp"
 #include "any_websocket.hpp"
+#include "io_context_pool.hpp"
+#include "mime_type.hpp"
+#include "corked_stream.hpp"
+#include "send_file.hpp"
+#include "static_file_cache.hpp"
+#include "router.hpp"
+#include "broadcast_hub.hpp"
+#include "object_id.hpp"
+#include "logger.hpp"
+#include "tls_session_cache.hpp"
+#include "ktls_stream.hpp"
+#include "recycling_allocator.hpp"
+#include "timer_wheel.hpp"
+#include "connection_limiter.hpp"
+#include "metrics.hpp"
+#include "listener_handoff.hpp"
+#include "response_template.hpp"
 
 #include "asio.hpp"
 #include "signal.hpp"
 
 #include <boost/beast.hpp>
-#include <boost/mp11/tuple.hpp>
 
+#include <array>
+#include <atomic>
 #include <iostream>
 #include <iomanip>
+#include <limits>
 #include <string_view>
-#include <regex>
 #include <functional>
+#include <charconv>
+#include <cstdlib>
+#include <new>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace beast  = boost::beast;
 
 using namespace std::literals;
 
-template<asio::cancellation_type Test>
-bool cancel_check(asio::cancellation_type in)
+// Every allocation in the server goes through the recycling allocator. This is how coroutine
+// frames reach it: asio::awaitable's promise type, which we cannot replace, allocates its
+// frames with the global operator new once asio's own single-frame cache is occupied.
+
+void*
+operator new(std::size_t size)
 {
-    return (in & Test) != asio::cancellation_type::none;
+    return recycling_allocator::allocate(size);
 }
 
-template<class T, class = void>
-struct emitter
+void*
+operator new[](std::size_t size)
 {
-    void operator()(std::ostream& os) const
-    {
-        os << arg;
-    }
-
-    T& arg;
-};
-
-template<class T>
-emitter(T&) -> emitter<T>;
-
-template<class T>
-std::ostream&
-operator<<(std::ostream& os, emitter<T> const& e)
-{
-    e(os);
-    return os;
-}
-
-template<class T>
-struct emitter <
-    T, 
-    std::enable_if_t<
-        std::is_same_v<
-            std::decay_t<T>, 
-            asio::ip::tcp::socket
-        > ||
-        std::is_same_v<
-            std::decay_t<T>,
-            asio::basic_stream_socket<asio::ip::tcp>
-        >
-    >
->
-{
-    void operator()(std::ostream& os) const
-    {
-        auto ec = error_code();
-        auto ep = arg.remote_endpoint(ec);
-        if (ec)
-            os << "unconnected";
-        else
-            os << arg.remote_endpoint();
-    }
+    return recycling_allocator::allocate(size);
+}
 
-    T& arg;
-};
+void*
+operator new(std::size_t size, std::nothrow_t const&) noexcept
+try
+{
+    return recycling_allocator::allocate(size);
+}
+catch(std::bad_alloc&)
+{
+    return nullptr;
+}
 
-template<class T>
-auto emit(T& x, std::ostream& os = std::cout)
+void*
+operator new[](std::size_t size, std::nothrow_t const&) noexcept
+try
 {
-    os << emitter<T>{ x };
+    return recycling_allocator::allocate(size);
+}
+catch(std::bad_alloc&)
+{
+    return nullptr;
 }
 
-template<class...Params>
-struct object_id
+void
+operator delete(void* p) noexcept
 {
-    object_id(std::string_view name_, Params&...params_)
-    : name { name_ }
-    , params { params_ ... }
-    {
-    }
+    recycling_allocator::deallocate(p);
+}
 
-    friend 
-    std::ostream&
-    operator << (std::ostream& os, object_id const& oid) 
-    {
-        os << oid.name;
-        if constexpr (sizeof...(Params) > 0)
-        {
-            const char* sep = "[";
-            boost::mp11::tuple_for_each(oid.params, 
-                [&os, &sep](auto&& x)
-            {
-                os << sep;
-                sep = ", ";
-                emit(x, os);
-            });
-            os << ']';
-        }
-        os << " : ";
+void
+operator delete[](void* p) noexcept
+{
+    recycling_allocator::deallocate(p);
+}
 
-        return os;
-    }
+void
+operator delete(void* p, std::size_t) noexcept
+{
+    recycling_allocator::deallocate(p);
+}
 
-    std::string_view name;
-    std::tuple<Params&...> params;
-};
+void
+operator delete[](void* p, std::size_t) noexcept
+{
+    recycling_allocator::deallocate(p);
+}
 
+/// Set once the listening sockets have been handed to a successor, after which http
+/// connections are closed as soon as their current request is answered.
+std::atomic< bool > draining { false };
 
-template<class...Params>
-object_id(std::string_view, Params&...) -> object_id<Params...>;
+/// Implementation of the websocket protocol for upgraded connections, set once at startup
+websocket_codec websock_codec = websocket_codec::beast;
 
+template<asio::cancellation_type Test>
+bool cancel_check(asio::cancellation_type in)
+{
+    return (in & Test) != asio::cancellation_type::none;
+}
 
 template<class...Contexts>
 void
 report(std::exception const& e, std::string_view location, Contexts&&...contexts)
 {
-    std::cerr << object_id(location, contexts...) << " : " << e.what() << '\n';
+    log_error(object_id(location, contexts...), e.what());
 }
 
 
@@ -155,10 +152,9 @@ catch(std::exception& e)
 }
 
 asio::awaitable<void> 
-timeout(asio::steady_timer& timer, std::chrono::milliseconds duration)
+timeout(timer_wheel& wheel, std::chrono::milliseconds duration)
 {
-    timer.expires_after(duration);
-    co_await timer.async_wait(asio::use_awaitable);
+    co_await wheel.async_wait(duration, asio::use_awaitable);
 }
 
 template<class Stream>
@@ -185,17 +181,43 @@ read_header_only(Stream& stream,
             asio::use_awaitable);
 }
 
+/// Read some of a request body, to the buffer the parser's body refers to.
+/// @return the error, if any, since need_buffer is expected whenever the buffer fills.
+template<class Stream>
+asio::awaitable<error_code>
+read_body_some(Stream& stream, 
+    beast::flat_buffer& rx_buffer, 
+    beast::http::request_parser<beast::http::buffer_body>& parser)
+{
+    // as read_header_only
+    if (auto cslot = (co_await asio::this_coro::cancellation_state).slot() ; cslot.is_connected())
+    {
+        cslot.assign([&](asio::cancellation_type type) 
+        {
+            if (cancel_check<asio::cancellation_type::terminal>(type))
+                beast::get_lowest_layer(stream).close(); 
+        });
+    }
+
+    auto [ec, n] = co_await
+        beast::http::async_read_some(stream, 
+            rx_buffer, 
+            parser, 
+            asioex::as_tuple(asio::use_awaitable));
+    co_return ec;
+}
+
 asio::awaitable<void>
 delay(std::chrono::milliseconds dur)
 {
-    auto t = asio::steady_timer(co_await asio::this_coro::executor, dur);
-    co_await t.async_wait(asio::use_awaitable);
+    auto& wheel = timer_wheel::of(co_await asio::this_coro::executor);
+    co_await wheel.async_wait(dur, asio::use_awaitable);
 }
 
 asio::awaitable<void>
 write_and_close(std::shared_ptr<any_websocket> ws, std::string s)
 {
-    co_await ws->write(s);
+    co_await ws->write(std::move(s));
     co_await delay(5s);
     co_await ws->close();
 }
@@ -226,57 +248,298 @@ catch(std::exception& e)
     auto ec = error_code();
     auto ep = s.remote_endpoint(ec);
     if (ec)
-        std::cout << object_id(__func__, ec) << "read error: " << e.what() << '\n';
+        log_info(object_id(__func__, ec), "read error: ", e.what());
     else
-        std::cout << object_id(__func__, ep) << "read error: " << e.what() << '\n';
+        log_info(object_id(__func__, ep), "read error: ", e.what());
 throw;    
 }
 
+/// A broadcast hub for each io_context. A hub is only touched on its own io_context's thread.
+struct thread_hub
+{
+    asio::any_io_executor exec;
+    broadcast_hub hub;
+};
+
+/// Every thread's hub. Populated before the io_contexts start running.
+std::vector< std::unique_ptr< thread_hub > > all_hubs;
+
+/// The hub of the io_context running on this thread.
+thread_local thread_hub* this_thread_hub = nullptr;
+
+/// Publish a payload to the subscribers of a topic on every thread.
+/// The payload is shared between all threads' subscribers, not copied.
+void
+publish(std::string_view topic, shared_payload const& payload, frame_type type)
+{
+    for (auto& h : all_hubs)
+    {
+        if (h.get() == this_thread_hub)
+            h->hub.publish(topic, payload, type);
+        else
+            asio::post(h->exec, [h = h.get(), topic = std::string(topic), payload, type]
+            {
+                h->hub.publish(topic, payload, type);
+            });
+    }
+}
+
+/// Websocket application which joins the connection to a topic. Every message received
+/// is published to all members of the topic, including the sender.
+asio::awaitable<void>
+topic_websock_app(std::shared_ptr<any_websocket> ws, 
+    beast::http::request<beast::http::string_body>& request,
+    route_params const& params)
+try
+{
+    // a dedicated writer means publishing to this socket never has to start a coroutine.
+    // It is queued to start before subscribing, so that publishes find it waiting, rather
+    // than each start a flush of their own.
+    asio::co_spawn(co_await asio::this_coro::executor, 
+        run_writer(ws), 
+        asio::detached);
+
+    auto const topic = std::string(params["topic"]);
+    auto subscription = this_thread_hub->hub.subscribe(topic, ws);
+
+    for(;;)
+    {
+        auto frame = co_await ws->read();
+        publish(topic, 
+            shared_payload(frame.as_string()), 
+            frame.is_binary() ? frame_type::binary : frame_type::text);
+    }
+}
+catch(std::exception& e)
+{
+    auto& s = ws->socket();
+    auto ec = error_code();
+    auto ep = s.remote_endpoint(ec);
+    if (ec)
+        log_info(object_id(__func__, ec), "read error: ", e.what());
+    else
+        log_info(object_id(__func__, ep), "read error: ", e.what());
+}
+
+/// Websocket application which sends every message straight back to the sender.
+asio::awaitable<void>
+echo_websock_app(std::shared_ptr<any_websocket> ws, 
+    beast::http::request<beast::http::string_body>& request,
+    route_params const& params)
+try
+{
+    for(;;)
+    {
+        auto frame = co_await ws->read();
+        co_await ws->write(
+            shared_payload(frame.as_string()), 
+            frame.is_binary() ? frame_type::binary : frame_type::text);
+    }
+}
+catch(std::exception& e)
+{
+    log_debug(object_id(__func__), "read error: ", e.what());
+}
 
+/// The stream an http handler writes its response to. Each is a corked layer over the
+/// connection, so that the responses to pipelined requests can be sent together.
 using var_stream_ptr = 
     boost::variant2::variant <
-        asio::ip::tcp::socket*, 
-        asio::ssl::stream<asio::ip::tcp::socket>*
+        corked_stream<asio::ip::tcp::socket&>*, 
+        corked_stream<asio::ssl::stream<asio::ip::tcp::socket>&>*,
+        corked_stream<ktls_stream&>*
     >;
 
+/// Reads the body of a request as it arrives, one chunk at a time, so that a body of any size
+/// is handled in constant memory and a handler can start work before the last byte arrives.
+struct request_body_reader
+{
+    /// Size of the buffer each chunk is read into
+    static constexpr std::size_t chunk_size = 16 * 1024;
+
+    /// Longest wait for more of the body, after which the connection is dropped
+    static constexpr std::chrono::seconds read_timeout { 30 };
+
+    using request_type = beast::http::request<beast::http::buffer_body>;
+
+    /// Take over a parser which has read a request header, but none of its body.
+    request_body_reader(beast::http::request_parser<beast::http::string_body>&& header_parser,
+        var_stream_ptr stream,
+        beast::flat_buffer& rxbuffer);
+
+    /// The request. Its header is complete. Its body is read with read_some().
+    request_type const&
+    request() const { return parser_.get(); }
+
+    /// Coroutine to read the next chunk of the body. Before the first, sends 100 Continue
+    /// if the request expects it.
+    /// @return the chunk, which is valid until the next call, or an empty buffer once the whole
+    /// body has been read.
+    /// @throw system_error if the connection fails, no more of the body arrives within
+    /// read_timeout, or the body is malformed.
+    asio::awaitable<asio::const_buffer>
+    read_some();
+
+    /// @return true once the whole body has been read.
+    bool
+    done() const { return parser_.is_done(); }
+
+    /// Number of body bytes read so far
+    std::uint64_t
+    bytes_read() const { return bytes_read_; }
+
+private:
+    beast::http::request_parser<beast::http::buffer_body> parser_;
+    var_stream_ptr stream_;
+    beast::flat_buffer& rxbuffer_;
+    std::uint64_t bytes_read_ = 0;
+
+    /// allocated on the first read of a body, so that requests without one cost nothing
+    std::unique_ptr<char[]> chunk_;
+};
+
+request_body_reader::request_body_reader(
+    beast::http::request_parser<beast::http::string_body>&& header_parser,
+    var_stream_ptr stream,
+    beast::flat_buffer& rxbuffer)
+: parser_(std::move(header_parser))
+, stream_(stream)
+, rxbuffer_(rxbuffer)
+{
+    // memory use no longer depends on the size of the body, so neither does the limit
+    parser_.body_limit(std::numeric_limits<std::uint64_t>::max());
+}
+
+asio::awaitable<asio::const_buffer>
+request_body_reader::read_some()
+{
+    using namespace asioex::awaitable_operators;
+
+    if (parser_.is_done())
+        co_return asio::const_buffer();
+
+    if (!chunk_)
+    {
+        chunk_ = std::make_unique<char[]>(chunk_size);
+
+        // beast reads no more than the buffer's spare capacity, so make room for a whole chunk
+        rxbuffer_.reserve(chunk_size);
+
+        // A client which sent Expect: 100-continue waits to be told to send the body. The
+        // corked layer sends the interim response before the read below.
+        auto const& request = parser_.get();
+        if (request.version() >= 11 && beast::iequals(request[beast::http::field::expect], "100-continue"))
+        {
+            static constexpr std::string_view interim = "HTTP/1.1 100 Continue\r\n\r\n";
+            co_await visit([](auto* pstream) {
+                // never freed, so the corked layer need not copy it
+                pstream->hold(asio::buffer(interim));
+                return asio::async_write(*pstream, asio::buffer(interim), asio::use_awaitable);
+            }, stream_);
+        }
+    }
+
+    auto& body = parser_.get().body();
+    auto& wheel = timer_wheel::of(co_await asio::this_coro::executor);
+
+    // a read may parse only chunk framing, so carry on until some body arrives
+    while (!parser_.is_done())
+    {
+        body.data = chunk_.get();
+        body.size = chunk_size;
+
+        auto which = co_await visit([this, &wheel](auto* pstream) {
+            return read_body_some(*pstream, rxbuffer_, parser_) || timeout(wheel, read_timeout);
+        }, stream_);
+
+        if (which.index() == 1)
+            throw system_error(asio::error::timed_out);
+
+        // need_buffer only means that the chunk is full
+        auto const ec = std::get<0>(which);
+        if (ec && ec != beast::http::error::need_buffer)
+            throw system_error(ec);
+
+        auto const size = chunk_size - body.size;
+        if (size)
+        {
+            bytes_read_ += size;
+            co_return asio::const_buffer(chunk_.get(), size);
+        }
+    }
+
+    co_return asio::const_buffer();
+}
+
 using http_handler_sig = 
     asio::awaitable<void>
-        (beast::http::request_parser<beast::http::string_body>& parser, 
+        (request_body_reader& body, 
          var_stream_ptr stream, 
-         beast::flat_buffer& rxbuffer);
+         route_params const& params);
 
-using http_handler_element = 
-    std::tuple < 
-        std::regex, 
-        std::function<http_handler_sig> 
-    >;
+using http_router = router< std::function<http_handler_sig> >;
+
+using websocket_generator_sig = 
+    asio::awaitable<void>
+        (std::shared_ptr<any_websocket> ws, 
+         beast::http::request<beast::http::string_body>& request,
+         route_params const& params);
+
+using websocket_router = router< std::function<websocket_generator_sig> >;
+
+/// Directory from which /file/ requests are served. Taken from the WEBSERVER_DOCROOT environment
+/// variable, or the current directory if it is not set.
+std::string const&
+document_root()
+{
+    static const std::string root = []
+    {
+        auto env = std::getenv("WEBSERVER_DOCROOT");
+        return std::string(env ? env : ".");
+    }();
+    return root;
+}
+
+/// Cache of small files served from document_root(), shared by every io thread.
+static_file_cache&
+file_cache()
+{
+    static auto cache = static_file_cache(64 * 1024 * 1024, 1024 * 1024);
+    return cache;
+}
 
 asio::awaitable<void>
 send_file_error(var_stream_ptr stream, 
-    beast::flat_buffer& rxbuffer,
+    request_body_reader::request_type const& request,
+    beast::http::status status,
     std::string message)
 {
-    auto resp = beast::http::response<beast::http::string_body>();
-    resp.
+    message += '\n';
+    auto const out = response_buffers(common_response(status), request, message);
+
+    co_await visit([&out](auto* pstream) {
+        // common templates are never freed, so the corked layer need not copy them
+        pstream->hold(out.head());
+        return asio::async_write(*pstream, out.data(), asio::use_awaitable);
+    }, stream);
 }
 
 asio::awaitable<void>
 handle_http_file(
-    beast::http::request_parser<beast::http::string_body>& parser, 
+    request_body_reader& body, 
     var_stream_ptr stream, 
-    beast::flat_buffer& rxbuffer)
+    route_params const& params)
 {
-    auto& request = parser.get();
+    auto& request = body.request();
+    auto status = beast::http::status::bad_request;
+    auto error_message = std::string();
+    auto path = std::string_view();
+    auto file = beast::file();
+    std::uint64_t size = 0;
+    auto cached = static_file_cache::entry_ptr();
     try
     {
-        auto target = request.target();
-        std::smatch match;
-        static const auto re = std::regex("/*file(/[^?]*)(.*)");
-        auto matches = std::regex_match(match, std::begin(target), std::end(target), re);
-        if (!matches)
-            throw std::invalid_argument("invalid file format");
-
-        auto& path = match[1];
+        path = params["path"];
 
         static const std::string_view illegal_sequences[] = {
             "..",
@@ -284,7 +547,7 @@ handle_http_file(
         };
         for(auto illegal_sequence : illegal_sequences)
         {
-            if(std::search(std::begin(path), std::end(path), std::begin(illegal_sequence), std::end(illegal_sequence)))
+            if(path.find(illegal_sequence) != std::string_view::npos)
             {
                 std::ostringstream ss;
                 ss << "Illegal use of " << illegal_sequence << " in path name";
@@ -292,70 +555,117 @@ handle_http_file(
             }
         }
 
-        if (request.method() == http::verb::get)
+        if (request.method() == beast::http::verb::get)
         {
+            auto full_path = document_root();
+            full_path += '/';
+            full_path.append(path.begin(), path.end());
 
+            // the cached headers assume a persistent HTTP/1.1 connection
+            if (request.version() == 11 && request.keep_alive())
+                cached = file_cache().lookup(path, full_path);
+
+            if (!cached)
+            {
+                // O_NONBLOCK, so that opening a fifo does not wait for a writer on the io thread.
+                // It makes no difference to reads of a regular file.
+                auto const fd = ::open(full_path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+                if (fd < 0)
+                {
+                    status = beast::http::status::not_found;
+                    throw std::invalid_argument("File not found");
+                }
+                file.native_handle(fd);
+
+                // a directory opens, but sendfile(2) would fail once the header is sent
+                struct stat st;
+                if (::fstat(fd, &st) < 0)
+                    throw system_error(error_code(errno, asio::error::get_system_category()));
+                if (S_ISDIR(st.st_mode))
+                {
+                    status = beast::http::status::not_found;
+                    throw std::invalid_argument("File not found");
+                }
+                if (!S_ISREG(st.st_mode))
+                {
+                    status = beast::http::status::forbidden;
+                    throw std::invalid_argument("Not a regular file");
+                }
+                size = static_cast<std::uint64_t>(st.st_size);
+            }
         } 
         else
         {
+            status = beast::http::status::method_not_allowed;
             throw std::invalid_argument("Invalid method");
         }
     }
     catch(std::exception& e)
     {
-        // here we should execute the error response coroutine
-        // but we need special handling because you can't call
-        // a coroutine in an exception handler
-        std::cerr << e.what() << '\n';
+        // you can't call a coroutine in an exception handler, so note the error and
+        // send the response below
+        error_message = e.what();
     }
 
-    
-}
+    if (!error_message.empty())
+    {
+        co_await send_file_error(stream, request, status, std::move(error_message));
+        co_return;
+    }
 
-http_handler_element http_endpoints[] = {
-    std::make_tuple(std::regex("/file/.*"), handle_http_file),
-}
+    if (cached)
+    {
+        // hot path: the headers were serialized when the file was loaded, so the whole
+        // response goes out in one gather write. The corked layer keeps the entry alive
+        // until then, rather than copying its bytes.
+        if (request[beast::http::field::if_none_match] == cached->etag)
+            co_await visit([&cached](auto* pstream) {
+                pstream->hold(cached->not_modified_buffer(), cached);
+                return asio::async_write(*pstream, cached->not_modified_buffer(), asio::use_awaitable);
+            }, stream);
+        else
+            co_await visit([&cached](auto* pstream) {
+                for (auto const& b : cached->buffers())
+                    pstream->hold(b, cached);
+                return asio::async_write(*pstream, cached->buffers(), asio::use_awaitable);
+            }, stream);
+        co_return;
+    }
 
-asio::awaitable<void>
-handle_default_request(
-    beast::http::request_parser<beast::http::string_body>& parser, 
-    var_stream_ptr stream, 
-    beast::flat_buffer& rxbuffer)
-{
-    bool error = false;
-    auto& req = parser.get();
-    auto olen = req.payload_size();
-    if (!olen || *olen > 1'000'000)
-        error = true;
+    // Write the header only. The content length is set by hand, and the body is then
+    // sent straight from the file without passing through a string_body.
+    auto resp = beast::http::response<beast::http::empty_body>(beast::http::status::ok, request.version());
+    auto const type = mime_type(path);
+    resp.set(beast::http::field::content_type, beast::string_view(type.data(), type.size()));
+    resp.content_length(size);
+    resp.keep_alive(request.keep_alive());
 
-    if (!error && !parser.is_done())
-    {
-        // complete reading the rest of the message
-        co_await visit([&rxbuffer, &parser](auto* pstream) 
-        {
-            return beast::http::async_read_some(
+    co_await visit([&resp](auto* pstream) {
+        return 
+            beast::http::async_write(
                 *pstream, 
-                rxbuffer, 
-                parser, 
+                resp, 
                 asio::use_awaitable);
-        }, stream);
-    }
+    }, stream);
 
-    auto narrate = [](boost::optional<std::size_t> const& o) -> std::string
-    {
-        if (o)
-            return std::to_string(*o);
-        else
-            return "unspecified number of";
-    };
-
-    beast::http::response<beast::http::string_body> resp;
-    resp.result(beast::http::status::not_found);
-    resp.set("Content-Type", "text/plain");
-    std::ostringstream ss;
-    ss << "Thank you for your " << req.method_string() << " request containing " << narrate(olen) << " bytes\n"
-    << req.target() << " was not found on this server. Please try again.\n";
-    resp.body() = ss.str();
+    // sendfile(2) on plain tcp, a fixed-size buffer on tls
+    co_await visit([&file, size](auto* pstream) {
+        return send_file(*pstream, file, 0, size);
+    }, stream);
+}
+
+/// Serve every thread's metrics, in the Prometheus text format.
+asio::awaitable<void>
+handle_metrics(
+    request_body_reader& body, 
+    var_stream_ptr stream, 
+    route_params const&)
+{
+    auto& request = body.request();
+    auto resp = beast::http::response<beast::http::string_body>(beast::http::status::ok, request.version());
+    resp.set(beast::http::field::content_type, "text/plain; version=0.0.4");
+    resp.keep_alive(request.keep_alive());
+    resp.body() = render_metrics();
     resp.prepare_payload();
 
     co_await visit([&resp](auto* pstream) {
@@ -365,14 +675,105 @@ handle_default_request(
                 resp, 
                 asio::use_awaitable);
     }, stream);
+}
+
+/// Run an http handler, recording its latency under its route.
+asio::awaitable<void>
+run_timed(route_metric_id id,
+    std::function<http_handler_sig> const& handler,
+    request_body_reader& body, 
+    var_stream_ptr stream, 
+    route_params const& params)
+{
+    auto const start = metric_histogram::clock_type::now();
+    co_await handler(body, stream, params);
+    this_thread_metrics().http_handler[id].record_since(start);
+}
+
+/// Routes for plain http requests. Compiled once, on first use.
+http_router const&
+http_endpoints()
+{
+    static const auto endpoints = []
+    {
+        auto r = http_router();
+
+        // every handler's latency is recorded under its route. The router outlives the 
+        // wrappers' calls, so they may refer to the handlers they wrap.
+        auto add = [&r](std::string_view route, std::function<http_handler_sig> handler)
+        {
+            r.add(route, [id = register_route_metric(route), handler = std::move(handler)]
+                (request_body_reader& body, var_stream_ptr stream, route_params const& params)
+                {
+                    return run_timed(id, handler, body, stream, params);
+                });
+        };
+        add("/file/{path:path}", handle_http_file);
+        add("/metrics", handle_metrics);
+        return r;
+    }();
+    return endpoints;
+}
 
+/// Routes for websocket upgrades. Compiled once, on first use.
+websocket_router const&
+websocket_endpoints()
+{
+    static const auto endpoints = []
+    {
+        auto r = websocket_router();
+        r.add("/topic/{topic}", topic_websock_app);
+        r.add("/echo", echo_websock_app);
+        return r;
+    }();
+    return endpoints;
+}
 
-    if(error)
-        throw std::invalid_argument("request too big");
+asio::awaitable<void>
+handle_default_request(
+    request_body_reader& body, 
+    var_stream_ptr stream)
+{
+    auto& req = body.request();
+
+    // the body is counted as it arrives, and never held
+    while (!body.done())
+        co_await body.read_some();
+
+    // only the text varies; the headers come from the template
+    static constexpr std::string_view thanks = "Thank you for your ";
+    static constexpr std::string_view containing = " request containing ";
+    static constexpr std::string_view bytes_suffix = " bytes\n";
+    static constexpr std::string_view try_again = " was not found on this server. Please try again.\n";
+
+    char bytes[20];
+    auto const bytes_end = std::to_chars(std::begin(bytes), std::end(bytes), body.bytes_read()).ptr;
+
+    auto text = std::string();
+    text.reserve(thanks.size() + req.method_string().size() + containing.size() + 20 + 
+        bytes_suffix.size() + req.target().size() + try_again.size());
+    text += thanks;
+    text.append(req.method_string().data(), req.method_string().size());
+    text += containing;
+    text.append(bytes, bytes_end);
+    text += bytes_suffix;
+    text.append(req.target().data(), req.target().size());
+    text += try_again;
+
+    auto const out = response_buffers(common_response(beast::http::status::not_found), req, text);
+    co_await visit([&out](auto* pstream) {
+        // common templates are never freed, so the corked layer need not copy them
+        pstream->hold(out.head());
+        return asio::async_write(*pstream, out.data(), asio::use_awaitable);
+    }, stream);
 }
 
 
 
+/// Serve http requests on a connection until it closes, times out or is upgraded.
+/// Requests may be pipelined. Responses are written to a corked layer which holds them back
+/// until the next read would have to wait for the client, so the responses to every request
+/// already in rx_buffer go out together in one gather write.
 template<class Stream>
 asio::awaitable<void>
 chat_http(Stream& stream, beast::flat_buffer& rx_buffer)
@@ -382,60 +783,119 @@ chat_http(Stream& stream, beast::flat_buffer& rx_buffer)
     auto ident = beast::get_lowest_layer(stream).remote_endpoint();
     auto me = object_id(__func__, ident);
 
+    auto out = corked_stream<Stream&>(stream);
+    out.cork();
+    out.flush_before_read(true);
 
-    auto timer = asio::steady_timer(co_await asio::this_coro::executor);
+    auto& wheel = timer_wheel::of(co_await asio::this_coro::executor);
 
     auto again = true;
     while(again)
     {
+        // the body is streamed by request_body_reader, so its size is not limited here
         auto parser = beast::http::request_parser<beast::http::string_body>();
+        parser.body_limit(std::numeric_limits<std::uint64_t>::max());
 
+        auto const read_start = metric_histogram::clock_type::now();
         auto which = co_await (
-            read_header_only(stream, rx_buffer, parser) ||
-            timeout(timer, 30s)
+            read_header_only(out, rx_buffer, parser) ||
+            timeout(wheel, 30s)
         );
 
         // break on timeout
         if(which.index() == 1)
             break;
+        this_thread_metrics().http_header_read.record_since(read_start);
 
         auto& request = parser.get();
-        std::cout << me << "header received:\n" << request;
+        log_debug(me, "header received: ", request.method_string(), ' ', request.target());
+        this_thread_metrics().http_requests.add();
 
-        again = !request.need_eof();
-        auto const target = request.target();
+        // once the client has asked for the connection to close, later pipelined requests
+        // are ignored. While draining for a restart, each connection ends after its current
+        // request, and the client reconnects to the successor.
+        again = !request.need_eof() && !draining.load(std::memory_order_relaxed);
+        auto params = route_params();
 
         if (beast::websocket::is_upgrade(request))
         {
+            auto const target = std::string_view(request.target().data(), request.target().size());
+
+            // responses to earlier pipelined requests go before the upgrade
+            co_await out.async_flush(asio::use_awaitable);
+
             // upgrade to websocket
-            auto websock = std::make_shared<any_websocket>(std::move(stream), std::move(rx_buffer));
+            auto websock = std::make_shared<any_websocket>(std::move(stream), std::move(rx_buffer), websock_codec);
             co_await websock->accept(request);
 
-            using generator_sig = asio::awaitable<void>(std::shared_ptr<any_websocket>, beast::http::request<beast::http::string_body>&);
-            using generator_type = std::function<generator_sig>;
-            using element_type = std::tuple<std::regex, generator_type>;
-            static const std::vector<element_type> generators;
-
-            for (auto&& [re, gen] : generators)
-                if (std::regex_match(target.begin(), target.end(), re))
-                    co_return co_await gen(websock, request);
+            if (auto gen = websocket_endpoints().match(target, params))
+                co_return co_await (*gen)(websock, request, params);
             co_return co_await default_websock_app(websock, request);
         }
         else
         {
-            auto handled = false;
-            for(auto&& [handler, gen] : http_endpoints)
-                if (std::regex_match(target.begin(), target.end(), re)) 
-                {
-                    handled = true;
-                    co_return co_await handler(parser, var_stream_ptr(&stream), rx_buffer);
-                    break;
-                }
-            // handle http request
-            co_await handle_default_request(parser, var_stream_ptr(&stream), rx_buffer);
+            // handle http request. The handler reads as much of the body as it wants.
+            auto body = request_body_reader(std::move(parser), var_stream_ptr(&out), rx_buffer);
+            auto const target = std::string_view(body.request().target().data(), body.request().target().size());
+            if (auto handler = http_endpoints().match(target, params))
+                co_await (*handler)(body, var_stream_ptr(&out), params);
+            else
+            {
+                static const auto default_route = register_route_metric("default");
+                auto const start = metric_histogram::clock_type::now();
+                co_await handle_default_request(body, var_stream_ptr(&out));
+                this_thread_metrics().http_handler[default_route].record_since(start);
+            }
+
+            // the rest of an unread body is in the way of the next request
+            if (!body.done())
+                again = false;
         }
     }
 
+    co_await out.async_flush(asio::use_awaitable);
+}
+
+auto
+start_handshake(asio::ssl::stream<asio::ip::tcp::socket>& stream, asio::const_buffer initial)
+{
+    return stream.async_handshake(asio::ssl::stream_base::server, initial, asio::use_awaitable);
+}
+
+auto
+start_handshake(ktls_stream& stream, asio::const_buffer initial)
+{
+    return stream.async_handshake(initial, asio::use_awaitable);
+}
+
+/// Complete the tls handshake on a new connection, then serve http over it.
+/// @param rx_buffer holds the bytes read while detecting tls, which begin the handshake.
+template<class TlsStream>
+asio::awaitable<void>
+chat_tls(TlsStream stream, beast::flat_buffer& rx_buffer, timer_wheel& wheel)
+{
+    using namespace asioex::awaitable_operators;
+
+    auto ident = beast::get_lowest_layer(stream).remote_endpoint();
+    auto me = object_id(__func__, ident);
+
+    auto const start = metric_histogram::clock_type::now();
+    auto which = co_await (
+        start_handshake(stream, rx_buffer.data()) ||
+        timeout(wheel, 5s)
+    );
+
+    if (which.index() == 0)
+    {
+        tls_session_cache::record_handshake(stream.native_handle());
+        this_thread_metrics().tls_handshake.record_since(start);
+        rx_buffer.consume(std::get<0>(which));
+        co_await chat_http(stream, rx_buffer);
+    }
+    else
+    {
+        log_info(me, "handshake timeout on tls connection");
+    }
 }
 
 asio::awaitable< void >
@@ -448,50 +908,39 @@ chat(asio::ip::tcp::socket sock, asio::ssl::context& sslctx)
     try
     {
         auto const me = object_id(__func__, ident);
-        std::cout << me << "accepted\n";
+        log_debug(me, "accepted");
 
-        auto timer     = asio::steady_timer(co_await asio::this_coro::executor);
+        auto& wheel    = timer_wheel::of(co_await asio::this_coro::executor);
         auto rx_buffer = beast::flat_buffer();
         auto which = co_await(
             detect_ssl(sock, rx_buffer) || 
-            timeout(timer, 5s)
+            timeout(wheel, 5s)
         );
 
         if (which.index() == 1)
         {
-            std::cout << me << "client didn't speak\n";
+            log_info(me, "client didn't speak");
             co_return;
         }
 
+        auto& metrics = this_thread_metrics();
         if (auto is_ssl = std::get<0>(which) ; is_ssl)
         {
-            std::cout << me << "ssl detected\n";
-            auto ssl_stream = asio::ssl::stream<asio::ip::tcp::socket>(std::move(sock), sslctx);
-            auto which = co_await (
-                ssl_stream.async_handshake(
-                    asio::ssl::stream_base::server, 
-                    rx_buffer.data(),
-                    asio::use_awaitable) ||
-                timeout(timer, 5s)
-            );
-
-            if (which.index() == 0)
-            {
-                rx_buffer.consume(std::get<0>(which));
-                co_await chat_http(ssl_stream, rx_buffer);
-            }
+            metrics.connections_tls.add();
+            log_debug(me, "ssl detected");
+            if (ktls_enabled(sslctx))
+                co_await chat_tls(ktls_stream(std::move(sock), sslctx), rx_buffer, wheel);
             else
-            {
-                std::cout << me << "handshake timeout on tls connection\n";
-            }
+                co_await chat_tls(asio::ssl::stream<asio::ip::tcp::socket>(std::move(sock), sslctx), rx_buffer, wheel);
         }
         else
         {
-            std::cout << me << "tcp detected\n";
+            log_debug(me, "tcp detected");
+            metrics.connections_plain.add();
             co_await chat_http(sock, rx_buffer);
         }
 
-        std::cout << me << "exit\n";
+        log_debug(me, "exit");
     }
     catch(const std::exception& e)
     {
@@ -499,65 +948,161 @@ chat(asio::ip::tcp::socket sock, asio::ssl::context& sslctx)
     }
 }
 
+/// Socket option allowing several acceptors to bind the same port. The kernel then load-balances
+/// incoming connections across them.
+using reuse_port = asio::detail::socket_option::boolean< SOL_SOCKET, SO_REUSEPORT >;
+
+/// Listen on a new socket.
+/// @param share_port sets SO_REUSEPORT, so that each io thread can have a socket of its own.
+/// Left off otherwise, so that no other process can bind the port and take a share of its
+/// connections.
 void 
-start_listening(asio::ip::tcp::acceptor& acceptor, asio::ip::address_v4 address, unsigned short port)
+start_listening(asio::ip::tcp::acceptor& acceptor, asio::ip::address_v4 address, unsigned short port, bool share_port)
 {
     using namespace asio::ip;
 
     acceptor.open(tcp::v4());
     acceptor.set_option(tcp::acceptor::reuse_address(true));
+    if (share_port)
+        acceptor.set_option(reuse_port(true));
     acceptor.bind(tcp::endpoint(address, port));
     acceptor.listen();
 
 }
 
+/// Admission control settings for each listener.
+struct listen_options
+{
+    /// Most connections open on this listener at once
+    std::size_t max_connections = 10000;
+
+    /// Number of accepts kept in flight, so that a burst of connections is taken from the
+    /// backlog without waiting for each new connection to be spawned
+    std::size_t concurrent_accepts = 4;
+};
+
+/// One of a listener's accept loops. Takes a connection slot before each accept, so that at
+/// the limit the loop stops accepting until a connection closes.
 asio::awaitable< void >
-listen(program_stop_sink pstop, asio::ssl::context& sslctx)
-try
+accept_loop(asio::ip::tcp::acceptor& acceptor, 
+    std::shared_ptr< connection_limiter > limiter, 
+    program_stop_sink pstop, 
+    asio::ssl::context& sslctx)
 {
     using namespace asioex::awaitable_operators;
 
-    std::cout << "creating acceptor\n";
-    auto acceptor = asio::ip::tcp::acceptor(co_await asio::this_coro::executor);
-    start_listening(acceptor, asio::ip::address_v4::any(), 8080);
-
+    auto exec = co_await asio::this_coro::executor;
     for (;;)
     {
-        std::cout << object_id(__func__) << "accepting...\n";
-        auto sock = asio::ip::tcp::socket(co_await asio::this_coro::executor);
-        co_await acceptor.async_accept(sock, asio::use_awaitable);
-        auto ident = sock.remote_endpoint();
-        std::cout << object_id(__func__) << "connection accepted from " << ident << '\n';
+        co_await limiter->acquire();
+
+        log_trace(object_id(__func__), "accepting...");
+        auto sock = asio::ip::tcp::socket(exec);
+        auto ident = asio::ip::tcp::endpoint();
+        auto [ec] = co_await acceptor.async_accept(sock, ident, asioex::as_tuple(asio::use_awaitable));
+        if (ec)
+        {
+            limiter->release();
+            // a closed acceptor has been handed to a successor
+            if (ec == asio::error::operation_aborted || !acceptor.is_open())
+                throw system_error(asio::error::operation_aborted);
+
+            // out of file descriptors, or the like: back off rather than spin
+            log_warn(object_id(__func__), "accept failed: ", ec.message());
+            co_await delay(100ms);
+            continue;
+        }
+
+        limiter->admitted();
+        this_thread_metrics().connections_accepted.add();
+        log_debug(object_id(__func__), "connection accepted from ", ident);
 
-        auto connection_end = [ident](std::exception_ptr ep)
+        auto connection_end = [ident, limiter](std::exception_ptr ep)
         {
+            limiter->closed();
             try {
                 if (ep) 
                     std::rethrow_exception(ep);
-                std::cout << object_id("connection", ident) << "ended without exception\n";
+                log_debug(object_id("connection", ident), "ended without exception");
             }
             catch(std::exception& e)
             {
-                std::cerr << object_id("connection", ident) << "exception : " << e.what() << '\n';
+                log_error(object_id("connection", ident), "exception : ", e.what());
             }
-
         };
 
         // spawn a new connection, but make sure it receives a cancel signal if the program_stop_sink
         // is signalled. i.e. if the program wants to stop, the connections should shutdown gracefully
         // at their earliest convenience. 
         asio::co_spawn(
-            co_await asio::this_coro::executor,
+            exec,
             chat(std::move(sock), sslctx) || 
             pstop(asio::use_awaitable),
-            asio::detached);
+            connection_end);
+    }
+}
+
+/// Accept connections on this thread's listening sockets until the program stops.
+/// If the sockets are closed because they have been handed to a successor, carry on until the
+/// program stops, so that open connections can finish.
+asio::awaitable< void >
+listen(program_stop_sink pstop, 
+    asio::ssl::context& sslctx, 
+    listen_options opts, 
+    std::vector< asio::ip::tcp::acceptor >& acceptors)
+try
+{
+    using namespace asioex::awaitable_operators;
+
+    auto exec = co_await asio::this_coro::executor;
+
+    // the limiter outlives the listener while connections remain open
+    auto limiter = std::make_shared< connection_limiter >(exec, opts.max_connections);
+
+    auto accepts = accept_loop(acceptors.front(), limiter, pstop, sslctx);
+    for (auto& acceptor : acceptors)
+        for (std::size_t i = &acceptor == &acceptors.front(); i < opts.concurrent_accepts; ++i)
+            accepts = std::move(accepts) && accept_loop(acceptor, limiter, pstop, sslctx);
+
+    auto handed_off = false;
+    try
+    {
+        co_await std::move(accepts);
+    }
+    catch (system_error& e)
+    {
+        if (e.code() != asio::error::operation_aborted || acceptors.front().is_open())
+            throw;
+        handed_off = true;
+    }
+
+    if (handed_off)
+    {
+        log_info(object_id(__func__), "stopped accepting");
+        co_await pstop(asio::use_awaitable);
     }
 
-    std::cout << object_id(__func__) << "exit\n";
+    log_info(object_id(__func__), "exit");
 }
 catch (std::exception &e)
 {
-    std::cerr << object_id("listen") << "exception : " << e.what() << '\n';
+    log_error(object_id("listen"), "exception : ", e.what());
+}
+
+/// Log the number of open connections and the rate of accepts at debug level, every interval.
+asio::awaitable< void >
+monitor_connections(std::chrono::milliseconds interval)
+{
+    auto last = connection_limiter::totals();
+    for (;;)
+    {
+        co_await delay(interval);
+        auto const now = connection_limiter::totals();
+        auto const seconds = std::chrono::duration< double >(interval).count();
+        log_debug(object_id(__func__), "connections: ", now.live, ", accepts/s: ", 
+            double(now.accepted - last.accepted) / seconds);
+        last = now;
+    }
 }
 
 auto
@@ -576,47 +1121,333 @@ try
         std::cout << msg;
     }
     pstop.signal(4, "interrupted");
-    std::cout << object_id(__func__) << "exit\n";
+    log_info(object_id(__func__), "exit");
+}
+catch(std::exception& e)
+{
+    log_error(object_id(__func__), "exception : ", e.what());
+    throw;
+}
+
+/// The listening sockets of one io_context, which are only touched on its thread.
+struct thread_listeners
+{
+    asio::any_io_executor exec;
+    std::vector< asio::ip::tcp::acceptor > acceptors;
+};
+
+/// Longest a restarted instance waits for its open connections to finish, from the
+/// environment. WEBSERVER_DRAIN_SECONDS defaults to 30.
+/// @throw std::invalid_argument if it is not a number of seconds.
+std::chrono::seconds
+drain_timeout()
+{
+    auto seconds = 30u;
+    if (auto env = std::getenv("WEBSERVER_DRAIN_SECONDS"))
+    {
+        auto arg = std::string_view(env);
+        auto [ptr, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), seconds);
+        if (ec != std::errc() || ptr != arg.data() + arg.size())
+            throw std::invalid_argument("WEBSERVER_DRAIN_SECONDS must be a number of seconds");
+    }
+    return std::chrono::seconds(seconds);
+}
+
+/// How this instance restarts, settled once at startup
+struct restart_options
+{
+    /// the executable, from successor_executable()
+    std::string executable;
+
+    /// the program's argument vector, as passed to main
+    char** argv;
+
+    /// longest to wait for open connections to finish once the successor has the sockets
+    std::chrono::seconds drain_timeout;
+};
+
+/// On SIGUSR2, restart without refusing a connection. A new instance of the program is started
+/// and handed the listening sockets. Once it has taken them, this instance stops accepting and
+/// stops when its open connections have finished, or after the drain timeout.
+/// If the successor fails to start, this instance carries on as before.
+asio::awaitable< void >
+monitor_restart(program_stop_source pstop, restart_options const& restart, std::vector< thread_listeners >& listeners)
+try
+{
+    auto me = object_id(__func__);
+    auto sigs = asio::signal_set(co_await asio::this_coro::executor, SIGUSR2);
+
+    // descriptors are read here but the acceptors are only closed on their own threads
+    auto fds = std::vector< int >();
+    for (auto& l : listeners)
+        for (auto& acceptor : l.acceptors)
+            fds.push_back(acceptor.native_handle());
+
+    for (;;)
+    {
+        co_await wait_signal(sigs);
+        log_info(me, "restarting");
+        if (co_await hand_off_listeners(fds, restart.executable, restart.argv, 10s))
+            break;
+        log_error(me, "restart failed, still serving");
+    }
+
+    draining.store(true, std::memory_order_relaxed);
+    for (auto& l : listeners)
+        asio::post(l.exec, [&acceptors = l.acceptors]
+        {
+            for (auto& acceptor : acceptors)
+                acceptor.close();
+        });
+
+    auto const deadline = std::chrono::steady_clock::now() + restart.drain_timeout;
+    while (connection_limiter::totals().live && std::chrono::steady_clock::now() < deadline)
+        co_await delay(100ms);
+
+    log_info(me, "connections left open: ", connection_limiter::totals().live);
+    pstop.signal(0, "restarted");
 }
 catch(std::exception& e)
 {
-    std::cout << object_id(__func__) << "exception : " << e.what() << "\n";
+    log_error(object_id(__func__), "exception : ", e.what());
     throw;
 }
 
+/// A worker io_context's stop source, together with the executor on which it must be signalled.
+struct worker_stop
+{
+    asio::any_io_executor exec;
+    program_stop_source source;
+};
+
 asio::awaitable< void >
-co_main(program_stop_source pstop, asio::ssl::context& sslctx)
+co_main(program_stop_source pstop, 
+    asio::ssl::context& sslctx, 
+    tls_session_cache& sessions, 
+    listen_options opts,
+    restart_options const& restart,
+    std::vector< thread_listeners >& listeners,
+    std::vector< worker_stop >& workers)
 {
     using namespace asioex::awaitable_operators;
 
     co_await(
-        listen(pstop, sslctx) || 
-        monitor_sigint(pstop)
+        listen(pstop, sslctx, opts, listeners[0].acceptors) || 
+        monitor_sigint(pstop) ||
+        monitor_restart(pstop, restart, listeners) ||
+        monitor_connections(10s) ||
+        file_cache().watch() ||
+        sessions.run_key_rotation()
     );
+
+    // Relay the stop to every worker. A stop source is only ever touched on its own io_context's thread.
+    auto const sink = program_stop_sink(pstop);
+    for (auto& w : workers)
+        asio::post(w.exec, [source = w.source, code = sink.retcode(), message = sink.message()]() mutable
+        {
+            source.signal(code, message);
+        });
 }
 
+asio::awaitable< void >
+co_worker(program_stop_source pstop, 
+    asio::ssl::context& sslctx, 
+    listen_options opts, 
+    std::vector< asio::ip::tcp::acceptor >& acceptors)
+{
+    using namespace asioex::awaitable_operators;
+
+    auto stopped = program_stop_sink(pstop);
+    co_await(
+        listen(pstop, sslctx, opts, acceptors) || 
+        stopped(asio::use_awaitable)
+    );
+}
+
+/// Load the server's certificate chain and private key from the PEM files named by 
+/// WEBSERVER_TLS_CERT and WEBSERVER_TLS_KEY. Without them, TLS handshakes will fail.
+void
+load_certificate(asio::ssl::context& sslctx)
+{
+    auto cert = std::getenv("WEBSERVER_TLS_CERT");
+    auto key = std::getenv("WEBSERVER_TLS_KEY");
+    if (!cert || !key)
+    {
+        log_warn(object_id(__func__), "WEBSERVER_TLS_CERT and WEBSERVER_TLS_KEY not set, tls disabled");
+        return;
+    }
+
+    sslctx.use_certificate_chain_file(cert);
+    sslctx.use_private_key_file(key, asio::ssl::context::pem);
+}
+
+/// Listener settings from the environment, for one of several listeners.
+/// WEBSERVER_MAX_CONNECTIONS is the most connections open at once across all listeners.
+/// Defaults to 10000.
+listen_options
+listen_options_for(std::size_t listeners)
+{
+    auto opts = listen_options();
+    if (auto env = std::getenv("WEBSERVER_MAX_CONNECTIONS"))
+    {
+        auto arg = std::string_view(env);
+        auto [ptr, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), opts.max_connections);
+        if (ec != std::errc() || ptr != arg.data() + arg.size())
+            throw std::invalid_argument("WEBSERVER_MAX_CONNECTIONS must be a number");
+    }
+
+    // each listener takes an equal share, rounded up
+    opts.max_connections = (opts.max_connections + listeners - 1) / listeners;
+    return opts;
+}
+
+/// Run the server.
+/// @param threads is the number of io_contexts to run, each on its own thread and with its own acceptor.
+/// Zero means one per hardware thread.
+/// @param argv is the program's argument vector, with which a successor is started on restart.
 auto 
-run_program()
+run_program(std::size_t threads, char** argv)
 -> program_stop_sink
 {
         auto sslctx = asio::ssl::context(asio::ssl::context_base::tls_server);
-        auto ioc = asio::io_context();
-        auto exec = ioc.get_executor();
-        auto pstop = program_stop_source(exec);
+        load_certificate(sslctx);
+        // WEBSERVER_KTLS hands tls record encryption to the kernel, where it is supported
+        if (std::getenv("WEBSERVER_KTLS"))
+            enable_ktls(sslctx);
+        auto sessions = tls_session_cache(sslctx);
+        auto pool = io_context_pool(threads);
+        log_info(object_id(__func__), "io backend: ", asio_backend, ", threads: ", pool.size());
+        auto const opts = listen_options_for(pool.size());
+
+        // settled now, so that a bad setting stops the program here rather than mid-restart,
+        // once the listeners have already been handed off
+        auto const restart = restart_options { successor_executable(argv[0]), argv, drain_timeout() };
+
+        // the primary io_context owns the program's stop source and monitors signals
+        auto pstop = program_stop_source(pool[0].get_executor());
         auto stopsink = program_stop_sink(pstop);
-        asio::co_spawn(ioc, 
-            co_main(std::move(pstop), sslctx), 
+
+        // each io_context gets its own broadcast hub, installed before any connection runs on it
+        for (std::size_t i = 0; i < pool.size(); ++i)
+        {
+            auto exec = pool[i].get_executor();
+            auto h = all_hubs.emplace_back(std::make_unique< thread_hub >()).get();
+            h->exec = exec;
+            asio::post(exec, [h] { this_thread_hub = h; });
+        }
+
+        // Listening sockets handed over by a predecessor are shared round robin between the
+        // io_contexts. A predecessor with fewer threads may not have shared its port, so those
+        // left without one accept on a duplicate of an inherited socket rather than binding
+        // their own. Without a predecessor, each listens on a new socket.
+        auto inherited = inherited_listeners::receive();
+        auto listeners = std::vector< thread_listeners >();
+        for (std::size_t i = 0; i < pool.size(); ++i)
+            listeners.push_back(thread_listeners { pool[i].get_executor(), {} });
+        for (std::size_t i = 0; i < inherited.fds.size(); ++i)
+        {
+            auto& l = listeners[i % pool.size()];
+            l.acceptors.emplace_back(l.exec, asio::ip::tcp::v4(), inherited.fds[i]);
+        }
+        for (std::size_t i = inherited.fds.size(); i < pool.size(); ++i)
+        {
+            auto& l = listeners[i];
+            if (inherited.fds.empty())
+            {
+                start_listening(l.acceptors.emplace_back(l.exec), asio::ip::address_v4::any(), 8080, pool.size() > 1);
+                continue;
+            }
+
+            auto fd = ::dup(inherited.fds[i % inherited.fds.size()]);
+            if (fd < 0)
+                throw system_error(error_code(errno, asio::error::get_system_category()), "dup");
+            l.acceptors.emplace_back(l.exec, asio::ip::tcp::v4(), fd);
+        }
+        if (!inherited.fds.empty())
+            log_info(object_id(__func__), "took ", inherited.fds.size(), " listening sockets from predecessor");
+        inherited.acknowledge();
+
+        auto workers = std::vector< worker_stop >();
+        workers.reserve(pool.size() - 1);
+        for (std::size_t i = 1; i < pool.size(); ++i)
+        {
+            auto exec = pool[i].get_executor();
+            auto& w = workers.emplace_back(worker_stop { exec, program_stop_source(exec) });
+            asio::co_spawn(exec, 
+                co_worker(w.source, sslctx, opts, listeners[i].acceptors), 
+                asio::detached);
+        }
+
+        asio::co_spawn(pool[0], 
+            co_main(std::move(pstop), sslctx, sessions, opts, restart, listeners, workers), 
             asio::detached);
-        ioc.run();
+        pool.run();
+
+        log_info(object_id(__func__), "tls handshakes: ", sessions.full_handshakes(), " full, ", 
+            sessions.resumed_handshakes(), " resumed");
+
+        auto const connections = connection_limiter::totals();
+        log_info(object_id(__func__), "connections accepted: ", connections.accepted);
+
+        // the io threads have exited, so their counts are in the totals
+        auto const allocs = recycling_allocator::total_stats();
+        auto const requests = metric_total(&thread_metrics::http_requests);
+        log_info(object_id(__func__), "http requests: ", requests, ", allocations: ", allocs.allocations,
+            ", from malloc: ", allocs.heap(), ", from malloc per request: ", 
+            requests ? double(allocs.heap()) / double(requests) : 0.0);
         return stopsink;
 }
 
+/// Parse the thread count from the command line. 
+/// Usage: webserver [threads]  where threads is a number, or 0 for one per core. Defaults to 1.
+std::size_t
+parse_threads(int argc, char** argv)
+{
+    if (argc < 2)
+        return 1;
+
+    auto arg = std::string_view(argv[1]);
+    std::size_t threads = 1;
+    auto [ptr, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), threads);
+    if (ec != std::errc() || ptr != arg.data() + arg.size())
+        throw std::invalid_argument("usage: webserver [threads]");
+    return threads;
+}
+
+/// Logger configuration from the environment.
+/// WEBSERVER_LOG_LEVEL is one of trace, debug, info, warn, error or off. Defaults to info.
+logger_options
+log_options()
+{
+    auto opts = logger_options();
+    if (auto level = std::getenv("WEBSERVER_LOG_LEVEL"))
+        opts.level = parse_log_level(level);
+    return opts;
+}
+
 int
-main()
+main(int argc, char** argv)
+try
 {
-    const auto stopsink = run_program();
+    // WEBSERVER_RECYCLING=0 sends every allocation to malloc, to compare against
+    if (auto recycling = std::getenv("WEBSERVER_RECYCLING"))
+        recycling_allocator::enable(std::string_view(recycling) != "0");
+
+    // WEBSERVER_WS_CODEC=native frames websockets with native_websock instead of beast
+    if (auto codec = std::getenv("WEBSERVER_WS_CODEC"))
+        websock_codec = std::string_view(codec) == "native" ? websocket_codec::native : websocket_codec::beast;
+
+    logger::instance().start(log_options());
+    struct stop_logger { ~stop_logger() { logger::instance().stop(); } } stop_logger_on_exit;
+
+    const auto stopsink = run_program(parse_threads(argc, argv), argv);
 
     if (stopsink.retcode())
         std::cerr << "webserver: " << stopsink.message() << '\n';
     return stopsink.retcode();
 }
+catch(std::exception& e)
+{
+    std::cerr << "webserver: " << e.what() << '\n';
+    return 127;
+}
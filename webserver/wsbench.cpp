@@ -0,0 +1,364 @@
+#include "asio.hpp"
+#include "beast.hpp"
+#include "io_context_pool.hpp"
+#include "latency_histogram.hpp"
+
+#include <boost/beast/http.hpp>
+
+#include <charconv>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/resource.h>
+
+// Load generator for webserver.
+// Opens many concurrent plain or TLS connections to a server on this machine and drives
+// keep-alive HTTP GETs, or websocket messages which the server echoes back, then reports
+// throughput and latency percentiles.
+//
+// With -r, requests are sent on a fixed schedule spread evenly over the connections, and
+// latency is measured from the time each request was due to be sent. This avoids coordinated
+// omission: a stalled server is charged for the requests it held up. Without -r, each
+// connection sends its next request as soon as the previous response arrives.
+
+using namespace std::literals;
+using clock_type = std::chrono::steady_clock;
+
+enum class bench_mode
+{
+    http,
+    websocket
+};
+
+struct bench_options
+{
+    bench_mode mode = bench_mode::http;
+    bool tls        = false;
+    std::string host = "127.0.0.1";
+    unsigned short port = 8080;
+    std::string target;
+    std::size_t connections = 100;
+    std::size_t threads     = 1;
+    std::chrono::seconds duration { 10 };
+
+    /// requests per second across all connections, or zero for closed loop
+    double rate = 0;
+
+    /// websocket message size in bytes
+    std::size_t message_size = 64;
+};
+
+/// Results gathered by one thread. Only touched by that thread until the run is over.
+struct thread_stats
+{
+    latency_histogram latency;
+    std::uint64_t requests        = 0;
+    std::uint64_t errors          = 0;
+    std::uint64_t connect_errors  = 0;
+    std::uint64_t connections_up  = 0;
+};
+
+/// Decides when a connection sends its next request.
+struct pacer
+{
+    pacer(bench_options const& opts, std::size_t index)
+    : paced_(opts.rate > 0)
+    {
+        if (paced_)
+        {
+            interval_ = std::chrono::duration_cast< clock_type::duration >(
+                std::chrono::duration< double >(double(opts.connections) / opts.rate));
+
+            // stagger the connections so that the load is even, rather than in bursts
+            next_ = clock_type::now() + interval_ * index / opts.connections;
+        }
+    }
+
+    /// Wait until the next request is due.
+    /// @return the time from which the request's latency is measured
+    asio::awaitable< clock_type::time_point >
+    wait(asio::steady_timer& timer)
+    {
+        if (!paced_)
+            co_return clock_type::now();
+
+        auto const due = next_;
+        next_ += interval_;
+        if (due > clock_type::now())
+        {
+            timer.expires_at(due);
+            co_await timer.async_wait(asio::use_awaitable);
+        }
+        co_return due;
+    }
+
+private:
+    bool paced_;
+    clock_type::duration interval_ {};
+    clock_type::time_point next_ {};
+};
+
+template < class Stream >
+asio::awaitable< void >
+drive_http(Stream& stream, bench_options const& opts, thread_stats& stats, clock_type::time_point deadline, std::size_t index)
+{
+    namespace http = beast::http;
+
+    auto req = http::request< http::empty_body >(http::verb::get, opts.target, 11);
+    req.set(http::field::host, opts.host);
+    req.set(http::field::user_agent, "wsbench");
+    req.keep_alive(true);
+
+    auto timer  = asio::steady_timer(co_await asio::this_coro::executor);
+    auto pace   = pacer(opts, index);
+    auto buffer = beast::flat_buffer();
+
+    while (clock_type::now() < deadline)
+    {
+        auto const start = co_await pace.wait(timer);
+        co_await http::async_write(stream, req, asio::use_awaitable);
+
+        auto res = http::response< http::string_body >();
+        co_await http::async_read(stream, buffer, res, asio::use_awaitable);
+        stats.latency.record(std::chrono::duration_cast< std::chrono::nanoseconds >(clock_type::now() - start).count());
+        ++stats.requests;
+
+        if (res.result_int() >= 500)
+            ++stats.errors;
+        if (!res.keep_alive())
+            break;
+    }
+}
+
+template < class Stream >
+asio::awaitable< void >
+drive_websocket(Stream& stream, bench_options const& opts, thread_stats& stats, clock_type::time_point deadline, std::size_t index)
+{
+    auto ws = beast::websocket::stream< Stream& >(stream);
+    co_await ws.async_handshake(opts.host, opts.target, asio::use_awaitable);
+
+    auto const message = std::string(opts.message_size, 'x');
+    auto timer  = asio::steady_timer(co_await asio::this_coro::executor);
+    auto pace   = pacer(opts, index);
+    auto buffer = beast::flat_buffer();
+
+    while (clock_type::now() < deadline)
+    {
+        auto const start = co_await pace.wait(timer);
+        co_await ws.async_write(asio::buffer(message), asio::use_awaitable);
+        co_await ws.async_read(buffer, asio::use_awaitable);
+        stats.latency.record(std::chrono::duration_cast< std::chrono::nanoseconds >(clock_type::now() - start).count());
+        ++stats.requests;
+
+        if (buffer.size() != message.size())
+            ++stats.errors;
+        buffer.consume(buffer.size());
+    }
+
+    co_await ws.async_close(beast::websocket::close_code::normal, asio::use_awaitable);
+}
+
+template < class Stream >
+asio::awaitable< void >
+drive(Stream& stream, bench_options const& opts, thread_stats& stats, clock_type::time_point deadline, std::size_t index)
+{
+    if (opts.mode == bench_mode::http)
+        co_await drive_http(stream, opts, stats, deadline, index);
+    else
+        co_await drive_websocket(stream, opts, stats, deadline, index);
+}
+
+asio::awaitable< void >
+connection(asio::ip::tcp::endpoint ep,
+           bench_options const& opts,
+           asio::ssl::context& sslctx,
+           thread_stats& stats,
+           clock_type::time_point deadline,
+           std::size_t index)
+{
+    auto sock = asio::ip::tcp::socket(co_await asio::this_coro::executor);
+    try
+    {
+        co_await sock.async_connect(ep, asio::use_awaitable);
+        sock.set_option(asio::ip::tcp::no_delay(true));
+    }
+    catch (std::exception&)
+    {
+        ++stats.connect_errors;
+        co_return;
+    }
+    ++stats.connections_up;
+
+    try
+    {
+        if (opts.tls)
+        {
+            auto stream = asio::ssl::stream< asio::ip::tcp::socket >(std::move(sock), sslctx);
+            co_await stream.async_handshake(asio::ssl::stream_base::client, asio::use_awaitable);
+            co_await drive(stream, opts, stats, deadline, index);
+        }
+        else
+            co_await drive(sock, opts, stats, deadline, index);
+    }
+    catch (std::exception&)
+    {
+        ++stats.errors;
+    }
+}
+
+/// Give up on connections which are still waiting for a response after the deadline.
+asio::awaitable< void >
+wait_until(clock_type::time_point when)
+{
+    auto timer = asio::steady_timer(co_await asio::this_coro::executor, when);
+    co_await timer.async_wait(asio::use_awaitable);
+}
+
+/// Allow as many file descriptors as the hard limit permits, since every connection needs one.
+void
+raise_fd_limit()
+{
+    auto lim = rlimit();
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+}
+
+const char* const usage =
+    "usage: wsbench [--http | --ws] [--tls] [-c connections] [-t threads] [-d seconds]\n"
+    "               [-r requests_per_second] [--size bytes] [--target path] [--host address] [--port port]";
+
+template < class T >
+T
+parse_number(std::string_view s)
+{
+    T value {};
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+    if (ec != std::errc() || ptr != s.data() + s.size())
+        throw std::invalid_argument(usage);
+    return value;
+}
+
+bench_options
+parse_options(int argc, char** argv)
+{
+    auto opts = bench_options();
+    auto args = std::vector< std::string_view >(argv + 1, argv + argc);
+
+    for (std::size_t i = 0; i < args.size(); ++i)
+    {
+        auto const arg = args[i];
+        auto value     = [&] {
+            if (++i == args.size())
+                throw std::invalid_argument(usage);
+            return args[i];
+        };
+
+        if (arg == "--http")
+            opts.mode = bench_mode::http;
+        else if (arg == "--ws")
+            opts.mode = bench_mode::websocket;
+        else if (arg == "--tls")
+            opts.tls = true;
+        else if (arg == "-c")
+            opts.connections = parse_number< std::size_t >(value());
+        else if (arg == "-t")
+            opts.threads = parse_number< std::size_t >(value());
+        else if (arg == "-d")
+            opts.duration = std::chrono::seconds(parse_number< unsigned >(value()));
+        else if (arg == "-r")
+            opts.rate = parse_number< double >(value());
+        else if (arg == "--size")
+            opts.message_size = parse_number< std::size_t >(value());
+        else if (arg == "--target")
+            opts.target = value();
+        else if (arg == "--host")
+            opts.host = value();
+        else if (arg == "--port")
+            opts.port = parse_number< unsigned short >(value());
+        else
+            throw std::invalid_argument(usage);
+    }
+
+    if (opts.target.empty())
+        opts.target = opts.mode == bench_mode::http ? "/" : "/echo";
+    if (opts.connections == 0)
+        throw std::invalid_argument(usage);
+    return opts;
+}
+
+void
+report(bench_options const& opts, thread_stats const& total, double seconds)
+{
+    auto us = [](std::uint64_t ns) { return double(ns) / 1000.0; };
+
+    std::cout << (opts.mode == bench_mode::http ? "http" : "websocket") << (opts.tls ? " over tls" : "") << " to "
+              << opts.host << ':' << opts.port << opts.target << '\n'
+              << "connections : " << total.connections_up << " up, " << total.connect_errors << " failed\n"
+              << "requests    : " << total.requests << " in " << seconds << "s, " << total.errors << " errors\n"
+              << "throughput  : " << double(total.requests) / seconds << " req/s\n"
+              << std::fixed << std::setprecision(1)
+              << "latency (us): min " << us(total.latency.min())
+              << "  p50 " << us(total.latency.value_at_percentile(50))
+              << "  p99 " << us(total.latency.value_at_percentile(99))
+              << "  p99.9 " << us(total.latency.value_at_percentile(99.9))
+              << "  max " << us(total.latency.max())
+              << "  mean " << total.latency.mean() / 1000.0 << '\n';
+}
+
+int
+main(int argc, char** argv)
+try
+{
+    using namespace asioex::awaitable_operators;
+
+    auto const opts = parse_options(argc, argv);
+    auto const address = asio::ip::make_address(opts.host);
+    if (!address.is_loopback())
+        throw std::invalid_argument("wsbench only targets servers on this machine");
+
+    raise_fd_limit();
+
+    auto sslctx = asio::ssl::context(asio::ssl::context::tls_client);
+    sslctx.set_verify_mode(asio::ssl::verify_none);
+
+    auto pool  = io_context_pool(opts.threads);
+    auto stats = std::vector< thread_stats >(pool.size());
+    auto const ep       = asio::ip::tcp::endpoint(address, opts.port);
+    auto const start    = clock_type::now();
+    auto const deadline = start + opts.duration;
+
+    for (std::size_t i = 0; i < opts.connections; ++i)
+    {
+        auto const t = i % pool.size();
+        asio::co_spawn(pool[t],
+            connection(ep, opts, sslctx, stats[t], deadline, i) ||
+            wait_until(deadline + 2s),
+            asio::detached);
+    }
+    pool.run();
+
+    auto const elapsed = std::chrono::duration< double >(std::min(clock_type::now(), deadline) - start).count();
+    auto total = thread_stats();
+    for (auto& s : stats)
+    {
+        total.latency.merge(s.latency);
+        total.requests += s.requests;
+        total.errors += s.errors;
+        total.connect_errors += s.connect_errors;
+        total.connections_up += s.connections_up;
+    }
+    report(opts, total, elapsed);
+}
+catch (std::exception& e)
+{
+    std::cerr << "wsbench: " << e.what() << '\n';
+    return 1;
+}
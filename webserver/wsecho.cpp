@@ -1,23 +1,235 @@
 #include "asio.hpp"
 #include "beast.hpp"
+#include "any_websocket.hpp"
+#include "io_context_pool.hpp"
+#include "latency_histogram.hpp"
 #include "program_stop_source.hpp"
 #include "program_stop_sink.hpp"
 #include "interrupt.hpp"
 
-int 
-main()
+#include <boost/beast/http.hpp>
+
+#include <charconv>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+// Websocket echo server, used as the performance reference for any_websocket::read() and
+// any_websocket::write(). Every message is sent back with the type it arrived with, written
+// straight from the receive buffer. Throughput and the time taken to echo each message are
+// reported when the server is interrupted. --native selects native_websock in place of beast's
+// websocket stream, which cannot be combined with --deflate.
+
+using clock_type = std::chrono::steady_clock;
+
+struct echo_options
 {
+    std::size_t threads = 1;
+    unsigned short port = 8080;
+    std::string cert_file;
+    std::string key_file;
+    bool deflate = false;
+    websocket_codec codec = websocket_codec::beast;
 
-    auto ioc = asio::io_context();
-    auto e = ioc.get_executor();
+    bool
+    tls() const { return !cert_file.empty(); }
+};
 
-    auto stpsrc = program_stop_source(e);
-    asio::co_spawn(e, 
-        monitor_interrupt(stpsrc), 
-        asio::detached);
-    ioc.run();
+/// Counters for one thread. Only touched by that thread until the server stops.
+struct echo_stats
+{
+    std::uint64_t connections = 0;
+    std::uint64_t messages    = 0;
+    std::uint64_t bytes       = 0;
+
+    /// time from a message being read to its echo being written, in nanoseconds
+    latency_histogram latency;
+};
+
+/// Socket option allowing each thread's acceptor to bind the same port.
+using reuse_port = asio::detail::socket_option::boolean< SOL_SOCKET, SO_REUSEPORT >;
+
+asio::awaitable< void >
+echo(std::shared_ptr< any_websocket > ws, echo_stats& stats)
+{
+    for (;;)
+    {
+        auto frame = co_await ws->read();
+        auto const start = clock_type::now();
+        co_await ws->write(frame);
+
+        stats.latency.record(std::chrono::duration_cast< std::chrono::nanoseconds >(clock_type::now() - start).count());
+        ++stats.messages;
+        stats.bytes += frame.as_string().size();
+    }
+}
+
+template < class Stream >
+asio::awaitable< void >
+upgrade(Stream stream, beast::flat_buffer rxbuf, echo_options const& opts, echo_stats& stats)
+{
+    auto request = any_websocket::request_type();
+    co_await beast::http::async_read(stream, rxbuf, request, asio::use_awaitable);
+    if (!beast::websocket::is_upgrade(request))
+        co_return;
+
+    auto ws = std::make_shared< any_websocket >(std::move(stream), std::move(rxbuf), opts.codec);
+    auto compression = compression_options();
+    compression.enabled = opts.deflate;
+    co_await ws->accept(request, compression);
+    ++stats.connections;
+    co_await echo(ws, stats);
+}
+
+asio::awaitable< void >
+session(asio::ip::tcp::socket sock, asio::ssl::context& sslctx, echo_options const& opts, echo_stats& stats)
+try
+{
+    sock.set_option(asio::ip::tcp::no_delay(true));
+    if (opts.tls())
+    {
+        auto stream = tls_transport(std::move(sock), sslctx);
+        co_await stream.async_handshake(asio::ssl::stream_base::server, asio::use_awaitable);
+        co_await upgrade(std::move(stream), beast::flat_buffer(), opts, stats);
+    }
+    else
+        co_await upgrade(std::move(sock), beast::flat_buffer(), opts, stats);
+}
+catch (std::exception&)
+{
+    // the client went away
+}
+
+asio::awaitable< void >
+listen(asio::ssl::context& sslctx, echo_options const& opts, echo_stats& stats, bool share_port)
+{
+    auto exec     = co_await asio::this_coro::executor;
+    auto acceptor = asio::ip::tcp::acceptor(exec);
+    acceptor.open(asio::ip::tcp::v4());
+    acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+    if (share_port)
+        acceptor.set_option(reuse_port(true));
+    acceptor.bind(asio::ip::tcp::endpoint(asio::ip::address_v4::any(), opts.port));
+    acceptor.listen();
 
+    for (;;)
+    {
+        auto sock = co_await acceptor.async_accept(asio::use_awaitable);
+        asio::co_spawn(exec, session(std::move(sock), sslctx, opts, stats), asio::detached);
+    }
+}
+
+void
+report(echo_stats const& total, double seconds)
+{
+    auto us = [](std::uint64_t ns) { return double(ns) / 1000.0; };
+
+    std::cout << "connections : " << total.connections << '\n'
+              << "messages    : " << total.messages << " in " << seconds << "s, "
+              << double(total.messages) / seconds << " msg/s\n"
+              << "bytes       : " << total.bytes << ", " << double(total.bytes) / seconds / 1e6 << " MB/s\n"
+              << std::fixed << std::setprecision(1)
+              << "echo (us)   : p50 " << us(total.latency.value_at_percentile(50))
+              << "  p99 " << us(total.latency.value_at_percentile(99))
+              << "  p99.9 " << us(total.latency.value_at_percentile(99.9))
+              << "  max " << us(total.latency.max()) << '\n';
+}
+
+const char* const usage = "usage: wsecho [-t threads] [--port port] [--deflate | --native] [--tls cert.pem key.pem]";
+
+echo_options
+parse_options(int argc, char** argv)
+{
+    auto opts = echo_options();
+    auto args = std::vector< std::string_view >(argv + 1, argv + argc);
+
+    auto number = [](std::string_view s, auto& out) {
+        auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), out);
+        if (ec != std::errc() || ptr != s.data() + s.size())
+            throw std::invalid_argument(usage);
+    };
+
+    for (std::size_t i = 0; i < args.size(); ++i)
+    {
+        auto value = [&] {
+            if (++i == args.size())
+                throw std::invalid_argument(usage);
+            return args[i];
+        };
+
+        if (args[i] == "-t")
+            number(value(), opts.threads);
+        else if (args[i] == "--port")
+            number(value(), opts.port);
+        else if (args[i] == "--deflate")
+            opts.deflate = true;
+        else if (args[i] == "--native")
+            opts.codec = websocket_codec::native;
+        else if (args[i] == "--tls")
+        {
+            opts.cert_file = value();
+            opts.key_file  = value();
+        }
+        else
+            throw std::invalid_argument(usage);
+    }
+    if (opts.deflate && opts.codec == websocket_codec::native)
+        throw std::invalid_argument(usage);
+    return opts;
+}
+
+int
+main(int argc, char** argv)
+try
+{
+    auto const opts = parse_options(argc, argv);
+
+    auto sslctx = asio::ssl::context(asio::ssl::context::tls_server);
+    if (opts.tls())
+    {
+        sslctx.use_certificate_chain_file(opts.cert_file);
+        sslctx.use_private_key_file(opts.key_file, asio::ssl::context::pem);
+    }
+
+    auto pool  = io_context_pool(opts.threads);
+    auto stats = std::vector< echo_stats >(pool.size());
+    for (std::size_t i = 0; i < pool.size(); ++i)
+        asio::co_spawn(pool[i], listen(sslctx, opts, stats[i], pool.size() > 1), asio::detached);
+
+    // on interrupt, stop every thread. The counters are read once they have all been joined.
+    auto stpsrc = program_stop_source(pool[0].get_executor());
     auto stpsnk = program_stop_sink(stpsrc);
+    asio::co_spawn(pool[0],
+        monitor_interrupt(stpsrc),
+        asio::detached);
+    stpsnk([&pool](error_code)
+    {
+        for (std::size_t i = 0; i < pool.size(); ++i)
+            pool[i].stop();
+    });
+
+    auto const start = clock_type::now();
+    pool.run();
+    auto const elapsed = std::chrono::duration< double >(clock_type::now() - start).count();
 
+    auto total = echo_stats();
+    for (auto& s : stats)
+    {
+        total.connections += s.connections;
+        total.messages += s.messages;
+        total.bytes += s.bytes;
+        total.latency.merge(s.latency);
+    }
+
+    std::cout << "wsecho: " << stpsnk.message() << '\n';
+    report(total, elapsed);
     return stpsnk.retcode();
-}
\ No newline at end of file
+}
+catch (std::exception& e)
+{
+    std::cerr << "wsecho: " << e.what() << '\n';
+    return 127;
+}